@@ -0,0 +1,519 @@
+#include "analysis.hpp"
+#include <algorithm>
+
+namespace compiler {
+
+// loop iterations before bounds which keep growing are widened
+static constexpr int widen_after = 2;
+
+LengthInterval LengthInterval::join(const LengthInterval &b) const {
+	return {std::min(lo, b.lo), std::max(hi, b.hi)};
+}
+
+static uint64_t saturatingAdd(uint64_t a, uint64_t b) {
+	return a > LengthInterval::unbounded - b ? LengthInterval::unbounded
+	                                         : a + b;
+}
+
+static uint64_t saturatingMul(uint64_t a, uint64_t b) {
+	return b != 0 && a > LengthInterval::unbounded / b
+	           ? LengthInterval::unbounded
+	           : a * b;
+}
+
+LengthInterval LengthInterval::operator+(const LengthInterval &b) const {
+	return {saturatingAdd(lo, b.lo), saturatingAdd(hi, b.hi)};
+}
+
+LengthInterval LengthInterval::operator*(uint64_t times) const {
+	return {saturatingMul(lo, times), saturatingMul(hi, times)};
+}
+
+LengthInterval LengthInterval::operator*(const LengthInterval &b) const {
+	return {saturatingMul(lo, b.lo), saturatingMul(hi, b.hi)};
+}
+
+// A length repeated times. A length above max_string_length fails at
+// runtime before a later * 0 can make it empty, so its bound is kept.
+static LengthInterval repeated(const LengthInterval &len,
+                               const LengthInterval &times) {
+	auto result = len * times;
+	if (len.hi > max_string_length) {
+		result.hi = std::max(result.hi, len.hi);
+	}
+	return result;
+}
+
+// The length of a literal-only item or expression, nullopt if it reads a
+// variable or is longer than max_folded_length
+static std::optional<uint64_t> literalLength(const ExpressionNode &node);
+
+static std::optional<uint64_t> literalLength(const ItemNode &node) {
+	if (!node.repeat_variables.empty()) {
+		return std::nullopt;
+	}
+	std::optional<uint64_t> len;
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(StringFactorNode)) {
+		len = dynamic_cast<const StringFactorNode &>(factor).str.size();
+	} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		len = literalLength(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression);
+	}
+	if (len.has_value() && *len > max_folded_length) {
+		return std::nullopt;
+	}
+	for (auto repeat_time : node.repeat_times) {
+		if (!len.has_value() || repeat_time < 0) {
+			return std::nullopt;
+		}
+		*len = saturatingMul(*len, repeat_time);
+		// checked before a later * 0, which must not hide a value too long
+		// to be built at runtime
+		if (*len > max_folded_length) {
+			return std::nullopt;
+		}
+	}
+	return len;
+}
+
+static std::optional<uint64_t> literalLength(const ExpressionNode &node) {
+	if (node.items.empty()) {
+		return std::nullopt; // an error left to LLVMCodeGen
+	}
+	uint64_t len = 0;
+	for (auto &item : node.items) {
+		auto item_len = literalLength(*item);
+		if (!item_len.has_value()) {
+			return std::nullopt;
+		}
+		len += *item_len;
+	}
+	if (len > max_folded_length) {
+		return std::nullopt;
+	}
+	return len;
+}
+
+static void appendLiteral(const ExpressionNode &node, std::string &out);
+
+static void appendLiteral(const ItemNode &node, std::string &out) {
+	auto begin = out.size();
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(StringFactorNode)) {
+		out += dynamic_cast<const StringFactorNode &>(factor).str;
+	} else {
+		appendLiteral(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression,
+		    out);
+	}
+	for (auto repeat_time : node.repeat_times) {
+		auto len = out.size() - begin;
+		if (len == 0) {
+			break; // repeating an empty string keeps it empty
+		}
+		if (repeat_time == 0) {
+			out.resize(begin);
+		}
+		for (int64_t i = 1; i < repeat_time; i++) {
+			out.append(out, begin, len);
+		}
+	}
+}
+
+static void appendLiteral(const ExpressionNode &node, std::string &out) {
+	for (auto &item : node.items) {
+		appendLiteral(*item, out);
+	}
+}
+
+std::optional<std::string> literalValue(const ItemNode &node) {
+	auto len = literalLength(node);
+	if (!len.has_value()) {
+		return std::nullopt;
+	}
+	std::string value;
+	value.reserve(*len);
+	appendLiteral(node, value);
+	return value;
+}
+
+std::optional<std::string> literalValue(const ExpressionNode &node) {
+	auto len = literalLength(node);
+	if (!len.has_value()) {
+		return std::nullopt;
+	}
+	std::string value;
+	value.reserve(*len);
+	appendLiteral(node, value);
+	return value;
+}
+
+void collectReads(const ExpressionNode &node, std::set<std::string> &reads) {
+	for (auto &item : node.items) {
+		reads.insert(item->repeat_variables.begin(),
+		             item->repeat_variables.end());
+		auto &factor = *item->factor;
+		if (typeid(factor) == typeid(VariableFactorNode)) {
+			reads.insert(
+			    dynamic_cast<const VariableFactorNode &>(factor).identifier);
+		} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+			collectReads(
+			    *dynamic_cast<const ExpressionFactorNode &>(factor).expression,
+			    reads);
+		}
+	}
+}
+
+bool isIntExpression(const ExpressionNode &node,
+                     const std::set<std::string> &int_variables) {
+	auto &factor = *node.items.at(0)->factor;
+	if (typeid(factor) == typeid(IntegerFactorNode)) {
+		return true;
+	} else if (typeid(factor) == typeid(VariableFactorNode)) {
+		return int_variables.contains(
+		    dynamic_cast<const VariableFactorNode &>(factor).identifier);
+	} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		return isIntExpression(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression,
+		    int_variables);
+	}
+	return false;
+}
+
+std::vector<StatementRun>
+independentRuns(const StatementsNode &node,
+                const std::set<std::string> &int_variables) {
+	std::vector<StatementRun> runs;
+	// of the current run
+	std::set<std::string> reads;
+	std::set<std::string> assigned;
+	for (size_t idx = 0; idx < node.statements.size(); idx++) {
+		auto &statement = *node.statements[idx];
+		auto *assign = dynamic_cast<const AssignStatementNode *>(&statement);
+		if (assign == nullptr || int_variables.contains(assign->variable)) {
+			runs.push_back({idx, idx + 1});
+			reads.clear();
+			assigned.clear();
+			continue;
+		}
+		std::set<std::string> statement_reads;
+		collectReads(*assign->expression, statement_reads);
+		bool independent = !runs.empty() && !assigned.empty() &&
+		                   !reads.contains(assign->variable) &&
+		                   !assigned.contains(assign->variable);
+		for (auto &name : statement_reads) {
+			independent = independent && !assigned.contains(name);
+		}
+		if (independent) {
+			runs.back().end = idx + 1;
+		} else {
+			runs.push_back({idx, idx + 1});
+			reads.clear();
+			assigned.clear();
+		}
+		reads.insert(statement_reads.begin(), statement_reads.end());
+		assigned.insert(assign->variable);
+	}
+	return runs;
+}
+
+LengthAnalysis::LengthAnalysis(const ProgramNode &program) {
+	State state;
+	for (auto &name : program.variables->identifiers) {
+		state[name] = {0, 0}; // null reads as an empty string
+	}
+	for (auto &name : program.variables->temporaries) {
+		state[name] = {0, 0};
+	}
+	for (auto &name : program.int_variables->identifiers) {
+		state[name] = {0, 0};
+	}
+	visitStatements(*program.statements, std::move(state));
+}
+
+std::optional<LengthInterval>
+LengthAnalysis::lengthOf(const VariableFactorNode &node) const {
+	auto it = variable_lengths.find(&node);
+	if (it == variable_lengths.end()) {
+		return std::nullopt;
+	}
+	return it->second;
+}
+
+std::optional<LengthInterval>
+LengthAnalysis::lengthOf(const ItemNode &node) const {
+	std::optional<LengthInterval> len;
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(StringFactorNode)) {
+		auto size = dynamic_cast<const StringFactorNode &>(factor).str.size();
+		len = LengthInterval{size, size};
+	} else if (typeid(factor) == typeid(IntegerFactorNode)) {
+		uint64_t value = dynamic_cast<const IntegerFactorNode &>(factor).value;
+		len = LengthInterval{value, value};
+	} else if (typeid(factor) == typeid(VariableFactorNode)) {
+		len = lengthOf(dynamic_cast<const VariableFactorNode &>(factor));
+	} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		len = lengthOf(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression);
+	} else {
+		throw std::runtime_error("Unknown factor");
+	}
+	if (!len.has_value()) {
+		return std::nullopt;
+	}
+	for (auto repeat_time : node.repeat_times) {
+		uint64_t times = std::max<int64_t>(repeat_time, 0);
+		*len = repeated(*len, {times, times});
+	}
+	if (!node.repeat_variables.empty()) {
+		auto it = repeat_counts.find(&node);
+		if (it == repeat_counts.end()) {
+			return std::nullopt;
+		}
+		*len = repeated(*len, it->second);
+	}
+	return len;
+}
+
+std::optional<LengthInterval>
+LengthAnalysis::lengthOf(const ExpressionNode &node) const {
+	LengthInterval len;
+	for (auto &item : node.items) {
+		auto item_len = lengthOf(*item);
+		if (!item_len.has_value()) {
+			return std::nullopt;
+		}
+		len = len + *item_len;
+	}
+	return len;
+}
+
+std::optional<bool> LengthAnalysis::decided(const ConditionNode &node) const {
+	auto it = condition_results.find(&node);
+	if (it == condition_results.end()) {
+		return std::nullopt;
+	}
+	return it->second;
+}
+
+std::optional<LengthAnalysis::State>
+LengthAnalysis::stateBefore(const StatementNode &node) const {
+	auto it = statement_states.find(&node);
+	if (it == statement_states.end()) {
+		return std::nullopt;
+	}
+	return it->second;
+}
+
+LengthInterval LengthAnalysis::visitFactor(const FactorNode &node,
+                                           const State &state) {
+	if (typeid(node) == typeid(StringFactorNode)) {
+		auto size = dynamic_cast<const StringFactorNode &>(node).str.size();
+		return {size, size};
+	} else if (typeid(node) == typeid(IntegerFactorNode)) {
+		uint64_t value = dynamic_cast<const IntegerFactorNode &>(node).value;
+		return {value, value};
+	} else if (typeid(node) == typeid(VariableFactorNode)) {
+		auto &variable = dynamic_cast<const VariableFactorNode &>(node);
+		auto it = state.find(variable.identifier);
+		if (it == state.end()) {
+			// reported by codegen
+			return {0, LengthInterval::unbounded};
+		}
+		// The same node is visited once per loop iteration of the analysis
+		auto [record, inserted] =
+		    variable_lengths.try_emplace(&variable, it->second);
+		if (!inserted) {
+			record->second = record->second.join(it->second);
+		}
+		return it->second;
+	} else if (typeid(node) == typeid(ExpressionFactorNode)) {
+		return visitExpression(
+		    *dynamic_cast<const ExpressionFactorNode &>(node).expression,
+		    state);
+	} else {
+		throw std::runtime_error("Unknown factor");
+	}
+}
+
+LengthInterval LengthAnalysis::visitItem(const ItemNode &node,
+                                         const State &state) {
+	auto len = visitFactor(*node.factor, state);
+	for (auto repeat_time : node.repeat_times) {
+		uint64_t times = std::max<int64_t>(repeat_time, 0);
+		len = repeated(len, {times, times});
+	}
+	if (!node.repeat_variables.empty()) {
+		LengthInterval count{1, 1};
+		for (auto &name : node.repeat_variables) {
+			auto it = state.find(name);
+			count = count * (it == state.end()
+			                     ? LengthInterval{0, LengthInterval::unbounded}
+			                     : it->second);
+		}
+		auto [record, inserted] = repeat_counts.try_emplace(&node, count);
+		if (!inserted) {
+			record->second = record->second.join(count);
+		}
+		len = repeated(len, count);
+	}
+	return len;
+}
+
+LengthInterval LengthAnalysis::visitExpression(const ExpressionNode &node,
+                                               const State &state) {
+	LengthInterval len;
+	for (auto &item : node.items) {
+		len = len + visitItem(*item, state);
+	}
+	return len;
+}
+
+std::optional<bool> LengthAnalysis::visitCondition(const ConditionNode &node,
+                                                   const State &state) {
+	auto lhs = visitExpression(*node.lhs, state);
+	auto rhs = visitExpression(*node.rhs, state);
+	std::optional<bool> result;
+	switch (node.op) {
+	case RelationOp::LESS:
+		if (lhs.hi < rhs.lo) {
+			result = true;
+		} else if (lhs.lo >= rhs.hi) {
+			result = false;
+		}
+		break;
+	case RelationOp::GREATER:
+		if (lhs.lo > rhs.hi) {
+			result = true;
+		} else if (lhs.hi <= rhs.lo) {
+			result = false;
+		}
+		break;
+	case RelationOp::LESS_EQUAL:
+		if (lhs.hi <= rhs.lo) {
+			result = true;
+		} else if (lhs.lo > rhs.hi) {
+			result = false;
+		}
+		break;
+	case RelationOp::GREATER_EQUAL:
+		if (lhs.lo >= rhs.hi) {
+			result = true;
+		} else if (lhs.hi < rhs.lo) {
+			result = false;
+		}
+		break;
+	case RelationOp::EQUAL:
+	case RelationOp::NOT_EQUAL:
+		// only strings of different lengths are known to differ
+		if (lhs.hi < rhs.lo || rhs.hi < lhs.lo) {
+			result = node.op == RelationOp::NOT_EQUAL;
+		}
+		break;
+	}
+	if (lhs.hi > max_string_length || rhs.hi > max_string_length) {
+		// an operand may fail at runtime, which deciding the condition
+		// without evaluating it would skip
+		result = std::nullopt;
+	}
+	auto [record, inserted] = condition_results.try_emplace(&node, result);
+	if (!inserted && record->second != result) {
+		record->second = std::nullopt;
+	}
+	return result;
+}
+
+static LengthAnalysis::State joinStates(const LengthAnalysis::State &a,
+                                        const LengthAnalysis::State &b) {
+	auto result = a;
+	for (auto &[name, len] : b) {
+		auto [it, inserted] = result.try_emplace(name, len);
+		if (!inserted) {
+			it->second = it->second.join(len);
+		}
+	}
+	return result;
+}
+
+LengthAnalysis::State LengthAnalysis::visitStatements(const StatementsNode &node,
+                                                      State state) {
+	for (auto &statement : node.statements) {
+		auto [record, inserted] =
+		    statement_states.try_emplace(&*statement, state);
+		if (!inserted) {
+			record->second = joinStates(record->second, state);
+		}
+		state = visitStatement(*statement, std::move(state));
+	}
+	return state;
+}
+
+LengthAnalysis::State LengthAnalysis::visitStatement(const StatementNode &node,
+                                                     State state) {
+	if (typeid(node) == typeid(AssignStatementNode)) {
+		auto &assign = dynamic_cast<const AssignStatementNode &>(node);
+		state[assign.variable] = visitExpression(*assign.expression, state);
+		return state;
+	} else if (typeid(node) == typeid(IfStatementNode)) {
+		return visitIfStatement(dynamic_cast<const IfStatementNode &>(node),
+		                        std::move(state));
+	} else if (typeid(node) == typeid(DoWhileStatementNode)) {
+		return visitDoWhileStatement(
+		    dynamic_cast<const DoWhileStatementNode &>(node), state);
+	} else if (typeid(node) == typeid(ReleaseStatementNode)) {
+		state[dynamic_cast<const ReleaseStatementNode &>(node).variable] = {0,
+		                                                                    0};
+		return state;
+	} else {
+		throw std::runtime_error("Unknown statement");
+	}
+}
+
+LengthAnalysis::State LengthAnalysis::visitIfStatement(const IfStatementNode &node,
+                                                       State state) {
+	// A branch which the lengths rule out is not visited
+	auto result = visitCondition(*node.condition, state);
+	if (result == true) {
+		return visitStatements(*node.true_action, std::move(state));
+	} else if (result == false) {
+		return visitStatements(*node.false_action, std::move(state));
+	}
+	return joinStates(visitStatements(*node.true_action, state),
+	                  visitStatements(*node.false_action, state));
+}
+
+LengthAnalysis::State
+LengthAnalysis::visitDoWhileStatement(const DoWhileStatementNode &node,
+                                      const State &state) {
+	// The state at the head of the loop joins the state before the loop and
+	// the state at the end of each iteration which loops back, until it no
+	// longer changes. Bounds still moving after widen_after iterations are
+	// dropped, so that this terminates.
+	auto head = state;
+	for (int iteration = 0;; iteration++) {
+		auto end = visitStatements(*node.loop_action, head);
+		auto result = visitCondition(*node.condition, end);
+		if (result == false) {
+			return end;
+		}
+		auto next = joinStates(state, end);
+		if (iteration >= widen_after) {
+			for (auto &[name, len] : next) {
+				auto &prev = head[name];
+				if (len.lo < prev.lo) {
+					len.lo = 0;
+				}
+				if (len.hi > prev.hi) {
+					len.hi = LengthInterval::unbounded;
+				}
+			}
+		}
+		if (next == head) {
+			return end;
+		}
+		head = std::move(next);
+	}
+}
+
+} // namespace compiler
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "ast.hpp"
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <vector>
+
+namespace compiler {
+
+// A range of string lengths or int values, hi == unbounded if there is no
+// upper bound
+struct LengthInterval {
+	static constexpr uint64_t unbounded = UINT64_MAX;
+
+	uint64_t lo = 0;
+	uint64_t hi = 0;
+
+	bool isExact() const {
+		return lo == hi;
+	}
+	bool operator==(const LengthInterval &) const = default;
+	LengthInterval join(const LengthInterval &b) const;
+	LengthInterval operator+(const LengthInterval &b) const;
+	LengthInterval operator*(uint64_t times) const;
+	LengthInterval operator*(const LengthInterval &b) const;
+};
+
+// Longer strings are a runtime error in the compiled program, so that their
+// sizes never overflow 64 bits
+static constexpr uint64_t max_string_length = INT64_MAX;
+
+// Literal-only expressions up to this length are computed at compile time
+// and stored in the program. Longer ones are cheaper to build at runtime
+// than to load from a bloated executable.
+static constexpr uint64_t max_folded_length = 1 << 16;
+
+// The value of an item or expression made only of literals, nullopt if it
+// reads a variable or is longer than max_folded_length
+std::optional<std::string> literalValue(const ItemNode &node);
+std::optional<std::string> literalValue(const ExpressionNode &node);
+
+// Adds the variables an expression reads to reads
+void collectReads(const ExpressionNode &node, std::set<std::string> &reads);
+
+// Whether an expression adds ints rather than concatenating strings. The
+// TAC has checked that its items all have the same type.
+bool isIntExpression(const ExpressionNode &node,
+                     const std::set<std::string> &int_variables);
+
+// Consecutive statements [begin, end) of a StatementsNode
+struct StatementRun {
+	size_t begin;
+	size_t end;
+};
+
+// Splits the statements into maximal runs of assignments where none reads
+// or assigns a variable which another one assigns, so that they give the
+// same result in any order. Any other statement is a run of its own, and
+// so is an assignment to one of int_variables, which takes a single add.
+std::vector<StatementRun>
+independentRuns(const StatementsNode &node,
+                const std::set<std::string> &int_variables);
+
+// Forward dataflow analysis of the lengths of all variables at every point
+// of the program. Conditions which the lengths decide are taken into
+// account, so code they make unreachable doesn't widen the results. An int
+// variable is tracked by its value, which is never negative and compares
+// like a length, since ints only start at 0 and add up literals.
+class LengthAnalysis {
+  public:
+	// lengths or values of the variables at a point of the program
+	using State = std::map<std::string, LengthInterval>;
+
+	explicit LengthAnalysis(const ProgramNode &program);
+
+	// The length of a variable where it is read, nullopt if never reached
+	std::optional<LengthInterval>
+	lengthOf(const VariableFactorNode &node) const;
+	// The length of an item or expression, nullopt if never reached
+	std::optional<LengthInterval> lengthOf(const ItemNode &node) const;
+	std::optional<LengthInterval> lengthOf(const ExpressionNode &node) const;
+	// The result of a condition, nullopt unless the same in every execution
+	std::optional<bool> decided(const ConditionNode &node) const;
+	// The lengths right before a statement, nullopt if never reached
+	std::optional<State> stateBefore(const StatementNode &node) const;
+
+  private:
+	std::map<const VariableFactorNode *, LengthInterval> variable_lengths;
+	// nullopt once two executions disagree
+	std::map<const ConditionNode *, std::optional<bool>> condition_results;
+	std::map<const StatementNode *, State> statement_states;
+	// the product of the repeat_variables of an item
+	std::map<const ItemNode *, LengthInterval> repeat_counts;
+
+	LengthInterval visitExpression(const ExpressionNode &node,
+	                               const State &state);
+	LengthInterval visitItem(const ItemNode &node, const State &state);
+	LengthInterval visitFactor(const FactorNode &node, const State &state);
+	std::optional<bool> visitCondition(const ConditionNode &node,
+	                                   const State &state);
+	State visitStatements(const StatementsNode &node, State state);
+	State visitStatement(const StatementNode &node, State state);
+	State visitIfStatement(const IfStatementNode &node, State state);
+	State visitDoWhileStatement(const DoWhileStatementNode &node,
+	                            const State &state);
+};
+
+} // namespace compiler
@@ -8,12 +8,12 @@ std::ostream &operator<<(std::ostream &out, const ASTNode &ast) {
 }
 
 void ProgramNode::print_json(std::ostream &out) const {
-	out << R"({"variables":)" << *variables << R"(,"statements":)"
-	    << *statements << R"(})";
+	out << R"({"variables":)" << *variables << R"(,"int_variables":)"
+	    << *int_variables << R"(,"statements":)" << *statements << R"(})";
 }
 
 void VariableDeclarationNode::print_json(std::ostream &out) const {
-	out << R"({"type":"string","identifiers":[)";
+	out << R"({"type":")" << type << R"(","identifiers":[)";
 	bool first = true;
 	for (const auto &identifier : identifiers) {
 		if (first) {
@@ -23,7 +23,21 @@ void VariableDeclarationNode::print_json(std::ostream &out) const {
 		}
 		out << '"' << identifier << '"';
 	}
-	out << R"(]})";
+	out << ']';
+	if (!temporaries.empty()) {
+		out << R"(,"temporaries":[)";
+		first = true;
+		for (const auto &temporary : temporaries) {
+			if (first) {
+				first = false;
+			} else {
+				out << ",";
+			}
+			out << '"' << temporary << '"';
+		}
+		out << ']';
+	}
+	out << '}';
 }
 
 void StatementsNode::print_json(std::ostream &out) const {
@@ -55,6 +69,10 @@ void DoWhileStatementNode::print_json(std::ostream &out) const {
 	    << R"(,"loop_action":)" << *loop_action << R"(})";
 }
 
+void ReleaseStatementNode::print_json(std::ostream &out) const {
+	out << R"({"type":"release","variable":")" << variable << R"("})";
+}
+
 void ConditionNode::print_json(std::ostream &out) const {
 	out << R"({"op":")";
 	switch (op) {
@@ -105,13 +123,31 @@ void ItemNode::print_json(std::ostream &out) const {
 		}
 		out << repeat_time;
 	}
-	out << R"(]})";
+	out << ']';
+	if (!repeat_variables.empty()) {
+		out << R"(,"repeat_variables":[)";
+		first = true;
+		for (const auto &repeat_variable : repeat_variables) {
+			if (first) {
+				first = false;
+			} else {
+				out << ",";
+			}
+			out << '"' << repeat_variable << '"';
+		}
+		out << ']';
+	}
+	out << '}';
 }
 
 void StringFactorNode::print_json(std::ostream &out) const {
 	out << R"({"type":"string","value":")" << str << R"("})";
 }
 
+void IntegerFactorNode::print_json(std::ostream &out) const {
+	out << R"({"type":"integer","value":)" << value << R"(})";
+}
+
 void VariableFactorNode::print_json(std::ostream &out) const {
 	out << R"({"type":"variable","identifier":")" << identifier << R"("})";
 }
@@ -120,4 +156,105 @@ void ExpressionFactorNode::print_json(std::ostream &out) const {
 	out << R"({"type":"expression","expression":)" << *expression << R"(})";
 }
 
+static void copyPosition(ASTNode &to, const ASTNode &from) {
+	to.position_begin = from.position_begin;
+	to.position_end = from.position_end;
+}
+
+std::unique_ptr<StatementsNode> StatementsNode::clone() const {
+	auto node = std::make_unique<StatementsNode>();
+	copyPosition(*node, *this);
+	for (const auto &statement : statements) {
+		node->statements.push_back(statement->clone());
+	}
+	return node;
+}
+
+std::unique_ptr<StatementNode> AssignStatementNode::clone() const {
+	auto node = std::make_unique<AssignStatementNode>();
+	copyPosition(*node, *this);
+	node->variable = variable;
+	node->expression = expression->clone();
+	return node;
+}
+
+std::unique_ptr<StatementNode> IfStatementNode::clone() const {
+	auto node = std::make_unique<IfStatementNode>();
+	copyPosition(*node, *this);
+	node->condition = condition->clone();
+	node->true_action = true_action->clone();
+	node->false_action = false_action->clone();
+	return node;
+}
+
+std::unique_ptr<StatementNode> DoWhileStatementNode::clone() const {
+	auto node = std::make_unique<DoWhileStatementNode>();
+	copyPosition(*node, *this);
+	node->condition = condition->clone();
+	node->loop_action = loop_action->clone();
+	return node;
+}
+
+std::unique_ptr<StatementNode> ReleaseStatementNode::clone() const {
+	auto node = std::make_unique<ReleaseStatementNode>();
+	copyPosition(*node, *this);
+	node->variable = variable;
+	return node;
+}
+
+std::unique_ptr<ConditionNode> ConditionNode::clone() const {
+	auto node = std::make_unique<ConditionNode>();
+	copyPosition(*node, *this);
+	node->op = op;
+	node->lhs = lhs->clone();
+	node->rhs = rhs->clone();
+	return node;
+}
+
+std::unique_ptr<ExpressionNode> ExpressionNode::clone() const {
+	auto node = std::make_unique<ExpressionNode>();
+	copyPosition(*node, *this);
+	for (const auto &item : items) {
+		node->items.push_back(item->clone());
+	}
+	return node;
+}
+
+std::unique_ptr<ItemNode> ItemNode::clone() const {
+	auto node = std::make_unique<ItemNode>();
+	copyPosition(*node, *this);
+	node->factor = factor->clone();
+	node->repeat_times = repeat_times;
+	node->repeat_variables = repeat_variables;
+	return node;
+}
+
+std::unique_ptr<FactorNode> StringFactorNode::clone() const {
+	auto node = std::make_unique<StringFactorNode>();
+	copyPosition(*node, *this);
+	node->str = str;
+	return node;
+}
+
+std::unique_ptr<FactorNode> IntegerFactorNode::clone() const {
+	auto node = std::make_unique<IntegerFactorNode>();
+	copyPosition(*node, *this);
+	node->value = value;
+	return node;
+}
+
+std::unique_ptr<FactorNode> VariableFactorNode::clone() const {
+	auto node = std::make_unique<VariableFactorNode>();
+	copyPosition(*node, *this);
+	node->identifier = identifier;
+	return node;
+}
+
+std::unique_ptr<FactorNode> ExpressionFactorNode::clone() const {
+	auto node = std::make_unique<ExpressionFactorNode>();
+	copyPosition(*node, *this);
+	node->expression = expression->clone();
+	return node;
+}
+
 } // namespace compiler
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -17,35 +18,52 @@ class ASTNode {
 	friend std::ostream &operator<<(std::ostream &out, const ASTNode &ast);
 };
 
-class FactorNode : public ASTNode {};
+class FactorNode : public ASTNode {
+  public:
+	virtual std::unique_ptr<FactorNode> clone() const = 0;
+};
 
 class StringFactorNode : public FactorNode {
   public:
+	std::unique_ptr<FactorNode> clone() const;
 	std::string str;
 	void print_json(std::ostream &out) const;
 };
 
 class VariableFactorNode : public FactorNode {
   public:
+	std::unique_ptr<FactorNode> clone() const;
 	std::string identifier;
 	void print_json(std::ostream &out) const;
 };
 
+class IntegerFactorNode : public FactorNode {
+  public:
+	std::unique_ptr<FactorNode> clone() const;
+	int64_t value;
+	void print_json(std::ostream &out) const;
+};
+
 class ItemNode : public ASTNode {
   public:
+	std::unique_ptr<ItemNode> clone() const;
 	std::unique_ptr<FactorNode> factor;
-	std::vector<int> repeat_times;
+	std::vector<int64_t> repeat_times;
+	// int variables, multiplied with repeat_times
+	std::vector<std::string> repeat_variables;
 	void print_json(std::ostream &out) const;
 };
 
 class ExpressionNode : public ASTNode {
   public:
+	std::unique_ptr<ExpressionNode> clone() const;
 	std::vector<std::unique_ptr<ItemNode>> items;
 	void print_json(std::ostream &out) const;
 };
 
 class ExpressionFactorNode : public FactorNode {
   public:
+	std::unique_ptr<FactorNode> clone() const;
 	std::unique_ptr<ExpressionNode> expression;
 	void print_json(std::ostream &out) const;
 };
@@ -61,22 +79,28 @@ enum class RelationOp {
 
 class ConditionNode : public ASTNode {
   public:
+	std::unique_ptr<ConditionNode> clone() const;
 	RelationOp op;
 	std::unique_ptr<ExpressionNode> lhs;
 	std::unique_ptr<ExpressionNode> rhs;
 	void print_json(std::ostream &out) const;
 };
 
-class StatementNode : public ASTNode {};
+class StatementNode : public ASTNode {
+  public:
+	virtual std::unique_ptr<StatementNode> clone() const = 0;
+};
 
 class StatementsNode : public ASTNode {
   public:
+	std::unique_ptr<StatementsNode> clone() const;
 	std::vector<std::unique_ptr<StatementNode>> statements;
 	void print_json(std::ostream &out) const;
 };
 
 class AssignStatementNode : public StatementNode {
   public:
+	std::unique_ptr<StatementNode> clone() const;
 	std::string variable;
 	std::unique_ptr<ExpressionNode> expression;
 	void print_json(std::ostream &out) const;
@@ -84,6 +108,7 @@ class AssignStatementNode : public StatementNode {
 
 class IfStatementNode : public StatementNode {
   public:
+	std::unique_ptr<StatementNode> clone() const;
 	std::unique_ptr<ConditionNode> condition;
 	std::unique_ptr<StatementsNode> true_action;
 	std::unique_ptr<StatementsNode> false_action;
@@ -92,21 +117,36 @@ class IfStatementNode : public StatementNode {
 
 class DoWhileStatementNode : public StatementNode {
   public:
+	std::unique_ptr<StatementNode> clone() const;
 	std::unique_ptr<ConditionNode> condition;
 	std::unique_ptr<StatementsNode> loop_action;
 	void print_json(std::ostream &out) const;
 };
 
+// Drops the value of a variable which is not read again before it is
+// assigned, inserted by the optimizer
+class ReleaseStatementNode : public StatementNode {
+  public:
+	std::unique_ptr<StatementNode> clone() const;
+	std::string variable;
+	void print_json(std::ostream &out) const;
+};
+
 class VariableDeclarationNode : public ASTNode {
   public:
 	std::string type;
 	std::vector<std::string> identifiers;
+	// introduced by the optimizer, never printed
+	std::vector<std::string> temporaries;
 	void print_json(std::ostream &out) const;
 };
 
 class ProgramNode : public ASTNode {
   public:
+	// of type string, possibly without identifiers
 	std::unique_ptr<VariableDeclarationNode> variables;
+	// of type int, possibly without identifiers
+	std::unique_ptr<VariableDeclarationNode> int_variables;
 	std::unique_ptr<StatementsNode> statements;
 	void print_json(std::ostream &out) const;
 };
@@ -1,70 +1,341 @@
 #include "codegen.hpp"
 #include "error.hpp"
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Verifier.h>
 
 namespace compiler {
 
-llvm::Value *LLVMCodeGen::genStrlen(llvm::Value *str_ptr) {
+// strings up to this length are stored inline without a heap allocation
+static constexpr int sso_capacity = 15;
+// operands of == and <> flattened into more pieces are built instead
+static constexpr size_t max_stream_segments = 64;
+// transients known to be at most this long are built on the stack
+static constexpr uint64_t max_stack_transient = 4096;
+// independent assignments run on the worker threads when at least two of
+// them copy this many bytes, which outweighs waking the threads up
+static constexpr uint64_t parallel_statement_min_copy = 1 << 20;
+
+llvm::Value *LLVMCodeGen::genStrAlloc(llvm::Value *cap) {
+	// ---- C code ----
+	// struct string_header *header =
+	//     malloc(string_header_size + cap + 1);
+	// header->refcount = 1;
+	// header->capacity = cap;
+	// header->hash = 0;
+	// return (char *)header + string_header_size;
+	// cap is at most max_string_length, so the size doesn't wrap around
+	auto *size = builder.CreateAdd(
+	    cap, builder.getInt64(string_header_size + 1), "_stralloc_size");
+	auto *header = builder.CreateCall(options.arena ? runtime.poolAlloc()
+	                                                : runtime.malloc(),
+	                                  {size}, "_stralloc_header");
+	auto *ptr = builder.CreateConstInBoundsGEP1_64(
+	    builder.getInt8Ty(), header, string_header_size, "_stralloc_ptr");
+	builder.CreateStore(builder.getInt64(1), genStrHeaderField(ptr, 0));
+	builder.CreateStore(cap, genStrHeaderField(ptr, 1));
+	builder.CreateStore(builder.getInt64(0), genStrHeaderField(ptr, 2));
+	return ptr;
+}
+
+void LLVMCodeGen::genStrFree(llvm::Value *ptr) {
+	builder.CreateCall(runtime.stringFree(), {ptr});
+}
+
+llvm::Value *LLVMCodeGen::genStrHeaderField(llvm::Value *ptr, int field) {
+	// field 0 is the refcount, field 1 is the capacity, field 2 is the hash
+	auto *addr = builder.CreateConstInBoundsGEP1_64(
+	    builder.getInt8Ty(), ptr,
+	    -static_cast<int64_t>(string_header_size) + 8 * field);
+	return builder.CreatePointerCast(addr,
+	                                 builder.getInt64Ty()->getPointerTo());
+}
+
+llvm::Value *LLVMCodeGen::genStrRefcount(llvm::Value *ptr,
+                                         const std::string &name) {
+	// Other threads may drop references to the string at the same time.
+	// Seeing the last one dropped makes its buffer ours to modify.
+	auto *refcount = builder.CreateAlignedLoad(
+	    builder.getInt64Ty(), genStrHeaderField(ptr, 0), llvm::Align(8), name);
+	if (options.parallelStatements()) {
+		refcount->setAtomic(llvm::AtomicOrdering::Acquire);
+	}
+	return refcount;
+}
+
+void LLVMCodeGen::genStrRetain(llvm::Value *ptr) {
+	// ---- C code ----
+	// if (header(ptr)->refcount >= 0) header(ptr)->refcount++;
+	auto *current_func = builder.GetInsertBlock()->getParent();
+	auto *mortal = llvm::BasicBlock::Create(ctx, "_retain_mortal", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_retain_cont", current_func);
+	auto *refcount = genStrRefcount(ptr, "_retain_refcount");
+	auto *immortal = builder.CreateICmpSLT(refcount, builder.getInt64(0),
+	                                       "_retain_immortal");
+	builder.CreateCondBr(immortal, cont, mortal);
+
+	builder.SetInsertPoint(mortal);
+	if (options.parallelStatements()) {
+		builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+		                        genStrHeaderField(ptr, 0), builder.getInt64(1),
+		                        llvm::Align(8),
+		                        llvm::AtomicOrdering::Monotonic);
+	} else {
+		builder.CreateStore(builder.CreateAdd(refcount, builder.getInt64(1)),
+		                    genStrHeaderField(ptr, 0));
+	}
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
+}
+
+llvm::Value *LLVMCodeGen::genStrCopy(llvm::Value *dst, llvm::Value *offset,
+                                     llvm::Value *src, llvm::Value *len) {
+	// ---- C Code ----
+	// for (size_t idx = 0; idx < len; idx++) {
+	//   dst[offset++] = src[idx];
+	// }
 	// ---- LLVM IR ----
 	// entry:
 	//   ...
-	//   br label %loop
-	// loop:
-	//   %idx = phi i32 [ 0, %entry ], [ %next_idx, %loop ]
-	//   %addr = getelementptr inbounds i8, ptr %str_ptr, i32 %idx
-	//   %val = load i8, ptr %addr
-	//   %cond = icmp eq i8 %val, 0
-	//   %next_idx = add i32 %idx, 1
+	//   %len_is_zero = icmp eq i64 %len, 0
+	//   br i1 %len_is_zero, label %cont, label %loop
+	// loop: ; preds = %entry, %loop
+	//   %srcidx = phi i64 [ %next_srcidx, %loop ], [ 0, %entry ]
+	//   %dstidx = phi i64 [ %next_dstidx, %loop ], [ %offset, %entry ]
+	//   %srcptr = getelementptr inbounds i8, ptr %src, i64 %srcidx
+	//   %src_element = load i8, ptr %srcptr
+	//   %dstptr = getelementptr inbounds i8, ptr %dst, i64 %dstidx
+	//   store i8 %src_element, ptr %dstptr
+	//   %next_srcidx = add i64 %srcidx, 1
+	//   %next_dstidx = add i64 %dstidx, 1
+	//   %cond = icmp eq i64 %next_srcidx, %len
 	//   br i1 %cond, label %cont, label %loop
-	// cont:
-	//   ... (ret i32 %idx)
+	// cont: ; preds = %loop, %entry
+	//   %end_idx = phi i64 [ %offset, %entry ], [ %next_dstidx, %loop ]
+	//   ... (the new offset is %end_idx)
+	// A large copy is left to the runtime instead:
+	// if (len >= bulk_copy_threshold) {
+	//   _copy_bulk(dst + offset, src, len);
+	//   offset += len;
+	// }
+	auto *current_func = builder.GetInsertBlock()->getParent();
+	auto *loop = llvm::BasicBlock::Create(ctx, "_concat_loop", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_concat_cont", current_func);
+	llvm::BasicBlock *bulk = nullptr;
+	llvm::Value *bulk_end_idx = nullptr;
+	auto threshold = bulkCopyThreshold();
+	auto *const_len = llvm::dyn_cast<llvm::ConstantInt>(len);
+	if (const_len == nullptr || const_len->getZExtValue() >= threshold) {
+		bulk = llvm::BasicBlock::Create(ctx, "_concat_bulk", current_func);
+		auto *small = llvm::BasicBlock::Create(ctx, "_concat_small",
+		                                       current_func, loop);
+		builder.CreateCondBr(
+		    builder.CreateICmpUGE(len, builder.getInt64(threshold),
+		                          "_concat_is_bulk"),
+		    bulk, small,
+		    llvm::MDBuilder(ctx).createBranchWeights(1, 1 << 20));
+
+		builder.SetInsertPoint(bulk);
+		builder.CreateCall(runtime.copyBulk(),
+		                   {builder.CreateInBoundsGEP(builder.getInt8Ty(), dst,
+		                                              offset),
+		                    src, len});
+		bulk_end_idx = builder.CreateAdd(offset, len, "_concat_bulk_end");
+		builder.CreateBr(cont);
+
+		builder.SetInsertPoint(small);
+	}
 	auto *entry = builder.GetInsertBlock();
-	auto *current_func = entry->getParent();
-	auto *loop = llvm::BasicBlock::Create(ctx, "_strlen_loop", current_func);
-	builder.CreateBr(loop);
+	auto *len_is_zero =
+	    builder.CreateICmpEQ(len, builder.getInt64(0), "_concat_len_is_zero");
+	builder.CreateCondBr(len_is_zero, cont, loop);
+
 	builder.SetInsertPoint(loop);
-	auto *idx = builder.CreatePHI(builder.getInt32Ty(), 2, "_strlen_idx");
-	idx->addIncoming(builder.getInt32(0), entry);
-	auto *addr = builder.CreateInBoundsGEP(builder.getInt8Ty(), str_ptr, idx,
-	                                       "_strlen_addr");
-	auto *val = builder.CreateLoad(builder.getInt8Ty(), addr, "_strlen_val");
-	auto *cond = builder.CreateICmpEQ(val, builder.getInt8(0), "_strlen_cond");
-	auto *next_idx =
-	    builder.CreateAdd(idx, builder.getInt32(1), "_strlen_next_idx");
-	idx->addIncoming(next_idx, loop);
-	auto *cont = llvm::BasicBlock::Create(ctx, "_strlen_cont", current_func);
+	auto *srcidx = builder.CreatePHI(builder.getInt64Ty(), 2, "_concat_srcidx");
+	auto *dstidx = builder.CreatePHI(builder.getInt64Ty(), 2, "_concat_dstidx");
+	auto *srcptr = builder.CreateInBoundsGEP(builder.getInt8Ty(), src, srcidx,
+	                                         "_concat_srcptr");
+	auto *src_element =
+	    builder.CreateLoad(builder.getInt8Ty(), srcptr, "_concat_src_element");
+	auto *dstptr = builder.CreateInBoundsGEP(builder.getInt8Ty(), dst, dstidx,
+	                                         "_concat_dstptr");
+	builder.CreateStore(src_element, dstptr);
+	auto *next_srcidx =
+	    builder.CreateAdd(srcidx, builder.getInt64(1), "_concat_next_srcidx");
+	auto *next_dstidx =
+	    builder.CreateAdd(dstidx, builder.getInt64(1), "_concat_next_dstidx");
+	auto *cond = builder.CreateICmpEQ(next_srcidx, len, "_concat_cond");
 	builder.CreateCondBr(cond, cont, loop);
+
 	builder.SetInsertPoint(cont);
-	return idx;
+	auto *end_idx = builder.CreatePHI(builder.getInt64Ty(), 3);
+	if (bulk != nullptr) {
+		end_idx->addIncoming(bulk_end_idx, bulk);
+	}
+
+	srcidx->addIncoming(next_srcidx, loop);
+	srcidx->addIncoming(builder.getInt64(0), entry);
+	dstidx->addIncoming(next_dstidx, loop);
+	dstidx->addIncoming(offset, entry);
+	end_idx->addIncoming(offset, entry);
+	end_idx->addIncoming(next_dstidx, loop);
+	return end_idx;
 }
 
-llvm::Value *LLVMCodeGen::genStrAlloc(llvm::Value *len) {
-	auto *size = builder.CreateAdd(len, builder.getInt32(1), "_stralloc_size");
-	auto *ptr = llvm::CallInst::CreateMalloc(
-	    builder.GetInsertBlock(), builder.getInt32Ty(), builder.getInt8Ty(),
-	    size, nullptr, nullptr, "_stralloc_ptr");
-	builder.Insert(ptr);
-	return ptr;
+llvm::AllocaInst *LLVMCodeGen::genEntryAlloca(llvm::Type *type,
+                                              const std::string &name) {
+	auto &entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+	llvm::IRBuilder<> entry_builder(&entry, entry.begin());
+	return entry_builder.CreateAlloca(type, nullptr, name);
 }
 
-void LLVMCodeGen::genStrFree(llvm::Value *ptr) {
-	builder.Insert(llvm::CallInst::CreateFree(ptr, builder.GetInsertBlock()));
+LLVMCodeGen::DestructibleValue
+LLVMCodeGen::genTransientAlloc(llvm::Value *len, bool to_variable,
+                               std::optional<LengthInterval> known_len) {
+	// A transient escapes the statement which builds it only when it is
+	// moved into a variable. Otherwise, if its length is bounded, it lives
+	// in a stack buffer of the largest size it can have.
+	// ---- C code ----
+	// char stack_buf[known_len.hi + 1];
+	// char *result = stack_buf;
+	if (!to_variable && known_len.has_value() &&
+	    known_len->hi <= max_stack_transient) {
+		auto *buf_type =
+		    llvm::ArrayType::get(builder.getInt8Ty(), known_len->hi + 1);
+		auto *buf = genEntryAlloca(buf_type, "_stack_buf");
+		auto *result = builder.CreateConstInBoundsGEP2_32(buf_type, buf, 0, 0,
+		                                                  "_stack_result");
+		return {
+		    .val = result,
+		    .transient = true,
+		    .strlen = len,
+		    .inline_buf = result,
+		};
+	}
+
+	// Small-string optimization: a result of at most sso_capacity chars is
+	// stored in a stack buffer owned by this call site, longer results are
+	// spilled to the heap. In arena mode the heap copy comes from the arena,
+	// unless the result is going to be moved into a variable.
+	// ---- C code ----
+	// char inline_buf[sso_capacity + 1];
+	// char *result = len <= sso_capacity ? inline_buf : malloc(len + 1);
+	auto *buf = genEntryAlloca(inline_buf_type, "_sso_buf");
+	auto *inline_buf = builder.CreateConstInBoundsGEP2_32(inline_buf_type, buf,
+	                                                      0, 0, "_sso_inline");
+	auto *entry = builder.GetInsertBlock();
+	auto *current_func = entry->getParent();
+	auto *on_heap = llvm::BasicBlock::Create(ctx, "_sso_heap", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_sso_cont", current_func);
+	auto *fits = builder.CreateICmpULE(len, builder.getInt64(sso_capacity),
+	                                   "_sso_fits");
+	builder.CreateCondBr(fits, cont, on_heap);
+
+	builder.SetInsertPoint(on_heap);
+	llvm::Value *heap_ptr;
+	bool arena = options.arena && !to_variable;
+	if (arena) {
+		// released by the next genArenaReset()
+		auto *size = builder.CreateAdd(len, builder.getInt64(1), "_sso_size");
+		heap_ptr = builder.CreateCall(runtime.arenaAlloc(), {size},
+		                              "_sso_heap_ptr");
+	} else {
+		heap_ptr = genStrAlloc(len);
+	}
+	auto *on_heap_end = builder.GetInsertBlock();
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
+	auto *result = builder.CreatePHI(builder.getInt8PtrTy(), 2, "_sso_result");
+	result->addIncoming(inline_buf, entry);
+	result->addIncoming(heap_ptr, on_heap_end);
+	return {
+	    .val = result,
+	    .transient = true,
+	    .strlen = len,
+	    .inline_buf = inline_buf,
+	    .arena = arena,
+	};
 }
 
 void LLVMCodeGen::destructTransientValue(DestructibleValue &&val) {
 	if (!val.transient || !val.val->getType()->isPointerTy()) {
 		return;
 	}
+	if (val.arena) {
+		// released together with the arena by genArenaReset()
+		return;
+	}
+	if (val.val == val.inline_buf) {
+		// always on the stack
+		return;
+	}
+	if (val.inline_buf == nullptr) {
+		genStrFree(val.val);
+		return;
+	}
+	auto *current_func = builder.GetInsertBlock()->getParent();
+	auto *on_heap =
+	    llvm::BasicBlock::Create(ctx, "_destruct_heap", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_destruct_cont", current_func);
+	auto *is_inline =
+	    builder.CreateICmpEQ(val.val, val.inline_buf, "_destruct_is_inline");
+	builder.CreateCondBr(is_inline, cont, on_heap);
+
+	builder.SetInsertPoint(on_heap);
 	genStrFree(val.val);
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
+}
+
+void LLVMCodeGen::genArenaReset() {
+	if (options.arena) {
+		builder.CreateCall(runtime.arenaReset());
+	}
+}
+
+llvm::Value *LLVMCodeGen::genVariableInlineBuffer(llvm::Value *var_ptr) {
+	auto *buf =
+	    builder.CreateStructGEP(string_type, var_ptr, 2, "_var_inline_buf");
+	return builder.CreateConstInBoundsGEP2_32(inline_buf_type, buf, 0, 0,
+	                                          "_var_inline");
+}
+
+llvm::Value *LLVMCodeGen::genVariableSpare(llvm::Value *var_ptr) {
+	return builder.CreateStructGEP(string_type, var_ptr, 3, "_var_spare");
+}
+
+void LLVMCodeGen::genVariableFree(llvm::Value *var_ptr,
+                                  const std::string &name) {
+	// Only a spilled string is released, an unassigned variable holds
+	// nullptr and releasing it is safe. The spare buffer goes as well.
+	auto *spare = builder.CreateLoad(
+	    builder.getInt8PtrTy(), genVariableSpare(var_ptr), "_varfree_spare");
+	builder.CreateCall(runtime.stringRelease(), {spare});
+	auto *current_func = builder.GetInsertBlock()->getParent();
+	auto *on_heap =
+	    llvm::BasicBlock::Create(ctx, "_varfree_heap_" + name, current_func);
+	auto *cont =
+	    llvm::BasicBlock::Create(ctx, "_varfree_cont_" + name, current_func);
+	auto *str_ptr = builder.CreateStructGEP(string_type, var_ptr, 0);
+	auto *str =
+	    builder.CreateLoad(builder.getInt8PtrTy(), str_ptr, "_varfree_str");
+	auto *is_inline = builder.CreateICmpEQ(
+	    str, genVariableInlineBuffer(var_ptr), "_varfree_is_inline");
+	builder.CreateCondBr(is_inline, cont, on_heap);
+
+	builder.SetInsertPoint(on_heap);
+	builder.CreateCall(runtime.stringRelease(), {str});
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
 }
 
 void LLVMCodeGen::visitVariableDeclaration(
     const VariableDeclarationNode &node) {
-	llvm::Type *type;
-	if (node.type == "string") {
-		type = builder.getInt8PtrTy();
-	} else {
+	if (node.type != "string" && node.type != "int") {
 		throw CompileException(node.position_begin,
 		                       "Unsupported variable type: " + node.type);
 	}
@@ -73,26 +344,80 @@ void LLVMCodeGen::visitVariableDeclaration(
 			throw CompileException(node.position_begin,
 			                       "Variable is already defined: " + name);
 		}
-		auto *ptr = builder.CreateAlloca(type, nullptr, name);
-		if (type->isPointerTy()) {
-			// initialize pointers as null
-			builder.CreateStore(llvm::ConstantPointerNull::get(
-			                        llvm::dyn_cast<llvm::PointerType>(type)),
-			                    ptr);
+		if (node.type == "int") {
+			// ---- C code ----
+			// int64_t name = 0;
+			// (promoted to a register, as its address never escapes)
+			auto *ptr = builder.CreateAlloca(builder.getInt64Ty(), nullptr,
+			                                 name);
+			builder.CreateStore(builder.getInt64(0), ptr);
+			variables[name] = ptr;
+			int_variables.insert(name);
+			continue;
 		}
-		variables[name] = ptr;
+		variables[name] = genVariableAlloca(name);
+	}
+	for (const auto &name : node.temporaries) {
+		variables[name] = genVariableAlloca(name);
+		temporaries.insert(name);
 	}
 }
 
-LLVMCodeGen::DestructibleValue
-LLVMCodeGen::visitStringFactor(const StringFactorNode &node) {
+llvm::AllocaInst *LLVMCodeGen::genVariableAlloca(const std::string &name) {
+	auto *ptr = builder.CreateAlloca(string_type, nullptr, name);
+	// initialize strings as null
+	builder.CreateStore(llvm::ConstantPointerNull::get(builder.getInt8PtrTy()),
+	                    builder.CreateStructGEP(string_type, ptr, 0));
+	builder.CreateStore(builder.getInt64(0),
+	                    builder.CreateStructGEP(string_type, ptr, 1));
+	builder.CreateStore(llvm::ConstantPointerNull::get(builder.getInt8PtrTy()),
+	                    builder.CreateStructGEP(string_type, ptr, 3));
+	return ptr;
+}
+
+LLVMCodeGen::DestructibleValue LLVMCodeGen::genLiteral(const std::string &str) {
+	auto &constant = literals[str];
+	if (constant != nullptr) {
+		return {
+		    .val = constant,
+		    .transient = false,
+		    .strlen = builder.getInt64(str.size()),
+		};
+	}
+	if (str.size() <= sso_capacity) {
+		// copied into an inline buffer when assigned
+		constant = builder.CreateGlobalStringPtr(str);
+	} else {
+		// Long literals carry an immortal string header, so that a variable
+		// can share them instead of making a copy.
+		auto *data = llvm::ConstantDataArray::getString(ctx, str);
+		auto *type = llvm::StructType::get(
+		    ctx, {builder.getInt64Ty(), builder.getInt64Ty(),
+		          builder.getInt64Ty(), data->getType()});
+		auto *init = llvm::ConstantStruct::get(
+		    type, {builder.getInt64(-1), builder.getInt64(str.size()),
+		           builder.getInt64(hashString(str)), data});
+		auto *global = new llvm::GlobalVariable(
+		    *module, type, true, llvm::GlobalValue::PrivateLinkage, init,
+		    "_literal");
+		global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+		constant = llvm::ConstantExpr::getInBoundsGetElementPtr(
+		    type, global,
+		    llvm::ArrayRef<llvm::Constant *>{
+		        builder.getInt32(0), builder.getInt32(3), builder.getInt32(0)});
+	}
 	return {
-	    .val = builder.CreateGlobalStringPtr(node.str),
+	    .val = constant,
 	    .transient = false,
-	    .strlen = builder.getInt32(node.str.size()),
+	    .strlen = builder.getInt64(str.size()),
 	};
 }
 
+LLVMCodeGen::DestructibleValue
+LLVMCodeGen::visitStringFactor(const StringFactorNode &node) {
+	return genLiteral(node.str);
+}
+
 LLVMCodeGen::DestructibleValue
 LLVMCodeGen::visitVariableFactor(const VariableFactorNode &node) {
 	auto it = variables.find(node.identifier);
@@ -101,21 +426,48 @@ LLVMCodeGen::visitVariableFactor(const VariableFactorNode &node) {
 		                       "Undefined variable: " + node.identifier);
 	}
 	auto *var_ptr = it->second;
+	auto *str_ptr = builder.CreateStructGEP(string_type, var_ptr, 0);
+	auto *len_ptr = builder.CreateStructGEP(string_type, var_ptr, 1);
+	auto *str =
+	    builder.CreateLoad(builder.getInt8PtrTy(), str_ptr, node.identifier);
+	std::optional<LengthInterval> known_len;
+	if (lengths.has_value()) {
+		known_len = lengths->lengthOf(node);
+	}
+	if (known_len.has_value() && known_len->isExact() &&
+	    known_len->lo <= max_string_length) {
+		return {
+		    .val = str,
+		    .transient = false,
+		    .strlen = builder.getInt64(known_len->lo),
+		};
+	}
+	auto *len = builder.CreateLoad(builder.getInt64Ty(), len_ptr,
+	                               node.identifier + "_len");
+	if (known_len.has_value()) {
+		// lets LLVM fold comparisons with the length
+		len->setMetadata(
+		    llvm::LLVMContext::MD_range,
+		    llvm::MDBuilder(ctx).createRange(
+		        llvm::APInt(64, known_len->lo),
+		        llvm::APInt(64, std::min(known_len->hi, max_string_length) +
+		                            1)));
+	}
 	return {
-	    .val = builder.CreateLoad(var_ptr->getAllocatedType(), var_ptr,
-	                              node.identifier),
+	    .val = str,
 	    .transient = false,
-	    .strlen = std::nullopt,
+	    .strlen = len,
 	};
 }
 
 LLVMCodeGen::DestructibleValue
-LLVMCodeGen::visitExpressionFactor(const ExpressionFactorNode &node) {
-	return visitExpression(*node.expression);
+LLVMCodeGen::visitExpressionFactor(const ExpressionFactorNode &node,
+                                   bool to_variable) {
+	return visitExpression(*node.expression, to_variable);
 }
 
 LLVMCodeGen::DestructibleValue
-LLVMCodeGen::visitFactor(const FactorNode &node) {
+LLVMCodeGen::visitFactor(const FactorNode &node, bool to_variable) {
 	if (typeid(node) == typeid(StringFactorNode)) {
 		return visitStringFactor(dynamic_cast<const StringFactorNode &>(node));
 	} else if (typeid(node) == typeid(VariableFactorNode)) {
@@ -123,293 +475,645 @@ LLVMCodeGen::visitFactor(const FactorNode &node) {
 		    dynamic_cast<const VariableFactorNode &>(node));
 	} else if (typeid(node) == typeid(ExpressionFactorNode)) {
 		return visitExpressionFactor(
-		    dynamic_cast<const ExpressionFactorNode &>(node));
+		    dynamic_cast<const ExpressionFactorNode &>(node), to_variable);
 	} else {
 		throw std::runtime_error("Unknown factor");
 	}
 }
 
-LLVMCodeGen::DestructibleValue LLVMCodeGen::visitItem(const ItemNode &node) {
-	auto factor = visitFactor(*node.factor);
-	if (node.repeat_times.empty()) {
-		return factor;
+LLVMCodeGen::DestructibleValue LLVMCodeGen::visitItem(const ItemNode &node,
+                                                      bool to_variable) {
+	if (node.repeat_times.empty() && node.repeat_variables.empty()) {
+		return visitFactor(*node.factor, to_variable);
 	}
-	auto *type = factor.val->getType();
-	if (!type->isPointerTy()) {
-		throw CompileException(
-		    node.position_begin,
-		    "Left operand of repeat operator must be string");
+	if (auto value = literalValue(node)) {
+		// "ab" * 3 is stored as "ababab"
+		return genLiteral(*value);
+	}
+	auto *len = genItemLength(node);
+	std::optional<LengthInterval> known_len;
+	if (lengths.has_value()) {
+		known_len = lengths->lengthOf(node);
+	}
+	auto result_val = genTransientAlloc(len, to_variable, known_len);
+	genItemInto(node, result_val.val, builder.getInt64(0));
+	auto *lastaddr = builder.CreateInBoundsGEP(
+	    builder.getInt8Ty(), result_val.val, len, "_repeat_lastaddr");
+	builder.CreateStore(builder.getInt8(0), lastaddr);
+	return result_val;
+}
+
+LLVMCodeGen::DestructibleValue
+LLVMCodeGen::visitExpression(const ExpressionNode &node, bool to_variable) {
+	auto item_count = node.items.size();
+	if (item_count == 0) {
+		throw CompileException(node.position_begin,
+		                       "Expression can't be empty");
+	}
+	if (item_count == 1) {
+		return visitItem(*node.items[0], to_variable);
+	}
+	if (auto value = literalValue(node)) {
+		return genLiteral(*value);
+	}
+	// The whole expression tree is written into a single allocation, see
+	// genExpressionInto()
+	auto *total_len = genExpressionLength(node);
+	std::optional<LengthInterval> known_len;
+	if (lengths.has_value()) {
+		known_len = lengths->lengthOf(node);
+	}
+	auto result_val = genTransientAlloc(total_len, to_variable, known_len);
+	genExpressionInto(node, result_val.val, builder.getInt64(0));
+	auto *lastaddr = builder.CreateInBoundsGEP(
+	    builder.getInt8Ty(), result_val.val, total_len, "_concat_lastaddr");
+	builder.CreateStore(builder.getInt8(0), lastaddr);
+	return result_val;
+}
+
+void LLVMCodeGen::genLengthCheck(llvm::Value *too_long) {
+	// ---- C code ----
+	// if (too_long) _length_overflow();
+	if (auto *constant = llvm::dyn_cast<llvm::ConstantInt>(too_long)) {
+		if (constant->isZero()) {
+			return;
+		}
+	}
+	auto *current_func = builder.GetInsertBlock()->getParent();
+	auto *overflow =
+	    llvm::BasicBlock::Create(ctx, "_length_overflow", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_length_ok", current_func);
+	builder.CreateCondBr(too_long, overflow, cont,
+	                     llvm::MDBuilder(ctx).createBranchWeights(1, 1 << 20));
+
+	builder.SetInsertPoint(overflow);
+	builder.CreateCall(runtime.lengthOverflow());
+	builder.CreateUnreachable();
+
+	builder.SetInsertPoint(cont);
+}
+
+llvm::Value *LLVMCodeGen::genLengthAdd(llvm::Value *a, llvm::Value *b,
+                                       const std::string &name, bool checked) {
+	if (!checked) {
+		return builder.CreateBinaryIntrinsic(
+		    llvm::Intrinsic::umin,
+		    builder.CreateBinaryIntrinsic(llvm::Intrinsic::uadd_sat, a, b),
+		    builder.getInt64(max_string_length + 1), nullptr, name);
+	}
+	// a and b are at most max_string_length, so the sum doesn't wrap around
+	auto *sum = builder.CreateAdd(a, b, name);
+	genLengthCheck(builder.CreateICmpUGT(
+	    sum, builder.getInt64(max_string_length), name + "_too_long"));
+	return sum;
+}
+
+llvm::Value *LLVMCodeGen::genLengthMul(llvm::Value *len, uint64_t times,
+                                       const std::string &name, bool checked) {
+	if (!checked && times > 1) {
+		return builder.CreateSelect(
+		    builder.CreateICmpUGT(len,
+		                          builder.getInt64(max_string_length / times)),
+		    builder.getInt64(max_string_length + 1),
+		    builder.CreateMul(len, builder.getInt64(times)), name);
 	}
-	llvm::Value *len;
-	if (factor.strlen.has_value()) {
-		// optimization: reuse strlen
-		len = *factor.strlen;
+	if (times > 1) {
+		genLengthCheck(builder.CreateICmpUGT(
+		    len, builder.getInt64(max_string_length / times),
+		    name + "_too_long"));
+	}
+	return builder.CreateMul(len, builder.getInt64(times), name);
+}
+
+llvm::Value *LLVMCodeGen::genLengthMul(llvm::Value *len, llvm::Value *times,
+                                       const std::string &name, bool checked) {
+	// times is an int, which is never negative
+	auto *result = builder.CreateBinaryIntrinsic(
+	    llvm::Intrinsic::umul_with_overflow, len, times);
+	auto *product = builder.CreateExtractValue(result, 0, name);
+	auto *too_long = builder.CreateOr(
+	    builder.CreateExtractValue(result, 1),
+	    builder.CreateICmpUGT(product, builder.getInt64(max_string_length)),
+	    name + "_too_long");
+	if (!checked) {
+		return builder.CreateSelect(too_long,
+		                            builder.getInt64(max_string_length + 1),
+		                            product, name);
+	}
+	genLengthCheck(too_long);
+	return product;
+}
+
+llvm::Value *LLVMCodeGen::genFactorLength(const FactorNode &node,
+                                          bool checked) {
+	if (typeid(node) == typeid(StringFactorNode)) {
+		auto &str = dynamic_cast<const StringFactorNode &>(node).str;
+		return builder.getInt64(str.size());
+	} else if (typeid(node) == typeid(VariableFactorNode)) {
+		auto var = visitVariableFactor(
+		    dynamic_cast<const VariableFactorNode &>(node));
+		if (!var.val->getType()->isPointerTy()) {
+			throw CompileException(node.position_begin,
+			                       "Operand of relation operator must be string");
+		}
+		return var.strlen;
+	} else if (typeid(node) == typeid(ExpressionFactorNode)) {
+		return genExpressionLength(
+		    *dynamic_cast<const ExpressionFactorNode &>(node).expression,
+		    checked);
 	} else {
-		len = genStrlen(factor.val);
+		throw std::runtime_error("Unknown factor");
 	}
+}
+
+llvm::Value *LLVMCodeGen::genItemLength(const ItemNode &node, bool checked) {
+	// len(x * n) = len(x) * n
+	auto *len = genFactorLength(*node.factor, checked);
 	for (auto repeat_time : node.repeat_times) {
 		if (repeat_time < 0) {
 			throw CompileException(node.position_begin,
 			                       "Repeat times can't be negative");
 		}
-		auto *times = builder.getInt32(repeat_time);
-		auto *newlen = builder.CreateMul(len, times, "_repeat_newlen");
-		auto *result = genStrAlloc(newlen);
+		len = genLengthMul(len, repeat_time, "_lenof_repeat", checked);
+	}
+	for (auto &repeat_variable : node.repeat_variables) {
+		len = genLengthMul(len,
+		                   genIntLoad(repeat_variable, node.position_begin),
+		                   "_lenof_repeat", checked);
+	}
+	return len;
+}
 
-		// String repeat code generation
-		{
-			// ---- C code ----
-			// result[newlen] = 0;
-			// int idx = 0;
-			// for (int i = 0; i < times; i++) {
-			//   for (int j = 0; j < len; j++) {
-			//     result[idx] = factor[j];
-			//     idx++;
-			//   }
-			// }
-			// ---- LLVM IR ----
-			// entry:
-			//   ...
-			//   %lastaddr = getelementptr inbounds i8, ptr %result, i32 %newlen
-			//   store i8 0, ptr %lastaddr
-			//   %times_is_zero = icmp eq i32 %times, 0
-			//   br i1 %times_is_zero, label %cont, label %outer_pre
-			// outer_pre: ; preds = %entry
-			//   %len_is_zero = icmp eq i32 %len, 0
-			//   br label %inner_pre
-			// outer_loop: ; preds = %inner_loop, %inner_pre
-			//   %dstidx_2 = phi i32 [ %dstidx_1, %inner_pre ], [ %next_dstidx, %inner_loop ]
-			//   %next_outer_i = add i32 %outer_i, 1
-			//   %outer_finished = icmp eq i32 %next_outer_i, %times
-			//   br i1 %outer_finished, label %cont, label %inner_pre
-			// inner_pre: ; preds = %outer_pre, %outer_loop
-			//   %outer_i = phi i32 [ 0, %outer_pre ], [ %next_outer_i, %outer_loop ]
-			//   %dstidx_1 = phi i32 [ 0, %outer_pre ], [ %dstidx_2, %outer_loop ]
-			//   br i1 %len_is_zero, label %outer_loop, label %inner_loop
-			// inner_loop: ; preds = %inner_pre, %inner_loop
-			//   %srcidx = phi i32 [ %next_srcidx, %inner_loop ], [ 0, %inner_pre ]
-			//   %dstidx = phi i32 [ %next_dstidx, %inner_loop ], [ %dstidx_1, %inner_pre ]
-			//   %srcaddr = getelementptr inbounds i8, ptr %factor, i32 %srcidx
-			//   %src = load i8, ptr %srcaddr
-			//   %dstaddr = getelementptr inbounds i8, ptr %result, i32 %dstidx
-			//   store i8 %src, ptr %dstaddr
-			//   %next_dstidx = add i32 %dstidx, 1
-			//   %next_srcidx = add i32 %srcidx, 1
-			//   %inner_finished = icmp eq i32 %next_srcidx, %len
-			//   br i1 %inner_finished, label %outer_loop, label %inner_loop
-			// cont: ; preds = %outer_loop, %entry
-			//   ...
+llvm::Value *LLVMCodeGen::genExpressionLength(const ExpressionNode &node,
+                                              bool checked) {
+	// len(x + y) = len(x) + len(y)
+	if (node.items.empty()) {
+		throw CompileException(node.position_begin,
+		                       "Expression can't be empty");
+	}
+	llvm::Value *total_len = nullptr;
+	for (auto &item_node : node.items) {
+		auto *len = genItemLength(*item_node, checked);
+		if (total_len == nullptr) {
+			total_len = len;
+		} else {
+			total_len = genLengthAdd(total_len, len, "_lenof_concat", checked);
+		}
+	}
+	return total_len;
+}
 
-			auto *entry = builder.GetInsertBlock();
-			auto *current_func = entry->getParent();
-			auto *outer_pre = llvm::BasicBlock::Create(ctx, "_repeat_outer_pre",
-			                                           current_func);
-			auto *outer_loop = llvm::BasicBlock::Create(
-			    ctx, "_repeat_outer_loop", current_func);
-			auto *inner_pre = llvm::BasicBlock::Create(ctx, "_repeat_inner_pre",
-			                                           current_func);
-			auto *inner_loop = llvm::BasicBlock::Create(
-			    ctx, "_repeat_inner_loop", current_func);
-			auto *cont =
-			    llvm::BasicBlock::Create(ctx, "_repeat_cont", current_func);
-			auto *lastaddr = builder.CreateInBoundsGEP(
-			    builder.getInt8Ty(), result, newlen, "_repeat_lastaddr");
-			builder.CreateStore(builder.getInt8(0), lastaddr);
-			auto *times_is_zero = builder.CreateICmpEQ(
-			    times, builder.getInt32(0), "_repeat_times_is_zero");
-			builder.CreateCondBr(times_is_zero, cont, outer_pre);
-
-			builder.SetInsertPoint(outer_pre);
-			auto *len_is_zero = builder.CreateICmpEQ(len, builder.getInt32(0),
-			                                         "_repeat_len_is_zero");
-			builder.CreateBr(inner_pre);
-
-			builder.SetInsertPoint(inner_pre);
-			auto *outer_i =
-			    builder.CreatePHI(builder.getInt32Ty(), 2, "_repeat_outer_i");
-			auto *dstidx_1 =
-			    builder.CreatePHI(builder.getInt32Ty(), 2, "_repeat_dstidx_1");
-			builder.CreateCondBr(len_is_zero, outer_loop, inner_loop);
-
-			builder.SetInsertPoint(outer_loop);
-			auto *dstidx_2 =
-			    builder.CreatePHI(builder.getInt32Ty(), 2, "_repeat_dstidx_2");
-			auto *next_outer_i = builder.CreateAdd(outer_i, builder.getInt32(1),
-			                                       "_repeat_next_outer_i");
-			auto *outer_finished = builder.CreateICmpEQ(
-			    next_outer_i, times, "_repeat_outer_finished");
-			builder.CreateCondBr(outer_finished, cont, inner_pre);
-
-			builder.SetInsertPoint(inner_loop);
-			auto *srcidx =
-			    builder.CreatePHI(builder.getInt32Ty(), 2, "_repeat_srcidx");
-			auto *dstidx =
-			    builder.CreatePHI(builder.getInt32Ty(), 2, "_repeat_dstidx");
-			auto *srcaddr = builder.CreateInBoundsGEP(
-			    builder.getInt8Ty(), factor.val, srcidx, "_repeat_srcaddr");
-			auto *src =
-			    builder.CreateLoad(builder.getInt8Ty(), srcaddr, "_repeat_src");
-			auto *dstaddr = builder.CreateInBoundsGEP(
-			    builder.getInt8Ty(), result, dstidx, "_repeat_dstaddr");
-			builder.CreateStore(src, dstaddr);
-			auto *next_dstidx = builder.CreateAdd(dstidx, builder.getInt32(1),
-			                                      "_repeat_next_dst_idx");
-			auto *next_srcidx = builder.CreateAdd(srcidx, builder.getInt32(1),
-			                                      "_repeat_next_src_idx");
-			auto *inner_finished = builder.CreateICmpEQ(
-			    next_srcidx, len, "_repeat_inner_finished");
-			builder.CreateCondBr(inner_finished, outer_loop, inner_loop);
-
-			dstidx_2->addIncoming(dstidx_1, inner_pre);
-			dstidx_2->addIncoming(next_dstidx, inner_loop);
-			outer_i->addIncoming(builder.getInt32(0), outer_pre);
-			outer_i->addIncoming(next_outer_i, outer_loop);
-			dstidx_1->addIncoming(builder.getInt32(0), outer_pre);
-			dstidx_1->addIncoming(dstidx_2, outer_loop);
-			srcidx->addIncoming(next_srcidx, inner_loop);
-			srcidx->addIncoming(builder.getInt32(0), inner_pre);
-			dstidx->addIncoming(next_dstidx, inner_loop);
-			dstidx->addIncoming(dstidx_1, inner_pre);
+llvm::Value *LLVMCodeGen::genFactorInto(const FactorNode &node,
+                                        llvm::Value *dst,
+                                        llvm::Value *offset) {
+	if (typeid(node) == typeid(ExpressionFactorNode)) {
+		return genExpressionInto(
+		    *dynamic_cast<const ExpressionFactorNode &>(node).expression, dst,
+		    offset);
+	}
+	// a literal or a variable, copied from where it is stored
+	auto factor = visitFactor(node);
+	if (!factor.val->getType()->isPointerTy()) {
+		throw CompileException(node.position_begin,
+		                       "Operand of concat operator must be string");
+	}
+	return genStrCopy(dst, offset, factor.val, factor.strlen);
+}
 
-			builder.SetInsertPoint(cont);
+llvm::Value *LLVMCodeGen::genItemInto(const ItemNode &node, llvm::Value *dst,
+                                      llvm::Value *offset) {
+	int64_t times = 1;
+	for (auto repeat_time : node.repeat_times) {
+		if (repeat_time < 0) {
+			throw CompileException(node.position_begin,
+			                       "Repeat times can't be negative");
+		}
+		// A product this large can only come up for an empty factor, as
+		// genItemLength() checks the length
+		times = repeat_time != 0 && times > INT64_MAX / repeat_time
+		            ? INT64_MAX
+		            : times * repeat_time;
+	}
+	if (times == 0) {
+		// genItemLength() reserved no room for it
+		return offset;
+	}
+	if (!node.repeat_variables.empty()) {
+		llvm::Value *dynamic_times = builder.getInt64(times);
+		for (auto &repeat_variable : node.repeat_variables) {
+			dynamic_times = builder.CreateMul(
+			    dynamic_times,
+			    genIntLoad(repeat_variable, node.position_begin),
+			    "_repeat_times");
 		}
+		return genRepeatInto(node, dynamic_times, dst, offset);
+	}
+	// ---- C code ----
+	// char *start = dst + offset;
+	// size_t len = write_factor(dst + offset) - offset;
+	// for (size_t done = 1; done < times; done += n) {
+	//   size_t n = min(done, times - done);
+	//   memcpy(start + len * done, start, len * n);
+	// }
+	// (the copies double in size, and are unrolled since times is known)
+	auto *end = genFactorInto(*node.factor, dst, offset);
+	if (times == 1) {
+		return end;
+	}
+	auto *len = builder.CreateSub(end, offset, "_repeat_len");
+	auto *start = builder.CreateInBoundsGEP(builder.getInt8Ty(), dst, offset,
+	                                        "_repeat_start");
+	for (int64_t done = 1; done < times;) {
+		auto n = std::min(done, times - done);
+		auto *copy_len = n == 1 ? len
+		                        : builder.CreateMul(len, builder.getInt64(n),
+		                                            "_repeat_copy_len");
+		end = genStrCopy(dst, end, start, copy_len);
+		done += n;
+	}
+	return end;
+}
 
-		destructTransientValue(std::move(factor));
-		factor = {
-		    .val = result,
-		    .transient = true,
-		    .strlen = newlen,
-		};
-		len = newlen;
+llvm::Value *LLVMCodeGen::genRepeatInto(const ItemNode &node,
+                                        llvm::Value *times, llvm::Value *dst,
+                                        llvm::Value *offset) {
+	// The same doubling copies as genItemInto(), for a number of times only
+	// known at runtime. The product of the repeat counts may wrap around
+	// only if the factor is empty, as genItemLength() checks the length, so
+	// nothing is copied then.
+	// ---- C code ----
+	// if (times != 0) {
+	//   char *start = dst + offset;
+	//   size_t len = write_factor(dst + offset) - offset;
+	//   offset += len;
+	//   for (size_t done = 1; len != 0 && done < times; done += n) {
+	//     size_t n = min(done, times - done);
+	//     offset = memcpy(dst + offset, start, len * n) + len * n;
+	//   }
+	// }
+	auto *entry = builder.GetInsertBlock();
+	auto *current_func = entry->getParent();
+	auto *write =
+	    llvm::BasicBlock::Create(ctx, "_repeatn_write", current_func);
+	auto *loop = llvm::BasicBlock::Create(ctx, "_repeatn_loop", current_func);
+	auto *copy = llvm::BasicBlock::Create(ctx, "_repeatn_copy", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_repeatn_cont", current_func);
+	builder.CreateCondBr(builder.CreateIsNull(times, "_repeatn_none"), cont,
+	                     write);
+
+	builder.SetInsertPoint(write);
+	auto *end = genFactorInto(*node.factor, dst, offset);
+	auto *len = builder.CreateSub(end, offset, "_repeatn_len");
+	auto *start = builder.CreateInBoundsGEP(builder.getInt8Ty(), dst, offset,
+	                                        "_repeatn_start");
+	auto *write_end = builder.GetInsertBlock();
+	builder.CreateBr(loop);
+
+	builder.SetInsertPoint(loop);
+	auto *done = builder.CreatePHI(builder.getInt64Ty(), 2, "_repeatn_done");
+	auto *loop_end = builder.CreatePHI(builder.getInt64Ty(), 2, "_repeatn_end");
+	auto *more = builder.CreateAnd(
+	    builder.CreateIsNotNull(len),
+	    builder.CreateICmpULT(done, times), "_repeatn_more");
+	builder.CreateCondBr(more, copy, cont);
+
+	builder.SetInsertPoint(copy);
+	auto *n = builder.CreateBinaryIntrinsic(
+	    llvm::Intrinsic::umin, done, builder.CreateSub(times, done), nullptr,
+	    "_repeatn_n");
+	auto *next_end =
+	    genStrCopy(dst, loop_end, start,
+	               builder.CreateMul(len, n, "_repeatn_copy_len"));
+	auto *next_done = builder.CreateAdd(done, n, "_repeatn_next_done");
+	done->addIncoming(builder.getInt64(1), write_end);
+	done->addIncoming(next_done, builder.GetInsertBlock());
+	loop_end->addIncoming(end, write_end);
+	loop_end->addIncoming(next_end, builder.GetInsertBlock());
+	builder.CreateBr(loop);
+
+	builder.SetInsertPoint(cont);
+	auto *result = builder.CreatePHI(builder.getInt64Ty(), 2, "_repeatn_end");
+	result->addIncoming(offset, entry);
+	result->addIncoming(loop_end, loop);
+	return result;
+}
+
+llvm::Value *LLVMCodeGen::genExpressionInto(const ExpressionNode &node,
+                                            llvm::Value *dst,
+                                            llvm::Value *offset) {
+	// Every leaf is copied straight to its final offset in dst, so nested
+	// concats and repeats create no intermediate strings. Reading operands
+	// is free of side effects, so the lengths computed beforehand by
+	// genExpressionLength() still hold. Adjacent literal-only items are
+	// copied from a single literal.
+	std::string literal_run;
+	auto flush_literal_run = [&]() {
+		if (!literal_run.empty()) {
+			auto literal = genLiteral(literal_run);
+			offset = genStrCopy(dst, offset, literal.val, literal.strlen);
+			literal_run.clear();
+		}
+	};
+	for (auto &item_node : node.items) {
+		auto value = literalValue(*item_node);
+		if (!value.has_value()) {
+			flush_literal_run();
+			offset = genItemInto(*item_node, dst, offset);
+			continue;
+		}
+		if (literal_run.size() + value->size() > max_folded_length) {
+			flush_literal_run();
+		}
+		literal_run += *value;
 	}
-	return factor;
+	flush_literal_run();
+	return offset;
 }
 
-LLVMCodeGen::DestructibleValue
-LLVMCodeGen::visitExpression(const ExpressionNode &node) {
-	auto item_count = node.items.size();
-	if (item_count == 0) {
-		throw CompileException(node.position_begin,
-		                       "Expression can't be empty");
+void LLVMCodeGen::genIntCheck(llvm::Value *overflow) {
+	// ---- C code ----
+	// if (overflow) _int_overflow();
+	if (auto *constant = llvm::dyn_cast<llvm::ConstantInt>(overflow)) {
+		if (constant->isZero()) {
+			return;
+		}
 	}
-	if (item_count == 1) {
-		return visitItem(*node.items[0]);
+	auto *current_func = builder.GetInsertBlock()->getParent();
+	auto *fail = llvm::BasicBlock::Create(ctx, "_int_overflow", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_int_ok", current_func);
+	builder.CreateCondBr(overflow, fail, cont,
+	                     llvm::MDBuilder(ctx).createBranchWeights(1, 1 << 20));
+
+	builder.SetInsertPoint(fail);
+	builder.CreateCall(runtime.intOverflow());
+	builder.CreateUnreachable();
+
+	builder.SetInsertPoint(cont);
+}
+
+llvm::Value *LLVMCodeGen::genIntLoad(const std::string &name, int position) {
+	auto it = variables.find(name);
+	if (it == variables.end()) {
+		throw CompileException(position, "Undefined variable: " + name);
 	}
-	llvm::Value *total_len = nullptr;
-	std::vector<DestructibleValue> item_vals;
-	for (auto &item_node : node.items) {
-		auto item = visitItem(*item_node);
-		if (!item.val->getType()->isPointerTy()) {
-			throw CompileException(item_node->position_begin,
-			                       "Operand of concat operator must be string");
+	return builder.CreateLoad(builder.getInt64Ty(), it->second, name);
+}
+
+llvm::Value *LLVMCodeGen::genIntFactor(const FactorNode &node) {
+	if (typeid(node) == typeid(IntegerFactorNode)) {
+		return builder.getInt64(
+		    dynamic_cast<const IntegerFactorNode &>(node).value);
+	} else if (typeid(node) == typeid(VariableFactorNode)) {
+		auto &variable = dynamic_cast<const VariableFactorNode &>(node);
+		std::optional<LengthInterval> known;
+		if (lengths.has_value()) {
+			known = lengths->lengthOf(variable);
 		}
-		if (!item.strlen.has_value()) {
-			item.strlen = genStrlen(item.val);
+		if (known.has_value() && known->isExact() &&
+		    known->lo <= static_cast<uint64_t>(INT64_MAX)) {
+			return builder.getInt64(known->lo);
 		}
-		if (total_len == nullptr) {
-			total_len = *item.strlen;
-		} else {
-			total_len =
-			    builder.CreateAdd(total_len, *item.strlen, "_concat_tmplen");
-		}
-		item_vals.push_back(std::move(item));
-	}
-	auto *result = genStrAlloc(total_len);
-
-	// String concat code generation
-	{
-		// ---- C Code ----
-		// for (size_t idx = 0; idx < len; idx++) {
-		//   result[offset++] = src[idx];
-		// }
-		// ---- LLVM IR ----
-		// entry:
-		//   ...
-		//   %len_is_zero = icmp eq i32 %len, 0
-		//   br i1 %len_is_zero, label %cont, label %loop
-		// loop: ; preds = %entry, %loop
-		//   %srcidx = phi i32 [ %next_srcidx, %loop ], [ 0, %entry ]
-		//   %dstidx = phi i32 [ %next_dstidx, %loop ], [ %offset, %entry ]
-		//   %srcptr = getelementptr inbounds i8, ptr %src, i32 %srcidx
-		//   %src_element = load i8, ptr %srcptr
-		//   %dstptr = getelementptr inbounds i8, ptr %result, i32 %dstidx
-		//   store i8 %src_element, ptr %dstptr
-		//   %next_srcidx = add i32 %srcidx, 1
-		//   %next_dstidx = add i32 %dstidx, 1
-		//   %cond = icmp eq i32 %next_srcidx, %len
-		//   br i1 %cond, label %cont, label %loop
-		// cont: ; preds = %loop, %entry
-		//   %end_idx = phi i32 [ %offset, %entry ], [ %next_dstidx, %loop ]
-		//   ...
-		auto *lastaddr = builder.CreateInBoundsGEP(
-		    builder.getInt8Ty(), result, total_len, "_concat_lastaddr");
-		builder.CreateStore(builder.getInt8(0), lastaddr);
-		llvm::Value *offset = builder.getInt32(0);
-		for (auto &item_val : item_vals) {
-			auto *len = *item_val.strlen;
-			auto *src = item_val.val;
-			auto *entry = builder.GetInsertBlock();
-			auto *current_func = entry->getParent();
-			auto *loop =
-			    llvm::BasicBlock::Create(ctx, "_concat_loop", current_func);
-			auto *cont =
-			    llvm::BasicBlock::Create(ctx, "_concat_cont", current_func);
-			auto *len_is_zero = builder.CreateICmpEQ(len, builder.getInt32(0),
-			                                         "_concat_len_is_zero");
-			builder.CreateCondBr(len_is_zero, cont, loop);
-
-			builder.SetInsertPoint(loop);
-			auto *srcidx =
-			    builder.CreatePHI(builder.getInt32Ty(), 2, "_concat_srcidx");
-			auto *dstidx =
-			    builder.CreatePHI(builder.getInt32Ty(), 2, "_concat_dstidx");
-			auto *srcptr = builder.CreateInBoundsGEP(builder.getInt8Ty(), src,
-			                                         srcidx, "_concat_srcptr");
-			auto *src_element = builder.CreateLoad(builder.getInt8Ty(), srcptr,
-			                                       "_concat_src_element");
-			auto *dstptr = builder.CreateInBoundsGEP(
-			    builder.getInt8Ty(), result, dstidx, "_concat_dstptr");
-			builder.CreateStore(src_element, dstptr);
-			auto *next_srcidx = builder.CreateAdd(srcidx, builder.getInt32(1),
-			                                      "_concat_next_srcidx");
-			auto *next_dstidx = builder.CreateAdd(dstidx, builder.getInt32(1),
-			                                      "_concat_next_dstidx");
-			auto *cond = builder.CreateICmpEQ(next_srcidx, len, "_concat_cond");
-			builder.CreateCondBr(cond, cont, loop);
+		auto *value = genIntLoad(variable.identifier, node.position_begin);
+		if (known.has_value()) {
+			// lets LLVM fold comparisons with the value
+			llvm::cast<llvm::Instruction>(value)->setMetadata(
+			    llvm::LLVMContext::MD_range,
+			    llvm::MDBuilder(ctx).createRange(
+			        llvm::APInt(64, known->lo),
+			        llvm::APInt(64, std::min<uint64_t>(known->hi, INT64_MAX) +
+			                            1)));
+		}
+		return value;
+	} else if (typeid(node) == typeid(ExpressionFactorNode)) {
+		return genIntExpression(
+		    *dynamic_cast<const ExpressionFactorNode &>(node).expression);
+	} else {
+		throw CompileException(node.position_begin,
+		                       "Operand of add operator must be int");
+	}
+}
 
-			builder.SetInsertPoint(cont);
-			auto *end_idx = builder.CreatePHI(builder.getInt32Ty(), 2);
+llvm::Value *LLVMCodeGen::genIntExpression(const ExpressionNode &node) {
+	// Ints only hold sums of literals, so they are never negative, and a
+	// sum overflows exactly when it exceeds INT64_MAX
+	// ---- C code ----
+	// int64_t sum = item_0;
+	// if (__builtin_add_overflow(sum, item_1, &sum)) _int_overflow();
+	// ...
+	llvm::Value *sum = nullptr;
+	for (auto &item : node.items) {
+		if (!item->repeat_times.empty() || !item->repeat_variables.empty()) {
+			throw CompileException(item->position_begin,
+			                       "Operand of repeat operator must be string");
+		}
+		auto *value = genIntFactor(*item->factor);
+		if (sum == nullptr) {
+			sum = value;
+			continue;
+		}
+		auto *result = builder.CreateBinaryIntrinsic(
+		    llvm::Intrinsic::sadd_with_overflow, sum, value);
+		genIntCheck(builder.CreateExtractValue(result, 1, "_int_overflows"));
+		sum = builder.CreateExtractValue(result, 0, "_int_sum");
+	}
+	return sum;
+}
 
-			srcidx->addIncoming(next_srcidx, loop);
-			srcidx->addIncoming(builder.getInt32(0), entry);
-			dstidx->addIncoming(next_dstidx, loop);
-			dstidx->addIncoming(offset, entry);
-			end_idx->addIncoming(offset, entry);
-			end_idx->addIncoming(next_dstidx, loop);
+// Whether the value of an expression has a string header whenever it is
+// longer than sso_capacity, i.e. it is a variable or a literal.
+static bool hasStringHeader(const ExpressionNode &node) {
+	if (node.items.size() != 1 || !node.items[0]->repeat_times.empty() ||
+	    !node.items[0]->repeat_variables.empty()) {
+		return false;
+	}
+	auto &factor = *node.items[0]->factor;
+	return typeid(factor) == typeid(VariableFactorNode) ||
+	       typeid(factor) == typeid(StringFactorNode);
+}
 
-			destructTransientValue(std::move(item_val));
+// Flattens an expression into its literal and variable leaves in order,
+// with repeats unrolled. Returns false if there are too many of them.
+static bool collectSegments(const ExpressionNode &node,
+                            std::vector<const FactorNode *> &segments) {
+	for (auto &item : node.items) {
+		if (!item->repeat_variables.empty()) {
+			return false;
+		}
+		// checked before each multiply, so that it can't overflow
+		size_t times = 1;
+		for (auto repeat_time : item->repeat_times) {
+			if (repeat_time < 0 ||
+			    (repeat_time != 0 &&
+			     times > max_stream_segments / repeat_time)) {
+				return false;
+			}
+			times *= repeat_time;
+		}
+		if (times == 0) {
+			continue;
+		}
+		std::vector<const FactorNode *> factor_segments;
+		auto &factor = *item->factor;
+		if (typeid(factor) == typeid(ExpressionFactorNode)) {
+			auto &expression =
+			    *dynamic_cast<const ExpressionFactorNode &>(factor).expression;
+			if (!collectSegments(expression, factor_segments)) {
+				return false;
+			}
+		} else {
+			factor_segments.push_back(&factor);
+		}
+		if (factor_segments.empty()) {
+			continue;
+		}
+		if (times > (max_stream_segments - segments.size()) /
+		                factor_segments.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < times; i++) {
+			segments.insert(segments.end(), factor_segments.begin(),
+			                factor_segments.end());
+		}
+	}
+	return true;
+}
 
-			offset = end_idx;
+llvm::Value *LLVMCodeGen::genSegments(
+    const std::vector<const FactorNode *> &segments) {
+	// ---- C code ----
+	// struct segment segments[n] = {{factor, len(factor)}, ...};
+	auto *segment_type = runtime.segmentType();
+	auto *array_type = llvm::ArrayType::get(segment_type, segments.size());
+	auto *array = genEntryAlloca(array_type, "_segments");
+	for (size_t i = 0; i < segments.size(); i++) {
+		auto factor = visitFactor(*segments[i]);
+		if (!factor.val->getType()->isPointerTy()) {
+			throw CompileException(
+			    segments[i]->position_begin,
+			    "Operand of relation operator must be string");
 		}
+		auto *segment = builder.CreateConstInBoundsGEP2_32(array_type, array,
+		                                                   0, i, "_segment");
+		builder.CreateStore(factor.val,
+		                    builder.CreateStructGEP(segment_type, segment, 0));
+		builder.CreateStore(factor.strlen,
+		                    builder.CreateStructGEP(segment_type, segment, 1));
 	}
+	return builder.CreateConstInBoundsGEP2_32(array_type, array, 0, 0,
+	                                          "_segments_begin");
+}
 
-	return {
-	    .val = result,
-	    .transient = true,
-	    .strlen = total_len,
-	};
+llvm::Value *
+LLVMCodeGen::genStreamingEqual(const ConditionNode &node,
+                               const std::vector<const FactorNode *> &lhs,
+                               const std::vector<const FactorNode *> &rhs) {
+	// Neither operand is built: the lengths are compared first, then the
+	// pieces of both sides are walked in step until the first mismatch.
+	// ---- C code ----
+	// bool result = len(lhs) == len(rhs) &&
+	//               _segments_equal(lhs_segments, n, rhs_segments, m);
+	auto *lhs_len = genExpressionLength(*node.lhs);
+	auto *rhs_len = genExpressionLength(*node.rhs);
+	auto *entry = builder.GetInsertBlock();
+	auto *current_func = entry->getParent();
+	auto *compare =
+	    llvm::BasicBlock::Create(ctx, "_streameq_compare", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_streameq_cont", current_func);
+	auto *samelen = builder.CreateICmpEQ(lhs_len, rhs_len, "_streameq_samelen");
+	builder.CreateCondBr(samelen, compare, cont);
+
+	builder.SetInsertPoint(compare);
+	auto *lhs_segments = genSegments(lhs);
+	auto *rhs_segments = genSegments(rhs);
+	auto *streq = builder.CreateCall(
+	    runtime.segmentsEqual(),
+	    {lhs_segments, builder.getInt64(lhs.size()), rhs_segments,
+	     builder.getInt64(rhs.size())},
+	    "_streameq_streq");
+	auto *compare_end = builder.GetInsertBlock();
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
+	auto *result = builder.CreatePHI(builder.getInt1Ty(), 2);
+	result->addIncoming(builder.getFalse(), entry);
+	result->addIncoming(streq, compare_end);
+	return result;
 }
 
 llvm::Value *LLVMCodeGen::visitCondition(const ConditionNode &node) {
+	if (lengths.has_value()) {
+		if (auto result = lengths->decided(node)) {
+			// the operands are free of side effects, so they are skipped
+			return builder.getInt1(*result);
+		}
+	}
+	if (isIntExpression(*node.lhs, int_variables)) {
+		auto *lhs = genIntExpression(*node.lhs);
+		auto *rhs = genIntExpression(*node.rhs);
+		switch (node.op) {
+		case RelationOp::LESS:
+			return builder.CreateICmpSLT(lhs, rhs, "_cond");
+		case RelationOp::GREATER:
+			return builder.CreateICmpSGT(lhs, rhs, "_cond");
+		case RelationOp::LESS_EQUAL:
+			return builder.CreateICmpSLE(lhs, rhs, "_cond");
+		case RelationOp::GREATER_EQUAL:
+			return builder.CreateICmpSGE(lhs, rhs, "_cond");
+		case RelationOp::NOT_EQUAL:
+			return builder.CreateICmpNE(lhs, rhs, "_cond");
+		case RelationOp::EQUAL:
+			return builder.CreateICmpEQ(lhs, rhs, "_cond");
+		}
+	}
+	switch (node.op) {
+	case RelationOp::LESS:
+	case RelationOp::GREATER:
+	case RelationOp::LESS_EQUAL:
+	case RelationOp::GREATER_EQUAL: {
+		// Only lengths are compared, so the operands are never materialized
+		auto *lhs_len = genExpressionLength(*node.lhs);
+		auto *rhs_len = genExpressionLength(*node.rhs);
+		switch (node.op) {
+		case RelationOp::LESS:
+			return builder.CreateICmpULT(lhs_len, rhs_len, "_cond");
+		case RelationOp::GREATER:
+			return builder.CreateICmpUGT(lhs_len, rhs_len, "_cond");
+		case RelationOp::LESS_EQUAL:
+			return builder.CreateICmpULE(lhs_len, rhs_len, "_cond");
+		case RelationOp::GREATER_EQUAL:
+			return builder.CreateICmpUGE(lhs_len, rhs_len, "_cond");
+		default:
+			throw std::runtime_error("Unknown op");
+		}
+	}
+	default:
+		break;
+	}
+
+	// Unless both operands are stored strings already, == and <> are
+	// evaluated piecewise instead of building the operands
+	std::vector<const FactorNode *> lhs_segments;
+	std::vector<const FactorNode *> rhs_segments;
+	if (!(hasStringHeader(*node.lhs) && hasStringHeader(*node.rhs)) &&
+	    collectSegments(*node.lhs, lhs_segments) &&
+	    collectSegments(*node.rhs, rhs_segments)) {
+		auto *result = genStreamingEqual(node, lhs_segments, rhs_segments);
+		switch (node.op) {
+		case RelationOp::EQUAL:
+			return result;
+		case RelationOp::NOT_EQUAL:
+			return builder.CreateNot(result, "_streameq_not");
+		default:
+			throw std::runtime_error("Unknown op");
+		}
+	}
+
 	auto lhs = visitExpression(*node.lhs);
 	if (!lhs.val->getType()->isPointerTy()) {
-		throw new CompileException(
+		throw CompileException(
 		    node.lhs->position_begin,
 		    "Operand of relation operator must be string");
 	}
-	if (!lhs.strlen.has_value()) {
-		lhs.strlen = genStrlen(lhs.val);
-	}
 
 	switch (node.op) {
 
@@ -417,32 +1121,36 @@ llvm::Value *LLVMCodeGen::visitCondition(const ConditionNode &node) {
 	case RelationOp::NOT_EQUAL: {
 		auto rhs = visitExpression(*node.rhs);
 		if (!rhs.val->getType()->isPointerTy()) {
-			throw new CompileException(
+			throw CompileException(
 			    node.rhs->position_begin,
 			    "Operand of relation operator must be string");
 		}
-		if (!rhs.strlen.has_value()) {
-			rhs.strlen = genStrlen(rhs.val);
-		}
 
 		llvm::PHINode *result;
 		// String equal compare code generation
 		{
 			auto *a = lhs.val;
 			auto *b = rhs.val;
-			auto *len_a = *lhs.strlen;
-			auto *len_b = *rhs.strlen;
+			auto *len_a = lhs.strlen;
+			auto *len_b = rhs.strlen;
+			// Hashes are cached in the string header, so they are only used
+			// when both operands are known to have one.
+			bool use_hash = options.hash_strings &&
+			                hasStringHeader(*node.lhs) &&
+			                hasStringHeader(*node.rhs);
 			// ---- C Code ----
 			// bool eq(char* a, char* b, size_t len_a, size_t len_b) {
 			//   if (len_a != len_b) {
 			//     return false;
 			//   }
-			//   for (size_t i = 0; i < len_a; i++) {
-			//     if (a[i] != b[i]) {
-			//       return false;
-			//     }
+			//   if (len_a == 0 || a == b) {
+			//     return true;
 			//   }
-			//   return true;
+			//   if (use_hash && len_a > sso_capacity &&
+			//       _string_hash(a, len_a) != _string_hash(b, len_b)) {
+			//     return false;
+			//   }
+			//   return memcmp(a, b, len_a) == 0;
 			// }
 			// ---- LLVM IR ----
 			// entry:
@@ -451,42 +1159,28 @@ llvm::Value *LLVMCodeGen::visitCondition(const ConditionNode &node) {
 			//   br i1 %samelen, label %check_empty, label %cont
 			// check_empty: ; preds = %entry
 			//   %empty = icmp eq i32 %len_a, 0
-			//   br i1 %empty, label %cont, label %check_first
-			// check_first: ; preds = %check_empty
-			//   %first_a = load i8, ptr %a
-			//   %first_b = load i8, ptr %b
-			//   %samefirst = icmp eq i8 %first_a, %first_b
-			//   br i1 %samefirst, label %loop_increment, label %cont
-			// loop_increment: ; preds = %check_first, %loop_body
-			//   %old_idx = phi i32 [ %idx, %loop_body ], [ 0, %check_first ]
-			//   %idx = add i32 %old_idx, 1
-			//   %loop_finished = icmp eq i32 %idx, %len_a
-			//   br i1 %loop_finished, label %loop_end, label %loop_body
-			// loop_body: ; preds = %loop_increment
-			//   %addr_a = getelementptr inbounds i8, ptr %a, i32 %idx
-			//   %val_a = load i8, ptr %addr_a
-			//   %addr_b = getelementptr inbounds i8, ptr %b, i32 %idx
-			//   %val_b = load i8, ptr %addr_b
-			//   %sameval = icmp eq i8 %val_a, %val_b
-			//   br i1 %sameval, label %loop_increment, label %loop_end
-			// loop_end: ; preds = %loop_increment, %loop_body
-			//   %streq = icmp uge i32 %idx, %len_a
+			//   br i1 %empty, label %cont, label %check_same
+			// check_same: ; preds = %check_empty
+			//   %same = icmp eq ptr %a, %b
+			//   br i1 %same, label %cont, label %compare
+			// (check_hash, only if use_hash)
+			// compare: ; preds = %check_same
+			//   %len = zext i32 %len_a to i64
+			//   %cmp = call i32 @memcmp(ptr %a, ptr %b, i64 %len)
+			//   %streq = icmp eq i32 %cmp, 0
 			//   br label %cont
-			// cont: ; preds = %check_empty, %check_first, %loop_end, %entry
-			//   result = phi i1 [ false, %entry ], [ true, %check_empty ], [ false, %check_first ], [ %streq, %loop_end ]
+			// cont:
+			//   result = phi i1 [ false, %entry ], [ true, %check_empty ],
+			//                   [ true, %check_same ], [ %streq, %compare ]
 			//   ...
 			auto *entry = builder.GetInsertBlock();
 			auto *current_func = entry->getParent();
 			auto *check_empty = llvm::BasicBlock::Create(
 			    ctx, "_streq_check_empty", current_func);
-			auto *check_first = llvm::BasicBlock::Create(
-			    ctx, "_streq_check_first", current_func);
-			auto *loop_increment = llvm::BasicBlock::Create(
-			    ctx, "_streq_loop_increment", current_func);
-			auto *loop_body =
-			    llvm::BasicBlock::Create(ctx, "_streq_loop_body", current_func);
-			auto *loop_end =
-			    llvm::BasicBlock::Create(ctx, "_streq_loop_end", current_func);
+			auto *check_same = llvm::BasicBlock::Create(
+			    ctx, "_streq_check_same", current_func);
+			auto *compare =
+			    llvm::BasicBlock::Create(ctx, "_streq_compare", current_func);
 			auto *cont =
 			    llvm::BasicBlock::Create(ctx, "_streq_cont", current_func);
 			auto *samelen =
@@ -494,54 +1188,55 @@ llvm::Value *LLVMCodeGen::visitCondition(const ConditionNode &node) {
 			builder.CreateCondBr(samelen, check_empty, cont);
 
 			builder.SetInsertPoint(check_empty);
-			auto *empty = builder.CreateICmpEQ(len_a, builder.getInt32(0),
+			auto *empty = builder.CreateICmpEQ(len_a, builder.getInt64(0),
 			                                   "_streq_empty");
-			builder.CreateCondBr(empty, cont, check_first);
-
-			builder.SetInsertPoint(check_first);
-			auto *first_a =
-			    builder.CreateLoad(builder.getInt8Ty(), a, "_streq_first_a");
-			auto *first_b =
-			    builder.CreateLoad(builder.getInt8Ty(), b, "_streq_first_b");
-			auto *samefirst =
-			    builder.CreateICmpEQ(first_a, first_b, "_streq_samefirst");
-			builder.CreateCondBr(samefirst, loop_increment, cont);
-
-			builder.SetInsertPoint(loop_increment);
-			auto *old_idx =
-			    builder.CreatePHI(builder.getInt32Ty(), 2, "_streq_old_idx");
-			auto *idx =
-			    builder.CreateAdd(old_idx, builder.getInt32(1), "_streq_idx");
-			auto *loop_finished =
-			    builder.CreateICmpEQ(idx, len_a, "_streq_loop_finished");
-			builder.CreateCondBr(loop_finished, loop_end, loop_body);
-
-			builder.SetInsertPoint(loop_body);
-			auto *addr_a = builder.CreateInBoundsGEP(builder.getInt8Ty(), a,
-			                                         idx, "_streq_addr_a");
-			auto *val_a =
-			    builder.CreateLoad(builder.getInt8Ty(), addr_a, "_streq_val_a");
-			auto *addr_b = builder.CreateInBoundsGEP(builder.getInt8Ty(), b,
-			                                         idx, "_streq_addr_b");
-			auto *val_b =
-			    builder.CreateLoad(builder.getInt8Ty(), addr_b, "_streq_val_b");
-			auto *sameval =
-			    builder.CreateICmpEQ(val_a, val_b, "_streq_sameval");
-			builder.CreateCondBr(sameval, loop_increment, loop_end);
-
-			builder.SetInsertPoint(loop_end);
-			auto *streq = builder.CreateICmpEQ(idx, len_a, "_streq_streq");
+			builder.CreateCondBr(empty, cont, check_same);
+
+			builder.SetInsertPoint(check_same);
+			auto *same = builder.CreateICmpEQ(a, b, "_streq_same");
+			llvm::BasicBlock *check_hash = nullptr;
+			llvm::BasicBlock *compare_hash = nullptr;
+			if (use_hash) {
+				check_hash = llvm::BasicBlock::Create(ctx, "_streq_check_hash",
+				                                      current_func);
+				compare_hash = llvm::BasicBlock::Create(
+				    ctx, "_streq_compare_hash", current_func);
+				builder.CreateCondBr(same, cont, check_hash);
+
+				builder.SetInsertPoint(check_hash);
+				auto *has_header = builder.CreateICmpUGT(
+				    len_a, builder.getInt64(sso_capacity), "_streq_has_header");
+				builder.CreateCondBr(has_header, compare_hash, compare);
+
+				builder.SetInsertPoint(compare_hash);
+				auto *hash_a = builder.CreateCall(runtime.stringHash(),
+				                                  {a, len_a}, "_streq_hash_a");
+				auto *hash_b = builder.CreateCall(runtime.stringHash(),
+				                                  {b, len_b}, "_streq_hash_b");
+				auto *samehash =
+				    builder.CreateICmpEQ(hash_a, hash_b, "_streq_samehash");
+				builder.CreateCondBr(samehash, compare, cont);
+			} else {
+				builder.CreateCondBr(same, cont, compare);
+			}
+
+			builder.SetInsertPoint(compare);
+			auto *cmp = builder.CreateCall(runtime.memcmp(), {a, b, len_a},
+			                               "_streq_cmp");
+			auto *streq =
+			    builder.CreateICmpEQ(cmp, builder.getInt32(0), "_streq_streq");
 			builder.CreateBr(cont);
 
 			builder.SetInsertPoint(cont);
-			result = builder.CreatePHI(builder.getInt1Ty(), 4);
+			result = builder.CreatePHI(builder.getInt1Ty(), 5);
 
-			old_idx->addIncoming(idx, loop_body);
-			old_idx->addIncoming(builder.getInt32(0), check_first);
 			result->addIncoming(builder.getFalse(), entry);
 			result->addIncoming(builder.getTrue(), check_empty);
-			result->addIncoming(builder.getFalse(), check_first);
-			result->addIncoming(streq, loop_end);
+			result->addIncoming(builder.getTrue(), check_same);
+			if (use_hash) {
+				result->addIncoming(builder.getFalse(), compare_hash);
+			}
+			result->addIncoming(streq, compare);
 		}
 		destructTransientValue(std::move(lhs));
 		destructTransientValue(std::move(rhs));
@@ -555,93 +1250,550 @@ llvm::Value *LLVMCodeGen::visitCondition(const ConditionNode &node) {
 		}
 	}
 
-	case RelationOp::LESS:
-	case RelationOp::GREATER:
-	case RelationOp::LESS_EQUAL:
-	case RelationOp::GREATER_EQUAL: {
-		auto *lhs_len = *lhs.strlen;
-		destructTransientValue(std::move(lhs));
-		auto rhs = visitExpression(*node.rhs);
-		if (!rhs.val->getType()->isPointerTy()) {
-			throw new CompileException(
-			    node.rhs->position_begin,
-			    "Operand of relation operator must be string");
-		}
-		if (!rhs.strlen.has_value()) {
-			rhs.strlen = genStrlen(rhs.val);
-		}
-		auto *rhs_len = *rhs.strlen;
-		destructTransientValue(std::move(rhs));
+	default:
+		throw std::runtime_error("Unknown op");
+	}
+}
 
-		switch (node.op) {
-		case RelationOp::LESS:
-			return builder.CreateICmpULT(lhs_len, rhs_len, "_cond");
-		case RelationOp::GREATER:
-			return builder.CreateICmpUGT(lhs_len, rhs_len, "_cond");
-		case RelationOp::LESS_EQUAL:
-			return builder.CreateICmpULE(lhs_len, rhs_len, "_cond");
-		case RelationOp::GREATER_EQUAL:
-			return builder.CreateICmpUGE(lhs_len, rhs_len, "_cond");
-		default:
-			throw std::runtime_error("Unknown op");
+static bool isSelfAppend(const AssignStatementNode &node) {
+	// var = var + ...
+	auto &items = node.expression->items;
+	if (items.size() < 2 || !items[0]->repeat_times.empty() ||
+	    !items[0]->repeat_variables.empty()) {
+		return false;
+	}
+	auto *var = dynamic_cast<const VariableFactorNode *>(&*items[0]->factor);
+	return var != nullptr && var->identifier == node.variable;
+}
+
+static bool readsVariable(const ExpressionNode &node,
+                          const std::string &variable);
+
+static bool readsVariable(const ItemNode &node, const std::string &variable) {
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(VariableFactorNode)) {
+		return dynamic_cast<const VariableFactorNode &>(factor).identifier ==
+		       variable;
+	}
+	if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		return readsVariable(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression,
+		    variable);
+	}
+	return false;
+}
+
+static bool readsVariable(const ExpressionNode &node,
+                          const std::string &variable) {
+	for (auto &item : node.items) {
+		if (readsVariable(*item, variable)) {
+			return true;
 		}
 	}
+	return false;
+}
 
-	default:
-		throw std::runtime_error("Unknown op");
+// var = expr, where expr is built at runtime into the storage of var
+static bool isOverwrite(const AssignStatementNode &node) {
+	auto &expression = *node.expression;
+	if (expression.items.size() == 1 &&
+	    expression.items[0]->repeat_times.empty() &&
+	    expression.items[0]->repeat_variables.empty() &&
+	    typeid(*expression.items[0]->factor) != typeid(ExpressionFactorNode)) {
+		return false; // shared or copied by genAssign()
 	}
+	return !literalValue(expression).has_value();
 }
 
 void LLVMCodeGen::visitAssignStatement(const AssignStatementNode &node) {
+	genAssignStatement(node);
+	genDebugAssign(node);
+	genArenaReset();
+}
+
+void LLVMCodeGen::genAssignStatement(const AssignStatementNode &node) {
 	auto var_it = variables.find(node.variable);
 	if (var_it == variables.end()) {
 		throw CompileException(node.position_begin,
 		                       "Undefined variable: " + node.variable);
 	}
 	auto *var_ptr = var_it->second;
-	auto expr = visitExpression(*node.expression);
-	if (!var_ptr->getAllocatedType()->isPointerTy() ||
-	    !expr.val->getType()->isPointerTy()) {
+	if (int_variables.contains(node.variable)) {
+		// ---- C code ----
+		// var = expr;
+		builder.CreateStore(genIntExpression(*node.expression), var_ptr);
+		return;
+	}
+	if (var_ptr->getType() != string_type->getPointerTo()) {
 		throw CompileException(node.position_begin,
 		                       "Assignment requires string operands");
 	}
 
-	// Destruct old string (freeing a nullptr is safe)
+	if (isSelfAppend(node)) {
+		genAppendAssign(node, var_ptr);
+	} else if (isOverwrite(node)) {
+		genOverwriteAssign(node, var_ptr);
+	} else {
+		genAssign(node, var_ptr);
+	}
+}
+
+void LLVMCodeGen::genDebugAssign(const AssignStatementNode &node) {
+	if (!options.debug_mode || temporaries.contains(node.variable)) {
+		return;
+	}
+	if (options.trace_file.empty()) {
+		genPrint(node.variable + " := ", node.variable);
+		return;
+	}
+	// ---- C code ----
+	// _trace_record(position, trace_id, var.str, var.len);
+	auto [str, len] = genVariableText(node.variable);
+	builder.CreateCall(runtime.traceRecord(),
+	                   {builder.getInt32(node.position_begin),
+	                    builder.getInt32(trace_ids.at(node.variable)), str,
+	                    len});
+}
+
+void LLVMCodeGen::genAssign(const AssignStatementNode &node,
+                            llvm::Value *var_ptr) {
+	auto expr = visitExpression(*node.expression, true);
+	if (!expr.val->getType()->isPointerTy()) {
+		throw CompileException(node.position_begin,
+		                       "Assignment requires string operands");
+	}
+	auto *len = expr.strlen;
+	auto *str_ptr = builder.CreateStructGEP(string_type, var_ptr, 0);
+	auto *len_ptr = builder.CreateStructGEP(string_type, var_ptr, 1);
+	auto *inline_buf = genVariableInlineBuffer(var_ptr);
 	auto *oldstr =
-	    builder.CreateLoad(builder.getInt8PtrTy(), var_ptr, "_assign_oldstr");
-	genStrFree(oldstr);
+	    builder.CreateLoad(builder.getInt8PtrTy(), str_ptr, "_assign_oldstr");
+
+	// ---- C code ----
+	// if (len <= sso_capacity) {
+	//   memmove(var.inline_buf, expr, len + 1); // expr may be var itself
+	//   newval = var.inline_buf;
+	// } else if (expr is transient) {
+	//   newval = expr; // move
+	// } else {
+	//   header(expr)->refcount++; // share (unless immortal)
+	//   newval = expr;
+	// }
+	// if (oldstr != var.inline_buf) retire(&var.spare, oldstr);
+	auto *entry = builder.GetInsertBlock();
+	auto *current_func = entry->getParent();
+	auto *on_inline =
+	    llvm::BasicBlock::Create(ctx, "_assign_inline", current_func);
+	auto *on_heap = llvm::BasicBlock::Create(ctx, "_assign_heap", current_func);
+	auto *store = llvm::BasicBlock::Create(ctx, "_assign_store", current_func);
+	auto *fits = builder.CreateICmpULE(len, builder.getInt64(sso_capacity),
+	                                   "_assign_fits");
+	auto *size = builder.CreateAdd(len, builder.getInt64(1), "_assign_size");
+	builder.CreateCondBr(fits, on_inline, on_heap);
+
+	builder.SetInsertPoint(on_inline);
+	builder.CreateMemMove(inline_buf, llvm::Align(), expr.val, llvm::Align(),
+	                      size);
+	destructTransientValue(DestructibleValue(expr));
+	auto *on_inline_end = builder.GetInsertBlock();
+	builder.CreateBr(store);
+
+	builder.SetInsertPoint(on_heap);
+	llvm::Value *heapval;
+	if (!expr.transient) {
+		// Share (a string this long always has a header)
+		genStrRetain(expr.val);
+		heapval = expr.val;
+	} else if (!expr.arena) {
+		// Move (a transient this long is always on the heap)
+		heapval = expr.val;
+	} else {
+		// Copy out of the arena
+		heapval = genStrAlloc(len);
+		genStrCopy(heapval, builder.getInt64(0), expr.val, size);
+	}
+	auto *on_heap_end = builder.GetInsertBlock();
+	builder.CreateBr(store);
+
+	builder.SetInsertPoint(store);
+	auto *newval =
+	    builder.CreatePHI(builder.getInt8PtrTy(), 2, "_assign_newval");
+	newval->addIncoming(inline_buf, on_inline_end);
+	newval->addIncoming(heapval, on_heap_end);
+	builder.CreateStore(newval, str_ptr);
+	builder.CreateStore(len, len_ptr);
+
+	// Release old string after the new value is built, since the
+	// expression may have read it (releasing a nullptr is safe)
+	auto *release_old =
+	    llvm::BasicBlock::Create(ctx, "_assign_release_old", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_assign_cont", current_func);
+	auto *old_is_inline =
+	    builder.CreateICmpEQ(oldstr, inline_buf, "_assign_old_is_inline");
+	builder.CreateCondBr(old_is_inline, cont, release_old);
+
+	builder.SetInsertPoint(release_old);
+	builder.CreateCall(runtime.stringRetire(),
+	                   {genVariableSpare(var_ptr), oldstr});
+	builder.CreateBr(cont);
 
-	llvm::Value *newval;
-	if (expr.transient) {
-		// Move
-		newval = expr.val;
+	builder.SetInsertPoint(cont);
+}
+
+void LLVMCodeGen::genOverwriteAssign(const AssignStatementNode &node,
+                                     llvm::Value *var_ptr) {
+	// When the expression reads var, it must not be built over the old value
+	bool aliased = readsVariable(*node.expression, node.variable);
+	auto *len = genExpressionLength(*node.expression);
+	auto *str_ptr = builder.CreateStructGEP(string_type, var_ptr, 0);
+	auto *len_ptr = builder.CreateStructGEP(string_type, var_ptr, 1);
+	auto *inline_buf = genVariableInlineBuffer(var_ptr);
+	auto *spare_ptr = genVariableSpare(var_ptr);
+	auto *oldstr = builder.CreateLoad(builder.getInt8PtrTy(), str_ptr,
+	                                  "_overwrite_oldstr");
+	auto *is_inline =
+	    builder.CreateICmpEQ(oldstr, inline_buf, "_overwrite_is_inline");
+	llvm::Value *tmp_buf = nullptr;
+	llvm::Value *short_dst = inline_buf;
+	if (aliased) {
+		auto *tmp = genEntryAlloca(inline_buf_type, "_overwrite_tmp");
+		tmp_buf = builder.CreateConstInBoundsGEP2_32(inline_buf_type, tmp, 0,
+		                                             0, "_overwrite_tmp_buf");
+		short_dst = builder.CreateSelect(is_inline, tmp_buf, inline_buf,
+		                                 "_overwrite_short_dst");
+	}
+
+	// The new value is written straight to where var keeps it. A buffer
+	// which only var owns is kept when var changes, either as its value or
+	// as its spare buffer, so that the next value which fits in it is
+	// written there rather than to a fresh allocation. A value built from
+	// var itself goes to the spare buffer, and the old value becomes the
+	// spare in turn.
+	// ---- C code ----
+	// if (len <= sso_capacity) {
+	//   dst = aliased && oldstr == var.inline_buf ? tmp : var.inline_buf;
+	// } else if (!aliased && oldstr != var.inline_buf && oldstr != NULL &&
+	//            header(oldstr)->refcount == 1 &&
+	//            header(oldstr)->capacity >= len) {
+	//   header(oldstr)->hash = 0;
+	//   dst = oldstr;
+	// } else if (var.spare != NULL && header(var.spare)->capacity >= len) {
+	//   header(var.spare)->hash = 0;
+	//   dst = var.spare;
+	//   var.spare = NULL;
+	// } else {
+	//   dst = alloc(len);
+	// }
+	// (copy expr to dst)
+	// dst[len] = 0;
+	// if (dst == tmp) dst = memcpy(var.inline_buf, tmp, len + 1);
+	// if (dst != oldstr && oldstr != var.inline_buf)
+	//   retire(&var.spare, oldstr);
+	auto *entry = builder.GetInsertBlock();
+	auto *current_func = entry->getParent();
+	auto *check_spare =
+	    llvm::BasicBlock::Create(ctx, "_overwrite_check_spare", current_func);
+	auto *check_spare_cap = llvm::BasicBlock::Create(
+	    ctx, "_overwrite_check_spare_cap", current_func);
+	auto *take_spare =
+	    llvm::BasicBlock::Create(ctx, "_overwrite_take_spare", current_func);
+	auto *alloc =
+	    llvm::BasicBlock::Create(ctx, "_overwrite_alloc", current_func);
+	auto *copy = llvm::BasicBlock::Create(ctx, "_overwrite_copy", current_func);
+	auto *fits = builder.CreateICmpULE(len, builder.getInt64(sso_capacity),
+	                                   "_overwrite_fits");
+	llvm::BasicBlock *reuse = nullptr;
+	if (aliased) {
+		builder.CreateCondBr(fits, copy, check_spare);
 	} else {
-		// Copy
-		if (!expr.strlen.has_value()) {
-			expr.strlen = genStrlen(expr.val);
-		}
-		auto *src = expr.val;
-		auto *strlen = *expr.strlen;
-		auto *size =
-		    builder.CreateAdd(strlen, builder.getInt32(1), "_assign_size");
-		auto *dst = llvm::CallInst::CreateMalloc(
-		    builder.GetInsertBlock(), builder.getInt32Ty(), builder.getInt8Ty(),
-		    size, nullptr, nullptr, "_assign_dst");
-		builder.Insert(dst);
-		builder.CreateMemCpy(dst, llvm::Align(), src, llvm::Align(), size);
-		newval = dst;
-	}
-	builder.CreateStore(newval, var_ptr);
-
-	if (debug_mode) {
-		auto *printf_template = builder.CreateGlobalStringPtr(
-		    node.variable + " := %s\n",
-		    "_debug_assign_template_" + node.variable);
-		auto printfFunc = module->getOrInsertFunction(
-		    "printf", llvm::FunctionType::get(builder.getInt32Ty(),
-		                                      builder.getInt8PtrTy(), true));
-		builder.CreateCall(printfFunc, {printf_template, newval});
+		auto *check_heap = llvm::BasicBlock::Create(
+		    ctx, "_overwrite_check_heap", current_func);
+		auto *check_unique = llvm::BasicBlock::Create(
+		    ctx, "_overwrite_check_unique", current_func);
+		reuse =
+		    llvm::BasicBlock::Create(ctx, "_overwrite_reuse", current_func);
+		builder.CreateCondBr(fits, copy, check_heap);
+
+		builder.SetInsertPoint(check_heap);
+		auto *on_heap = builder.CreateAnd(builder.CreateNot(is_inline),
+		                                  builder.CreateIsNotNull(oldstr),
+		                                  "_overwrite_on_heap");
+		builder.CreateCondBr(on_heap, check_unique, check_spare);
+
+		builder.SetInsertPoint(check_unique);
+		auto *refcount = genStrRefcount(oldstr, "_overwrite_refcount");
+		auto *capacity = builder.CreateLoad(builder.getInt64Ty(),
+		                                    genStrHeaderField(oldstr, 1),
+		                                    "_overwrite_capacity");
+		auto *unique = builder.CreateICmpEQ(refcount, builder.getInt64(1),
+		                                    "_overwrite_unique");
+		auto *enough =
+		    builder.CreateICmpUGE(capacity, len, "_overwrite_enough");
+		builder.CreateCondBr(builder.CreateAnd(unique, enough), reuse,
+		                     check_spare);
+
+		builder.SetInsertPoint(reuse);
+		if (options.hash_strings) {
+			// the cached hash goes stale
+			builder.CreateStore(builder.getInt64(0),
+			                    genStrHeaderField(oldstr, 2));
+		}
+		builder.CreateBr(copy);
+	}
+
+	builder.SetInsertPoint(check_spare);
+	auto *spare = builder.CreateLoad(builder.getInt8PtrTy(), spare_ptr,
+	                                 "_overwrite_spare");
+	builder.CreateCondBr(builder.CreateIsNull(spare), alloc, check_spare_cap);
+
+	builder.SetInsertPoint(check_spare_cap);
+	auto *spare_capacity =
+	    builder.CreateLoad(builder.getInt64Ty(), genStrHeaderField(spare, 1),
+	                       "_overwrite_spare_capacity");
+	builder.CreateCondBr(
+	    builder.CreateICmpUGE(spare_capacity, len, "_overwrite_spare_enough"),
+	    take_spare, alloc);
+
+	builder.SetInsertPoint(take_spare);
+	if (options.hash_strings) {
+		builder.CreateStore(builder.getInt64(0), genStrHeaderField(spare, 2));
+	}
+	builder.CreateStore(llvm::ConstantPointerNull::get(builder.getInt8PtrTy()),
+	                    spare_ptr);
+	builder.CreateBr(copy);
+
+	builder.SetInsertPoint(alloc);
+	auto *newbuf = genStrAlloc(len);
+	auto *alloc_end = builder.GetInsertBlock();
+	builder.CreateBr(copy);
+
+	builder.SetInsertPoint(copy);
+	auto *dst = builder.CreatePHI(builder.getInt8PtrTy(), 4, "_overwrite_dst");
+	dst->addIncoming(short_dst, entry);
+	if (reuse != nullptr) {
+		dst->addIncoming(oldstr, reuse);
 	}
+	dst->addIncoming(spare, take_spare);
+	dst->addIncoming(newbuf, alloc_end);
+	genExpressionInto(*node.expression, dst, builder.getInt64(0));
+	auto *lastaddr = builder.CreateInBoundsGEP(builder.getInt8Ty(), dst, len,
+	                                           "_overwrite_lastaddr");
+	builder.CreateStore(builder.getInt8(0), lastaddr);
+	llvm::Value *newval = dst;
+	if (aliased) {
+		auto *copy_end = builder.GetInsertBlock();
+		auto *from_tmp =
+		    llvm::BasicBlock::Create(ctx, "_overwrite_from_tmp", current_func);
+		auto *store =
+		    llvm::BasicBlock::Create(ctx, "_overwrite_store", current_func);
+		builder.CreateCondBr(builder.CreateICmpEQ(dst, tmp_buf), from_tmp,
+		                     store);
+
+		builder.SetInsertPoint(from_tmp);
+		builder.CreateMemCpy(inline_buf, llvm::Align(), tmp_buf,
+		                     llvm::Align(),
+		                     builder.CreateAdd(len, builder.getInt64(1)));
+		builder.CreateBr(store);
+
+		builder.SetInsertPoint(store);
+		auto *phi =
+		    builder.CreatePHI(builder.getInt8PtrTy(), 2, "_overwrite_newval");
+		phi->addIncoming(dst, copy_end);
+		phi->addIncoming(inline_buf, from_tmp);
+		newval = phi;
+	}
+	builder.CreateStore(newval, str_ptr);
+	builder.CreateStore(len, len_ptr);
+
+	auto *retire_old =
+	    llvm::BasicBlock::Create(ctx, "_overwrite_retire_old", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_overwrite_cont", current_func);
+	auto *moved = builder.CreateICmpNE(newval, oldstr, "_overwrite_moved");
+	auto *need_retire = builder.CreateAnd(moved, builder.CreateNot(is_inline),
+	                                      "_overwrite_need_retire");
+	builder.CreateCondBr(need_retire, retire_old, cont);
+
+	builder.SetInsertPoint(retire_old);
+	builder.CreateCall(runtime.stringRetire(), {spare_ptr, oldstr});
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
+}
+
+void LLVMCodeGen::genAppendAssign(const AssignStatementNode &node,
+                                  llvm::Value *var_ptr) {
+	auto &items = node.expression->items;
+	llvm::Value *addlen = builder.getInt64(0);
+	for (size_t i = 1; i < items.size(); i++) {
+		addlen = genLengthAdd(addlen, genItemLength(*items[i]),
+		                      "_append_addlen");
+	}
+	auto *str_ptr = builder.CreateStructGEP(string_type, var_ptr, 0);
+	auto *len_ptr = builder.CreateStructGEP(string_type, var_ptr, 1);
+	auto *inline_buf = genVariableInlineBuffer(var_ptr);
+	auto *oldstr =
+	    builder.CreateLoad(builder.getInt8PtrTy(), str_ptr, "_append_oldstr");
+	auto *oldlen =
+	    builder.CreateLoad(builder.getInt64Ty(), len_ptr, "_append_oldlen");
+	auto *newlen = genLengthAdd(oldlen, addlen, "_append_newlen");
+
+	// The string is appended in place when var exclusively owns a buffer
+	// which is large enough, and the buffer is grown when it is too small.
+	// Otherwise it is copied into a new buffer. Buffers get room to grow,
+	// so that repeated appends take amortized linear time.
+	// ---- C code ----
+	// size_t cap = max(newlen, min(oldlen * 2, max_string_length));
+	// bool grown = false;
+	// if (oldstr == var.inline_buf && newlen <= sso_capacity) {
+	//   dst = oldstr;
+	// } else if (oldstr != var.inline_buf && oldstr != NULL &&
+	//            header(oldstr)->refcount == 1) {
+	//   if (header(oldstr)->capacity >= newlen) {
+	//     header(oldstr)->hash = 0;
+	//     dst = oldstr;
+	//   } else if (!aliased) {
+	//     dst = _string_grow(oldstr, oldlen, cap);
+	//     grown = true;
+	//   } else {
+	//     (relocate as below, the items still read oldstr)
+	//   }
+	// } else if (newlen <= sso_capacity) {
+	//   dst = memmove(var.inline_buf, oldstr, oldlen);
+	// } else {
+	//   dst = alloc(cap);
+	//   memcpy(dst, oldstr, oldlen);
+	// }
+	// (copy items to dst + oldlen)
+	// dst[newlen] = 0;
+	// if (dst != oldstr && oldstr != var.inline_buf && !grown) {
+	//   release(oldstr);
+	// }
+	auto *current_func = builder.GetInsertBlock()->getParent();
+	auto *check_inline =
+	    llvm::BasicBlock::Create(ctx, "_append_check_inline", current_func);
+	auto *check_heap =
+	    llvm::BasicBlock::Create(ctx, "_append_check_heap", current_func);
+	auto *check_unique =
+	    llvm::BasicBlock::Create(ctx, "_append_check_unique", current_func);
+	auto *check_capacity =
+	    llvm::BasicBlock::Create(ctx, "_append_check_capacity", current_func);
+	auto *in_place =
+	    llvm::BasicBlock::Create(ctx, "_append_in_place", current_func);
+	// the items read oldstr, which _string_grow() would free
+	bool aliased = false;
+	for (size_t i = 1; i < items.size(); i++) {
+		aliased |= readsVariable(*items[i], node.variable);
+	}
+	auto *extend =
+	    aliased ? nullptr
+	            : llvm::BasicBlock::Create(ctx, "_append_extend", current_func);
+	auto *relocate =
+	    llvm::BasicBlock::Create(ctx, "_append_relocate", current_func);
+	auto *to_inline =
+	    llvm::BasicBlock::Create(ctx, "_append_to_inline", current_func);
+	auto *grow = llvm::BasicBlock::Create(ctx, "_append_grow", current_func);
+	auto *copy = llvm::BasicBlock::Create(ctx, "_append_copy", current_func);
+	auto *is_inline =
+	    builder.CreateICmpEQ(oldstr, inline_buf, "_append_is_inline");
+	auto *fits = builder.CreateICmpULE(newlen, builder.getInt64(sso_capacity),
+	                                   "_append_fits");
+	auto *doubled = builder.CreateBinaryIntrinsic(
+	    llvm::Intrinsic::umin,
+	    builder.CreateMul(oldlen, builder.getInt64(2)),
+	    builder.getInt64(max_string_length), nullptr, "_append_doubled");
+	auto *cap = builder.CreateSelect(
+	    builder.CreateICmpUGT(newlen, doubled), newlen, doubled, "_append_cap");
+	builder.CreateCondBr(is_inline, check_inline, check_heap);
+
+	builder.SetInsertPoint(check_inline);
+	builder.CreateCondBr(fits, copy, relocate);
+
+	builder.SetInsertPoint(check_heap);
+	builder.CreateCondBr(builder.CreateIsNull(oldstr), relocate, check_unique);
+
+	builder.SetInsertPoint(check_unique);
+	auto *refcount = genStrRefcount(oldstr, "_append_refcount");
+	auto *capacity = builder.CreateLoad(
+	    builder.getInt64Ty(), genStrHeaderField(oldstr, 1), "_append_capacity");
+	auto *unique = builder.CreateICmpEQ(refcount, builder.getInt64(1),
+	                                    "_append_unique");
+	builder.CreateCondBr(unique, check_capacity, relocate);
+
+	builder.SetInsertPoint(check_capacity);
+	auto *enough =
+	    builder.CreateICmpUGE(capacity, newlen, "_append_enough");
+	builder.CreateCondBr(enough, in_place, extend ? extend : relocate);
+
+	builder.SetInsertPoint(in_place);
+	if (options.hash_strings) {
+		// the cached hash goes stale
+		builder.CreateStore(builder.getInt64(0), genStrHeaderField(oldstr, 2));
+	}
+	builder.CreateBr(copy);
+
+	llvm::Value *extended = nullptr;
+	if (extend != nullptr) {
+		builder.SetInsertPoint(extend);
+		extended = builder.CreateCall(runtime.stringGrow(),
+		                              {oldstr, oldlen, cap},
+		                              "_append_extended");
+		builder.CreateBr(copy);
+	}
+
+	builder.SetInsertPoint(relocate);
+	builder.CreateCondBr(fits, to_inline, grow);
+
+	builder.SetInsertPoint(to_inline);
+	builder.CreateMemMove(inline_buf, llvm::Align(), oldstr, llvm::Align(),
+	                      oldlen);
+	builder.CreateBr(copy);
+
+	builder.SetInsertPoint(grow);
+	auto *newbuf = genStrAlloc(cap);
+	genStrCopy(newbuf, builder.getInt64(0), oldstr, oldlen);
+	auto *grow_end = builder.GetInsertBlock();
+	builder.CreateBr(copy);
+
+	builder.SetInsertPoint(copy);
+	auto *dst = builder.CreatePHI(builder.getInt8PtrTy(), 5, "_append_dst");
+	dst->addIncoming(oldstr, check_inline);
+	dst->addIncoming(oldstr, in_place);
+	dst->addIncoming(inline_buf, to_inline);
+	dst->addIncoming(newbuf, grow_end);
+	auto *grown = builder.CreatePHI(builder.getInt1Ty(), 5, "_append_grown");
+	grown->addIncoming(builder.getFalse(), check_inline);
+	grown->addIncoming(builder.getFalse(), in_place);
+	grown->addIncoming(builder.getFalse(), to_inline);
+	grown->addIncoming(builder.getFalse(), grow_end);
+	if (extend != nullptr) {
+		dst->addIncoming(extended, extend);
+		grown->addIncoming(builder.getTrue(), extend);
+	}
+	// The items only read var below oldlen, which is never overwritten
+	llvm::Value *offset = oldlen;
+	for (size_t i = 1; i < items.size(); i++) {
+		offset = genItemInto(*items[i], dst, offset);
+	}
+	auto *lastaddr = builder.CreateInBoundsGEP(builder.getInt8Ty(), dst,
+	                                           newlen, "_append_lastaddr");
+	builder.CreateStore(builder.getInt8(0), lastaddr);
+	builder.CreateStore(dst, str_ptr);
+	builder.CreateStore(newlen, len_ptr);
+
+	auto *release_old =
+	    llvm::BasicBlock::Create(ctx, "_append_release_old", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_append_cont", current_func);
+	auto *moved = builder.CreateICmpNE(dst, oldstr, "_append_moved");
+	auto *need_release = builder.CreateAnd(
+	    builder.CreateAnd(moved, builder.CreateNot(is_inline)),
+	    builder.CreateNot(grown), "_append_need_release");
+	builder.CreateCondBr(need_release, release_old, cont);
+
+	builder.SetInsertPoint(release_old);
+	builder.CreateCall(runtime.stringRelease(), {oldstr});
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
 }
 
 void LLVMCodeGen::visitIfStatement(const IfStatementNode &node) {
@@ -651,6 +1803,7 @@ void LLVMCodeGen::visitIfStatement(const IfStatementNode &node) {
 	auto *false_block = llvm::BasicBlock::Create(ctx, "if_false", current_func);
 	auto *cont_block = llvm::BasicBlock::Create(ctx, "if_cont", current_func);
 	auto *cond = visitCondition(*node.condition);
+	genArenaReset();
 	builder.CreateCondBr(cond, true_block, false_block);
 
 	builder.SetInsertPoint(true_block);
@@ -676,11 +1829,197 @@ void LLVMCodeGen::visitDoWhileStatement(const DoWhileStatementNode &node) {
 	builder.SetInsertPoint(loop_block);
 	visitStatements(*node.loop_action);
 	auto *cond = visitCondition(*node.condition);
+	genArenaReset();
 	builder.CreateCondBr(cond, loop_block, cont_block);
 
 	builder.SetInsertPoint(cont_block);
 }
 
+void LLVMCodeGen::visitReleaseStatement(const ReleaseStatementNode &node) {
+	auto var_it = variables.find(node.variable);
+	if (var_it == variables.end()) {
+		throw CompileException(node.position_begin,
+		                       "Undefined variable: " + node.variable);
+	}
+	// ---- C code ----
+	// release(var);
+	// var = {NULL, 0, .spare = NULL};
+	auto *var_ptr = var_it->second;
+	genVariableFree(var_ptr, node.variable);
+	builder.CreateStore(llvm::ConstantPointerNull::get(builder.getInt8PtrTy()),
+	                    builder.CreateStructGEP(string_type, var_ptr, 0));
+	builder.CreateStore(builder.getInt64(0),
+	                    builder.CreateStructGEP(string_type, var_ptr, 1));
+	builder.CreateStore(llvm::ConstantPointerNull::get(builder.getInt8PtrTy()),
+	                    genVariableSpare(var_ptr));
+}
+
+// The items [first, end) of the expression which an assignment copies,
+// none if it shares or copies a single value, which is cheap or short
+static size_t firstCopiedItem(const AssignStatementNode &node) {
+	if (isSelfAppend(node)) {
+		return 1;
+	} else if (isOverwrite(node)) {
+		return 0;
+	} else {
+		return node.expression->items.size();
+	}
+}
+
+llvm::Function *
+LLVMCodeGen::genStatementFunction(const AssignStatementNode &node,
+                                  const std::vector<std::string> &context) {
+	// ---- C code ----
+	// void _statement(void *arg) {
+	//   struct string **context = arg;
+	//   var = expr; // with the variables in context
+	// }
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *context_type = llvm::ArrayType::get(string_type->getPointerTo(),
+	                                          context.size());
+	auto *func = llvm::Function::Create(
+	    llvm::FunctionType::get(builder.getVoidTy(), {ptr_type}, false),
+	    llvm::Function::InternalLinkage, "_statement_" + node.variable,
+	    *module);
+	builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", func));
+	auto *context_ptr = builder.CreatePointerCast(
+	    func->getArg(0), context_type->getPointerTo(), "context");
+	auto outer_variables = variables;
+	for (size_t idx = 0; idx < context.size(); idx++) {
+		llvm::Value *var_ptr = builder.CreateLoad(
+		    string_type->getPointerTo(),
+		    builder.CreateConstInBoundsGEP2_64(context_type, context_ptr, 0,
+		                                       idx),
+		    context[idx] + "_ptr");
+		if (int_variables.contains(context[idx])) {
+			var_ptr = builder.CreatePointerCast(
+			    var_ptr, builder.getInt64Ty()->getPointerTo());
+		}
+		variables[context[idx]] = var_ptr;
+	}
+	genAssignStatement(node);
+	builder.CreateRetVoid();
+	variables = std::move(outer_variables);
+	return func;
+}
+
+void LLVMCodeGen::genParallelRun(
+    const std::vector<const AssignStatementNode *> &run) {
+	// The assignments of the run don't depend on each other. Each one is
+	// moved into a function of its own, and they run on the worker threads
+	// if at least two copy enough to be worth it. The debug output follows
+	// in statement order. They run in order as usual if any of them fails
+	// for a string which is too long, so that the output up to the runtime
+	// error stays the same.
+	// ---- C code ----
+	// struct string *context[] = {&var, ...}; // of the whole run
+	// size_t total_0 = len(expr_0), copied_0 = len(copied items), ...;
+	// if (total_0 <= max_string_length && ... &&
+	//     (copied_0 >= min_copy) + ... >= 2) {
+	//   struct job jobs[] = {{_statement_0, context}, ...};
+	//   _run_jobs(jobs, n);
+	//   print("var_0 := ", var_0); ... // only in debug mode
+	// } else {
+	//   _statement_0(context);
+	//   print("var_0 := ", var_0); ... // only in debug mode
+	// }
+	std::set<std::string> names;
+	for (auto *assign : run) {
+		names.insert(assign->variable);
+		collectReads(*assign->expression, names);
+	}
+	std::vector<std::string> context(names.begin(), names.end());
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *context_type = llvm::ArrayType::get(string_type->getPointerTo(),
+	                                          context.size());
+	auto *context_ptr = genEntryAlloca(context_type, "_parallel_context");
+	for (size_t idx = 0; idx < context.size(); idx++) {
+		auto *var_ptr = variables.at(context[idx]);
+		if (int_variables.contains(context[idx])) {
+			// The run only reads ints, from a copy, so that the slot of
+			// the variable stays in a register
+			auto *copy = genEntryAlloca(builder.getInt64Ty(),
+			                            "_parallel_" + context[idx]);
+			builder.CreateStore(
+			    builder.CreateLoad(builder.getInt64Ty(), var_ptr), copy);
+			var_ptr =
+			    builder.CreatePointerCast(copy, string_type->getPointerTo());
+		}
+		builder.CreateStore(var_ptr, builder.CreateConstInBoundsGEP2_64(
+		                                 context_type, context_ptr, 0, idx));
+	}
+	auto *context_arg = builder.CreatePointerCast(context_ptr, ptr_type);
+
+	llvm::Value *fits = builder.getTrue();
+	llvm::Value *large = builder.getInt64(0);
+	std::vector<llvm::Function *> functions;
+	for (auto *assign : run) {
+		auto &items = assign->expression->items;
+		auto first_copied = firstCopiedItem(*assign);
+		llvm::Value *total = nullptr;
+		llvm::Value *copied = builder.getInt64(0);
+		for (size_t idx = 0; idx < items.size(); idx++) {
+			auto *len = genItemLength(*items[idx], false);
+			total = total == nullptr
+			            ? len
+			            : genLengthAdd(total, len, "_parallel_total", false);
+			if (idx >= first_copied) {
+				copied = genLengthAdd(copied, len, "_parallel_copied", false);
+			}
+		}
+		fits = builder.CreateAnd(
+		    fits, builder.CreateICmpULE(total,
+		                                builder.getInt64(max_string_length)));
+		auto *copies_enough = builder.CreateICmpUGE(
+		    copied, builder.getInt64(parallel_statement_min_copy));
+		large = builder.CreateAdd(
+		    large, builder.CreateZExt(copies_enough, builder.getInt64Ty()));
+		functions.push_back(genStatementFunction(*assign, context));
+	}
+
+	auto *current_func = builder.GetInsertBlock()->getParent();
+	auto *parallel =
+	    llvm::BasicBlock::Create(ctx, "_parallel_run", current_func);
+	auto *sequential =
+	    llvm::BasicBlock::Create(ctx, "_parallel_sequential", current_func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "_parallel_cont", current_func);
+	builder.CreateCondBr(
+	    builder.CreateAnd(
+	        fits, builder.CreateICmpUGE(large, builder.getInt64(2)),
+	        "_parallel_worth"),
+	    parallel, sequential);
+
+	builder.SetInsertPoint(parallel);
+	auto *job_type = runtime.jobType();
+	auto *jobs_type = llvm::ArrayType::get(job_type, run.size());
+	auto *jobs = genEntryAlloca(jobs_type, "_parallel_jobs");
+	for (size_t idx = 0; idx < run.size(); idx++) {
+		auto *job = builder.CreateConstInBoundsGEP2_64(jobs_type, jobs, 0, idx);
+		builder.CreateStore(functions[idx],
+		                    builder.CreateStructGEP(job_type, job, 0));
+		builder.CreateStore(context_arg,
+		                    builder.CreateStructGEP(job_type, job, 1));
+	}
+	builder.CreateCall(
+	    runtime.runJobs(),
+	    {builder.CreateConstInBoundsGEP2_64(jobs_type, jobs, 0, 0),
+	     builder.getInt64(run.size())});
+	for (auto *assign : run) {
+		genDebugAssign(*assign);
+	}
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(sequential);
+	for (size_t idx = 0; idx < run.size(); idx++) {
+		builder.CreateCall(functions[idx], {context_arg});
+		genDebugAssign(*run[idx]);
+	}
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
+}
+
 void LLVMCodeGen::visitStatement(const StatementNode &node) {
 	if (typeid(node) == typeid(AssignStatementNode)) {
 		visitAssignStatement(dynamic_cast<const AssignStatementNode &>(node));
@@ -688,14 +2027,46 @@ void LLVMCodeGen::visitStatement(const StatementNode &node) {
 		visitIfStatement(dynamic_cast<const IfStatementNode &>(node));
 	} else if (typeid(node) == typeid(DoWhileStatementNode)) {
 		visitDoWhileStatement(dynamic_cast<const DoWhileStatementNode &>(node));
+	} else if (typeid(node) == typeid(ReleaseStatementNode)) {
+		visitReleaseStatement(dynamic_cast<const ReleaseStatementNode &>(node));
 	} else {
 		throw std::runtime_error("Unknown statement");
 	}
 }
 
 void LLVMCodeGen::visitStatements(const StatementsNode &node) {
-	for (auto &statement : node.statements) {
-		visitStatement(*statement);
+	if (!options.parallelStatements()) {
+		for (auto &statement : node.statements) {
+			visitStatement(*statement);
+		}
+		return;
+	}
+	for (auto [begin, end] : independentRuns(node, int_variables)) {
+		// only runs where two assignments may copy a lot are worth it
+		std::vector<const AssignStatementNode *> run;
+		size_t large = 0;
+		for (size_t idx = begin; idx < end && end - begin > 1; idx++) {
+			auto &assign = dynamic_cast<const AssignStatementNode &>(
+			    *node.statements[idx]);
+			run.push_back(&assign);
+			auto &items = assign.expression->items;
+			LengthInterval copied;
+			for (size_t item = firstCopiedItem(assign); item < items.size();
+			     item++) {
+				copied = copied + lengths->lengthOf(*items[item])
+				                      .value_or(LengthInterval{});
+			}
+			if (copied.hi >= parallel_statement_min_copy) {
+				large++;
+			}
+		}
+		if (large >= 2) {
+			genParallelRun(run);
+			continue;
+		}
+		for (size_t idx = begin; idx < end; idx++) {
+			visitStatement(*node.statements[idx]);
+		}
 	}
 }
 
@@ -705,63 +2076,174 @@ void LLVMCodeGen::visitProgram(const ProgramNode &node) {
 	    llvm::Function::ExternalLinkage, "main", *module);
 	llvm::BasicBlock *entry = llvm::BasicBlock::Create(ctx, "entry", mainFunc);
 	builder.SetInsertPoint(entry);
+	if (options.optimize) {
+		lengths.emplace(node);
+	}
 	visitVariableDeclaration(*node.variables);
+	visitVariableDeclaration(*node.int_variables);
+	genTraceOpen();
 	visitStatements(*node.statements);
 	genPrintVariables();
 	for (auto &[name, var_ptr] : variables) {
-		auto *var = builder.CreateLoad(builder.getInt8PtrTy(), var_ptr,
-		                               "_free_" + name);
-		genStrFree(var);
+		if (!int_variables.contains(name)) {
+			genVariableFree(var_ptr, name);
+		}
+	}
+	builder.CreateCall(runtime.shutdown());
+	if (options.stats) {
+		builder.CreateCall(runtime.printStats());
 	}
 	builder.CreateRet(builder.getInt32(0));
 
-	verify(mainFunc, node.position_begin);
+	for (auto &func : *module) {
+		if (!func.isDeclaration()) {
+			verify(&func, node.position_begin);
+		}
+	}
 }
 
-LLVMCodeGen::LLVMCodeGen(llvm::LLVMContext &ctx) : ctx(ctx), builder(ctx) {
-	module = std::make_unique<llvm::Module>("program", ctx);
+LLVMCodeGen::LLVMCodeGen(llvm::LLVMContext &ctx,
+                         const CodeGenOptions &options)
+    : options(options), ctx(ctx),
+      module(std::make_unique<llvm::Module>("program", ctx)), builder(ctx),
+      runtime(*module, options) {
+	// struct string {
+	//   char *str; // nullptr, inline_buf, or a heap string
+	//   int64_t len;
+	//   char inline_buf[sso_capacity + 1];
+	//   char *spare; // nullptr, or a heap string only this variable owns
+	// };
+	inline_buf_type =
+	    llvm::ArrayType::get(builder.getInt8Ty(), sso_capacity + 1);
+	string_type = llvm::StructType::create(
+	    ctx,
+	    {builder.getInt8PtrTy(), builder.getInt64Ty(), inline_buf_type,
+	     builder.getInt8PtrTy()},
+	    "string");
 }
 
-std::unique_ptr<llvm::Module> LLVMCodeGen::fromAST(llvm::LLVMContext &ctx,
-                                                   const ProgramNode &node,
-                                                   bool debug_mode) {
-	LLVMCodeGen codegen(ctx);
-	codegen.debug_mode = debug_mode;
+std::unique_ptr<llvm::Module>
+LLVMCodeGen::fromAST(llvm::LLVMContext &ctx, const ProgramNode &node,
+                     const CodeGenOptions &options) {
+	LLVMCodeGen codegen(ctx, options);
 	codegen.visitProgram(node);
 	return std::move(codegen.module);
 }
 
+std::pair<llvm::Value *, llvm::Value *>
+LLVMCodeGen::genVariableText(const std::string &name) {
+	auto *var_ptr = variables.at(name);
+	if (int_variables.contains(name)) {
+		// ---- C code ----
+		// char buf[20];
+		// size_t len = _format_int(buf, var);
+		auto *buf_type = llvm::ArrayType::get(builder.getInt8Ty(), 20);
+		auto *buf = builder.CreateConstInBoundsGEP2_32(
+		    buf_type, genEntryAlloca(buf_type, "_text_buf"), 0, 0);
+		auto *value = builder.CreateLoad(builder.getInt64Ty(), var_ptr,
+		                                 "_text_value");
+		auto *len =
+		    builder.CreateCall(runtime.formatInt(), {buf, value}, "_text_len");
+		return {buf, len};
+	}
+	auto *str_ptr = builder.CreateStructGEP(string_type, var_ptr, 0);
+	auto *str =
+	    builder.CreateLoad(builder.getInt8PtrTy(), str_ptr, "_text_str");
+	auto *len_ptr = builder.CreateStructGEP(string_type, var_ptr, 1);
+	auto *len = builder.CreateLoad(builder.getInt64Ty(), len_ptr, "_text_len");
+	return {str, len};
+}
+
+void LLVMCodeGen::genPrint(const std::string &prefix,
+                           const std::string &name) {
+	// ---- C code ----
+	// _out_write(prefix, strlen(prefix));
+	// _out_write(var.str, var.len);
+	// _out_write("\n", 1);
+	auto [str, len] = genVariableText(name);
+	auto write_func = runtime.outWrite();
+	auto *prefix_str = builder.CreateGlobalStringPtr(prefix, "_print_prefix");
+	builder.CreateCall(write_func,
+	                   {prefix_str, builder.getInt64(prefix.size())});
+	builder.CreateCall(write_func, {str, len});
+	auto *newline = builder.CreateGlobalStringPtr("\n", "_print_newline");
+	builder.CreateCall(write_func, {newline, builder.getInt64(1)});
+}
+
 void LLVMCodeGen::genPrintVariables() {
+	// ---- C code ----
+	// _out_open(options.dump_file); // only with a dump file
+	// for (each variable var) {
+	//   if (var.str == NULL) _out_write("var = <null>\n", ...);
+	//   else print("var = ", var);
+	// }
+	// (an int is always printed)
+	// _out_close(); // only with a dump file
+	if (!options.dump_file.empty()) {
+		auto *path =
+		    builder.CreateGlobalStringPtr(options.dump_file, "_dump_file");
+		builder.CreateCall(runtime.outOpen(), {path});
+	}
 	for (auto &[name, var_ptr] : variables) {
-		auto *entry = builder.GetInsertBlock();
-		auto *current_func = entry->getParent();
+		if (temporaries.contains(name)) {
+			continue;
+		}
+		if (int_variables.contains(name)) {
+			genPrint(name + " = ", name);
+			continue;
+		}
+		auto *current_func = builder.GetInsertBlock()->getParent();
 		auto *onnull = llvm::BasicBlock::Create(ctx, "_display_onnull_" + name,
 		                                        current_func);
+		auto *print = llvm::BasicBlock::Create(ctx, "_display_print_" + name,
+		                                       current_func);
 		auto *cont = llvm::BasicBlock::Create(ctx, "_display_cont_" + name,
 		                                      current_func);
-		auto *var = builder.CreateLoad(builder.getInt8PtrTy(), var_ptr,
+		auto *str_ptr = builder.CreateStructGEP(string_type, var_ptr, 0);
+		auto *var = builder.CreateLoad(builder.getInt8PtrTy(), str_ptr,
 		                               "_display_var_" + name);
 		auto *isnull = builder.CreateIsNull(var, "_display_isnull_" + name);
-		builder.CreateCondBr(isnull, onnull, cont);
+		builder.CreateCondBr(isnull, onnull, print);
 
 		builder.SetInsertPoint(onnull);
-		auto *nullalt =
-		    builder.CreateGlobalStringPtr("<null>", "_display_nullalt");
+		auto null_line = name + " = <null>\n";
+		auto *null_str =
+		    builder.CreateGlobalStringPtr(null_line, "_display_null_line");
+		builder.CreateCall(runtime.outWrite(),
+		                   {null_str, builder.getInt64(null_line.size())});
+		builder.CreateBr(cont);
+
+		builder.SetInsertPoint(print);
+		genPrint(name + " = ", name);
 		builder.CreateBr(cont);
 
 		builder.SetInsertPoint(cont);
-		auto *msg = builder.CreatePHI(builder.getInt8PtrTy(), 2,
-		                              "_display_msg_" + name);
-		msg->addIncoming(var, entry);
-		msg->addIncoming(nullalt, onnull);
-
-		auto *printf_template = builder.CreateGlobalStringPtr(
-		    name + " = %s\n", "_display_template_" + name);
-		auto printfFunc = module->getOrInsertFunction(
-		    "printf", llvm::FunctionType::get(builder.getInt32Ty(),
-		                                      builder.getInt8PtrTy(), true));
-		builder.CreateCall(printfFunc, {printf_template, msg});
 	}
+	if (!options.dump_file.empty()) {
+		builder.CreateCall(runtime.outClose());
+	}
+}
+
+void LLVMCodeGen::genTraceOpen() {
+	if (!options.debug_mode || options.trace_file.empty()) {
+		return;
+	}
+	// ---- C code ----
+	// _trace_open(options.trace_file, "a\0b\0...", names_size);
+	std::string names;
+	for (auto &[name, var_ptr] : variables) {
+		if (temporaries.contains(name)) {
+			continue;
+		}
+		trace_ids.emplace(name, trace_ids.size());
+		names += name;
+		names += '\0';
+	}
+	auto *path =
+	    builder.CreateGlobalStringPtr(options.trace_file, "_trace_file");
+	auto *names_str = builder.CreateGlobalStringPtr(names, "_trace_names");
+	builder.CreateCall(runtime.traceOpen(),
+	                   {path, names_str, builder.getInt64(names.size())});
 }
 
 void LLVMCodeGen::verify(llvm::Function *function, int position) {
@@ -1,52 +1,144 @@
 #pragma once
 
+#include "analysis.hpp"
 #include "ast.hpp"
+#include "codegen_options.hpp"
+#include "runtime.hpp"
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Value.h>
 #include <map>
+#include <optional>
+#include <set>
 
 namespace compiler {
 
 class LLVMCodeGen {
   public:
-	static std::unique_ptr<llvm::Module> fromAST(llvm::LLVMContext &ctx,
-	                                             const ProgramNode &node,
-	                                             bool debug_mode = false);
+	static std::unique_ptr<llvm::Module>
+	fromAST(llvm::LLVMContext &ctx, const ProgramNode &node,
+	        const CodeGenOptions &options = {});
 
   private:
-	explicit LLVMCodeGen(llvm::LLVMContext &ctx);
+	LLVMCodeGen(llvm::LLVMContext &ctx, const CodeGenOptions &options);
 
 	struct DestructibleValue {
 		llvm::Value *val;
 		bool transient;
-		std::optional<llvm::Value *> strlen;
+		llvm::Value *strlen;
+		// the inline or stack buffer of a transient, which must not be freed
+		llvm::Value *inline_buf = nullptr;
+		// allocated from the arena, released by genArenaReset()
+		bool arena = false;
 	};
 
-	bool debug_mode;
+	CodeGenOptions options;
 	llvm::LLVMContext &ctx;
 	std::unique_ptr<llvm::Module> module;
 	llvm::IRBuilder<> builder;
-	std::map<std::string, llvm::AllocaInst *> variables;
+	llvm::StructType *string_type;
+	llvm::ArrayType *inline_buf_type;
+	LLVMRuntime runtime;
+	// slots of the variables, which are allocas of main() or pointers
+	// passed to a function running statements on a worker thread
+	std::map<std::string, llvm::Value *> variables;
+	// variables introduced by the optimizer
+	std::set<std::string> temporaries;
+	// variables of type int, whose slots are i64 allocas
+	std::set<std::string> int_variables;
+	// only with options.optimize
+	std::optional<LengthAnalysis> lengths;
+	// every literal is emitted once
+	std::map<std::string, llvm::Constant *> literals;
+	// IDs of the variables in the trace of options.trace_file
+	std::map<std::string, uint32_t> trace_ids;
 
-	llvm::Value *genStrlen(llvm::Value *str_ptr);
-	llvm::Value *genStrAlloc(llvm::Value *len);
+	llvm::AllocaInst *genEntryAlloca(llvm::Type *type,
+	                                 const std::string &name);
+	llvm::Value *genStrAlloc(llvm::Value *cap);
 	void genStrFree(llvm::Value *ptr);
+	llvm::Value *genStrHeaderField(llvm::Value *ptr, int field);
+	llvm::Value *genStrRefcount(llvm::Value *ptr, const std::string &name);
+	void genStrRetain(llvm::Value *ptr);
+	llvm::Value *genStrCopy(llvm::Value *dst, llvm::Value *offset,
+	                        llvm::Value *src, llvm::Value *len);
+	DestructibleValue
+	genTransientAlloc(llvm::Value *len, bool to_variable = false,
+	                  std::optional<LengthInterval> known_len = std::nullopt);
 	void destructTransientValue(DestructibleValue &&val);
+	void genArenaReset();
+	llvm::Value *genVariableInlineBuffer(llvm::Value *var_ptr);
+	llvm::Value *genVariableSpare(llvm::Value *var_ptr);
+	void genVariableFree(llvm::Value *var_ptr, const std::string &name);
+	// the text of a variable as a pointer and a length, the decimal digits
+	// of an int
+	std::pair<llvm::Value *, llvm::Value *>
+	genVariableText(const std::string &name);
+	// writes prefix, the value of a variable and a newline to the output
+	void genPrint(const std::string &prefix, const std::string &name);
 	void genPrintVariables();
+	void genTraceOpen();
 
 	void visitVariableDeclaration(const VariableDeclarationNode &node);
+	llvm::AllocaInst *genVariableAlloca(const std::string &name);
+	DestructibleValue genLiteral(const std::string &str);
 	DestructibleValue visitStringFactor(const StringFactorNode &node);
 	DestructibleValue visitVariableFactor(const VariableFactorNode &node);
-	DestructibleValue visitExpressionFactor(const ExpressionFactorNode &node);
-	DestructibleValue visitFactor(const FactorNode &node);
-	DestructibleValue visitItem(const ItemNode &node);
-	DestructibleValue visitExpression(const ExpressionNode &node);
+	DestructibleValue visitExpressionFactor(const ExpressionFactorNode &node,
+	                                        bool to_variable = false);
+	DestructibleValue visitFactor(const FactorNode &node,
+	                              bool to_variable = false);
+	DestructibleValue visitItem(const ItemNode &node, bool to_variable = false);
+	DestructibleValue visitExpression(const ExpressionNode &node,
+	                                  bool to_variable = false);
+	// Length arithmetic, failing at runtime above max_string_length, or
+	// unless checked, saturating at max_string_length + 1
+	void genLengthCheck(llvm::Value *too_long);
+	llvm::Value *genLengthAdd(llvm::Value *a, llvm::Value *b,
+	                          const std::string &name, bool checked = true);
+	llvm::Value *genLengthMul(llvm::Value *len, uint64_t times,
+	                          const std::string &name, bool checked = true);
+	llvm::Value *genLengthMul(llvm::Value *len, llvm::Value *times,
+	                          const std::string &name, bool checked = true);
+	llvm::Value *genFactorLength(const FactorNode &node, bool checked = true);
+	llvm::Value *genItemLength(const ItemNode &node, bool checked = true);
+	llvm::Value *genExpressionLength(const ExpressionNode &node,
+	                                 bool checked = true);
+	llvm::Value *genFactorInto(const FactorNode &node, llvm::Value *dst,
+	                           llvm::Value *offset);
+	llvm::Value *genItemInto(const ItemNode &node, llvm::Value *dst,
+	                         llvm::Value *offset);
+	llvm::Value *genExpressionInto(const ExpressionNode &node,
+	                               llvm::Value *dst, llvm::Value *offset);
+	llvm::Value *genRepeatInto(const ItemNode &node, llvm::Value *times,
+	                           llvm::Value *dst, llvm::Value *offset);
+	// Int arithmetic, failing at runtime above INT64_MAX
+	void genIntCheck(llvm::Value *overflow);
+	llvm::Value *genIntLoad(const std::string &name, int position);
+	llvm::Value *genIntFactor(const FactorNode &node);
+	llvm::Value *genIntExpression(const ExpressionNode &node);
+	llvm::Value *genSegments(const std::vector<const FactorNode *> &segments);
+	llvm::Value *
+	genStreamingEqual(const ConditionNode &node,
+	                  const std::vector<const FactorNode *> &lhs,
+	                  const std::vector<const FactorNode *> &rhs);
 	llvm::Value *visitCondition(const ConditionNode &node);
 	void visitAssignStatement(const AssignStatementNode &node);
+	void genAssignStatement(const AssignStatementNode &node);
+	void genDebugAssign(const AssignStatementNode &node);
+	void genAssign(const AssignStatementNode &node, llvm::Value *var_ptr);
+	void genAppendAssign(const AssignStatementNode &node,
+	                     llvm::Value *var_ptr);
+	void genOverwriteAssign(const AssignStatementNode &node,
+	                        llvm::Value *var_ptr);
 	void visitIfStatement(const IfStatementNode &node);
 	void visitDoWhileStatement(const DoWhileStatementNode &node);
+	void visitReleaseStatement(const ReleaseStatementNode &node);
 	void visitStatement(const StatementNode &node);
+	llvm::Function *
+	genStatementFunction(const AssignStatementNode &node,
+	                     const std::vector<std::string> &context);
+	void genParallelRun(const std::vector<const AssignStatementNode *> &run);
 	void visitStatements(const StatementsNode &node);
 	void visitProgram(const ProgramNode &node);
 
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace compiler {
+
+struct CodeGenOptions {
+	bool debug_mode = false;
+	bool stats = false;
+	bool arena = false;
+	bool hash_strings = false;
+	// use compile-time analyses of the program
+	bool optimize = false;
+	// worker threads of the compiled program, 0 for one per CPU,
+	// overridden by the WORKER_THREADS environment variable
+	uint64_t threads = 0;
+	// the variables are printed at exit into this file instead of stdout
+	std::string dump_file;
+	// with debug_mode, the assignments are recorded into this binary trace
+	// file instead of printed
+	std::string trace_file;
+
+	// Independent statements may run on the worker threads, which makes
+	// reference counting atomic. The arena is not shared between threads.
+	bool parallelStatements() const {
+		return optimize && !arena;
+	}
+};
+
+} // namespace compiler
@@ -0,0 +1,407 @@
+#include "evaluator.hpp"
+#include "analysis.hpp"
+#include <set>
+#include <stdexcept>
+
+namespace compiler {
+
+namespace {
+
+// Thrown to stop the evaluation, before the current top-level statement
+struct EvaluationStopped {
+	std::string reason;
+};
+
+} // namespace
+
+// Whether every variable the statements use is declared, so that the
+// evaluation doesn't remove code LLVMCodeGen would reject
+static bool usesDeclared(const ExpressionNode &node,
+                         const std::set<std::string> &declared);
+
+static bool usesDeclared(const FactorNode &node,
+                         const std::set<std::string> &declared) {
+	if (typeid(node) == typeid(VariableFactorNode)) {
+		return declared.contains(
+		    dynamic_cast<const VariableFactorNode &>(node).identifier);
+	} else if (typeid(node) == typeid(ExpressionFactorNode)) {
+		return usesDeclared(
+		    *dynamic_cast<const ExpressionFactorNode &>(node).expression,
+		    declared);
+	}
+	return true;
+}
+
+static bool usesDeclared(const ExpressionNode &node,
+                         const std::set<std::string> &declared) {
+	if (node.items.empty()) {
+		return false;
+	}
+	for (auto &item : node.items) {
+		if (!usesDeclared(*item->factor, declared)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool usesDeclared(const ConditionNode &node,
+                         const std::set<std::string> &declared) {
+	return usesDeclared(*node.lhs, declared) &&
+	       usesDeclared(*node.rhs, declared);
+}
+
+static bool usesDeclared(const StatementsNode &node,
+                         const std::set<std::string> &declared) {
+	for (auto &statement : node.statements) {
+		if (typeid(*statement) == typeid(AssignStatementNode)) {
+			auto &assign =
+			    dynamic_cast<const AssignStatementNode &>(*statement);
+			if (!declared.contains(assign.variable) ||
+			    !usesDeclared(*assign.expression, declared)) {
+				return false;
+			}
+		} else if (typeid(*statement) == typeid(IfStatementNode)) {
+			auto &if_statement =
+			    dynamic_cast<const IfStatementNode &>(*statement);
+			if (!usesDeclared(*if_statement.condition, declared) ||
+			    !usesDeclared(*if_statement.true_action, declared) ||
+			    !usesDeclared(*if_statement.false_action, declared)) {
+				return false;
+			}
+		} else if (typeid(*statement) == typeid(DoWhileStatementNode)) {
+			auto &loop = dynamic_cast<const DoWhileStatementNode &>(*statement);
+			if (!usesDeclared(*loop.condition, declared) ||
+			    !usesDeclared(*loop.loop_action, declared)) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// var = var + ...
+static bool isSelfAppend(const AssignStatementNode &node) {
+	auto &items = node.expression->items;
+	if (items.size() < 2 || !items[0]->repeat_times.empty()) {
+		return false;
+	}
+	auto *var = dynamic_cast<const VariableFactorNode *>(&*items[0]->factor);
+	return var != nullptr && var->identifier == node.variable;
+}
+
+Evaluator::Evaluator(const EvaluationBudget &budget)
+    : budget(budget),
+      deadline(std::chrono::steady_clock::now() + budget.time) {}
+
+Evaluator::Result Evaluator::evaluate(ProgramNode &program,
+                                      const EvaluationBudget &budget) {
+	Result result;
+	if (!program.int_variables->identifiers.empty()) {
+		// values are strings only
+		result.stopped_because = "the program has int variables";
+		return result;
+	}
+	auto &declaration = *program.variables;
+	std::set<std::string> declared(declaration.identifiers.begin(),
+	                               declaration.identifiers.end());
+	if (declaration.type != "string" ||
+	    declared.size() != declaration.identifiers.size() ||
+	    !usesDeclared(*program.statements, declared)) {
+		result.stopped_because = "the program has errors";
+		return result;
+	}
+
+	Evaluator evaluator(budget);
+	for (auto &name : declaration.identifiers) {
+		evaluator.values[name] = std::nullopt;
+	}
+	auto &statements = program.statements->statements;
+	for (auto &statement : statements) {
+		try {
+			evaluator.visitStatement(*statement);
+			evaluator.commit();
+		} catch (EvaluationStopped &ex) {
+			evaluator.undo();
+			result.stopped_because = ex.reason;
+			break;
+		}
+		result.evaluated_statements++;
+	}
+	if (result.evaluated_statements == 0) {
+		return result;
+	}
+
+	// a = "...";
+	// b = "...";
+	// <the statements not evaluated>
+	std::vector<std::unique_ptr<StatementNode>> residual;
+	auto position_begin = statements.front()->position_begin;
+	auto position_end =
+	    statements[result.evaluated_statements - 1]->position_end;
+	for (auto &name : declaration.identifiers) {
+		auto &value = evaluator.values[name];
+		if (!value.has_value()) {
+			continue;
+		}
+		auto factor = std::make_unique<StringFactorNode>();
+		factor->str = std::move(*value);
+		auto item = std::make_unique<ItemNode>();
+		item->factor = std::move(factor);
+		auto expression = std::make_unique<ExpressionNode>();
+		expression->items.push_back(std::move(item));
+		auto assign = std::make_unique<AssignStatementNode>();
+		assign->variable = name;
+		assign->expression = std::move(expression);
+		for (ASTNode *node :
+		     std::initializer_list<ASTNode *>{
+		         &*assign, &*assign->expression,
+		         &*assign->expression->items[0],
+		         &*assign->expression->items[0]->factor}) {
+			node->position_begin = position_begin;
+			node->position_end = position_end;
+		}
+		residual.push_back(std::move(assign));
+	}
+	residual.insert(residual.end(),
+	                std::make_move_iterator(statements.begin() +
+	                                        result.evaluated_statements),
+	                std::make_move_iterator(statements.end()));
+	statements = std::move(residual);
+	return result;
+}
+
+void Evaluator::checkTime() const {
+	if (std::chrono::steady_clock::now() > deadline) {
+		throw EvaluationStopped{"out of time"};
+	}
+}
+
+void Evaluator::allocate(uint64_t size) {
+	memory_transient += size;
+	if (memory_transient > budget.memory ||
+	    memory_used > budget.memory - memory_transient) {
+		throw EvaluationStopped{"out of memory"};
+	}
+}
+
+void Evaluator::assign(const std::string &variable, std::string value) {
+	auto &slot = values.at(variable);
+	if (!saved.contains(variable)) {
+		// still held, so memory_used keeps counting it
+		saved.emplace(variable, std::move(slot));
+	} else if (slot.has_value()) {
+		memory_used -= slot->size();
+	}
+	memory_used += value.size();
+	memory_transient = 0;
+	slot = std::move(value);
+}
+
+void Evaluator::append(const std::string &variable, const std::string &tail) {
+	auto &slot = values.at(variable);
+	if (!slot.has_value()) {
+		throw EvaluationStopped{"reads an unassigned variable"};
+	}
+	if (!saved.contains(variable)) {
+		allocate(slot->size());
+		memory_used += slot->size();
+		saved.emplace(variable, slot);
+	}
+	memory_used += tail.size();
+	memory_transient = 0;
+	slot->append(tail);
+}
+
+void Evaluator::commit() {
+	for (auto &[variable, value] : saved) {
+		if (value.has_value()) {
+			memory_used -= value->size();
+		}
+	}
+	saved.clear();
+}
+
+void Evaluator::undo() {
+	for (auto &[variable, value] : saved) {
+		auto &slot = values.at(variable);
+		if (slot.has_value()) {
+			memory_used -= slot->size();
+		}
+		slot = std::move(value);
+	}
+	saved.clear();
+	memory_transient = 0;
+}
+
+std::string Evaluator::visitExpression(const ExpressionNode &node) {
+	if (node.items.size() == 1) {
+		return visitItem(*node.items[0]);
+	}
+	std::string result;
+	for (auto &item : node.items) {
+		auto str = visitItem(*item);
+		allocate(str.size());
+		result += str;
+	}
+	return result;
+}
+
+std::string Evaluator::visitItem(const ItemNode &node) {
+	auto str = visitFactor(*node.factor);
+	for (auto repeat_time : node.repeat_times) {
+		if (repeat_time < 0) {
+			throw EvaluationStopped{"negative repeat times"};
+		}
+		if (repeat_time == 1 || str.empty()) {
+			// an empty string would take times iterations to stay empty
+			continue;
+		}
+		auto times = static_cast<uint64_t>(repeat_time);
+		if (times != 0 && str.size() > budget.memory / times) {
+			throw EvaluationStopped{"out of memory"};
+		}
+		allocate(str.size() * times);
+		std::string repeated;
+		repeated.reserve(str.size() * times);
+		for (uint64_t i = 0; i < times; i++) {
+			repeated += str;
+		}
+		str = std::move(repeated);
+	}
+	return str;
+}
+
+std::string Evaluator::visitFactor(const FactorNode &node) {
+	if (typeid(node) == typeid(StringFactorNode)) {
+		auto &str = dynamic_cast<const StringFactorNode &>(node).str;
+		allocate(str.size());
+		return str;
+	} else if (typeid(node) == typeid(VariableFactorNode)) {
+		auto &value = values.at(
+		    dynamic_cast<const VariableFactorNode &>(node).identifier);
+		if (!value.has_value()) {
+			// left to the compiled program, which has its own rules for null
+			throw EvaluationStopped{"reads an unassigned variable"};
+		}
+		allocate(value->size());
+		return *value;
+	} else if (typeid(node) == typeid(ExpressionFactorNode)) {
+		return visitExpression(
+		    *dynamic_cast<const ExpressionFactorNode &>(node).expression);
+	} else {
+		throw std::runtime_error("Unknown factor");
+	}
+}
+
+uint64_t Evaluator::lengthOf(const ExpressionNode &node) {
+	uint64_t len = 0;
+	for (auto &item : node.items) {
+		len += lengthOf(*item);
+		if (len > max_string_length) {
+			throw EvaluationStopped{"string too long"};
+		}
+	}
+	return len;
+}
+
+uint64_t Evaluator::lengthOf(const ItemNode &node) {
+	uint64_t len;
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(StringFactorNode)) {
+		len = dynamic_cast<const StringFactorNode &>(factor).str.size();
+	} else if (typeid(factor) == typeid(VariableFactorNode)) {
+		auto &value = values.at(
+		    dynamic_cast<const VariableFactorNode &>(factor).identifier);
+		if (!value.has_value()) {
+			throw EvaluationStopped{"reads an unassigned variable"};
+		}
+		len = value->size();
+	} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		len = lengthOf(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression);
+	} else {
+		throw std::runtime_error("Unknown factor");
+	}
+	for (auto repeat_time : node.repeat_times) {
+		if (repeat_time < 0) {
+			throw EvaluationStopped{"negative repeat times"};
+		}
+		if (repeat_time != 0 &&
+		    len > max_string_length / static_cast<uint64_t>(repeat_time)) {
+			// an error in the compiled program
+			throw EvaluationStopped{"string too long"};
+		}
+		len *= repeat_time;
+	}
+	return len;
+}
+
+bool Evaluator::visitCondition(const ConditionNode &node) {
+	if (node.op != RelationOp::EQUAL && node.op != RelationOp::NOT_EQUAL) {
+		// only the lengths matter, so don't build the strings
+		auto lhs = lengthOf(*node.lhs);
+		auto rhs = lengthOf(*node.rhs);
+		switch (node.op) {
+		case RelationOp::LESS:
+			return lhs < rhs;
+		case RelationOp::GREATER:
+			return lhs > rhs;
+		case RelationOp::LESS_EQUAL:
+			return lhs <= rhs;
+		case RelationOp::GREATER_EQUAL:
+			return lhs >= rhs;
+		default:
+			throw std::runtime_error("Unknown op");
+		}
+	}
+	auto lhs = visitExpression(*node.lhs);
+	auto rhs = visitExpression(*node.rhs);
+	memory_transient = 0;
+	return node.op == RelationOp::EQUAL ? lhs == rhs : lhs != rhs;
+}
+
+void Evaluator::visitStatements(const StatementsNode &node) {
+	for (auto &statement : node.statements) {
+		visitStatement(*statement);
+	}
+}
+
+void Evaluator::visitStatement(const StatementNode &node) {
+	checkTime();
+	if (typeid(node) == typeid(AssignStatementNode)) {
+		auto &statement = dynamic_cast<const AssignStatementNode &>(node);
+		if (isSelfAppend(statement)) {
+			// appending in place keeps loops of appends linear
+			auto &items = statement.expression->items;
+			std::string tail;
+			for (size_t i = 1; i < items.size(); i++) {
+				auto str = visitItem(*items[i]);
+				allocate(str.size());
+				tail += str;
+			}
+			append(statement.variable, tail);
+		} else {
+			assign(statement.variable, visitExpression(*statement.expression));
+		}
+	} else if (typeid(node) == typeid(IfStatementNode)) {
+		auto &if_statement = dynamic_cast<const IfStatementNode &>(node);
+		if (visitCondition(*if_statement.condition)) {
+			visitStatements(*if_statement.true_action);
+		} else {
+			visitStatements(*if_statement.false_action);
+		}
+	} else if (typeid(node) == typeid(DoWhileStatementNode)) {
+		auto &loop = dynamic_cast<const DoWhileStatementNode &>(node);
+		do {
+			checkTime();
+			visitStatements(*loop.loop_action);
+		} while (visitCondition(*loop.condition));
+	} else {
+		throw std::runtime_error("Unknown statement");
+	}
+}
+
+} // namespace compiler
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "ast.hpp"
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+
+namespace compiler {
+
+// Limits on the work done by the Evaluator
+struct EvaluationBudget {
+	std::chrono::milliseconds time{1000};
+	// bytes of string data held at once
+	uint64_t memory = 64 << 20;
+};
+
+// Runs the program at compile time, enabled by -e/--evaluate. Programs have
+// no input, so running a statement in the compiler gives the same result as
+// running it in the compiled program. The statements run successfully are
+// replaced with assignments of the values they leave in the variables.
+//
+// Evaluation stops before the first top-level statement which exceeds the
+// budget, or which reads a variable that was never assigned. That statement
+// and the ones following it are compiled as usual. Programs with int
+// variables are not evaluated.
+class Evaluator {
+  public:
+	struct Result {
+		size_t evaluated_statements = 0;
+		// why the evaluation stopped, nullopt if the whole program ran
+		std::optional<std::string> stopped_because;
+	};
+
+	static Result evaluate(ProgramNode &program,
+	                       const EvaluationBudget &budget);
+
+  private:
+	Evaluator(const EvaluationBudget &budget);
+
+	const EvaluationBudget budget;
+	std::chrono::steady_clock::time_point deadline;
+	// nullopt until assigned
+	std::map<std::string, std::optional<std::string>> values;
+	// values before the current top-level statement assigned them, to undo
+	// it if it stops
+	std::map<std::string, std::optional<std::string>> saved;
+	// bytes held by values and saved
+	uint64_t memory_used = 0;
+	// bytes allocated by the current assignment
+	uint64_t memory_transient = 0;
+
+	void checkTime() const;
+	void allocate(uint64_t size);
+	void assign(const std::string &variable, std::string value);
+	void append(const std::string &variable, const std::string &tail);
+	void commit();
+	void undo();
+
+	std::string visitExpression(const ExpressionNode &node);
+	std::string visitItem(const ItemNode &node);
+	std::string visitFactor(const FactorNode &node);
+	uint64_t lengthOf(const ExpressionNode &node);
+	uint64_t lengthOf(const ItemNode &node);
+	bool visitCondition(const ConditionNode &node);
+	void visitStatements(const StatementsNode &node);
+	void visitStatement(const StatementNode &node);
+};
+
+} // namespace compiler
@@ -2,9 +2,12 @@
 #include "ast.hpp"
 #include "codegen.hpp"
 #include "error.hpp"
+#include "evaluator.hpp"
 #include "jit.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
 #include "tac.hpp"
+#include <cerrno>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -15,8 +18,28 @@ static bool opt_interactive = false;
 static bool opt_optimize = false;
 static bool opt_jit_run = false;
 static bool opt_debug = false;
+static bool opt_stats = false;
+static bool opt_arena = false;
+static bool opt_hash = false;
+static bool opt_evaluate = false;
+static compiler::EvaluationBudget opt_eval_budget;
+static uint64_t opt_threads = 0;
+static std::string opt_dump_file;
+static std::string opt_trace_file;
 static std::string opt_infile = "in.txt";
 
+static bool parse_number(const std::string &option, const char *arg,
+                         uint64_t &value) {
+	char *end;
+	errno = 0;
+	value = std::strtoull(arg, &end, 10);
+	if (*arg < '0' || *arg > '9' || *end != '\0' || errno != 0) {
+		std::cout << "error: " << option << " requires a number\n";
+		return false;
+	}
+	return true;
+}
+
 static bool parse_commandline(int argc, char *argv[]) {
 	int idx = 1;
 	while (idx < argc) {
@@ -42,6 +65,77 @@ static bool parse_commandline(int argc, char *argv[]) {
 			opt_debug = true;
 			idx++;
 
+		} else if (arg == "-s" || arg == "--stats") {
+			opt_stats = true;
+			idx++;
+
+		} else if (arg == "-a" || arg == "--arena") {
+			opt_arena = true;
+			idx++;
+
+		} else if (arg == "-H" || arg == "--hash") {
+			opt_hash = true;
+			idx++;
+
+		} else if (arg == "-e" || arg == "--evaluate") {
+			opt_evaluate = true;
+			idx++;
+
+		} else if (arg == "--eval-time") {
+			uint64_t ms;
+			if (idx + 1 >= argc) {
+				std::cout << "error: --eval-time requires 1 argument\n";
+				return false;
+			}
+			if (!parse_number(arg, argv[idx + 1], ms)) {
+				return false;
+			}
+			opt_eval_budget.time = std::chrono::milliseconds(ms);
+			idx += 2;
+
+		} else if (arg == "--eval-memory") {
+			uint64_t mib;
+			if (idx + 1 >= argc) {
+				std::cout << "error: --eval-memory requires 1 argument\n";
+				return false;
+			}
+			if (!parse_number(arg, argv[idx + 1], mib)) {
+				return false;
+			}
+			if (mib > (1 << 20)) {
+				std::cout << "error: --eval-memory is too large\n";
+				return false;
+			}
+			opt_eval_budget.memory = mib << 20;
+			idx += 2;
+
+		} else if (arg == "--threads") {
+			if (idx + 1 >= argc) {
+				std::cout << "error: --threads requires 1 argument\n";
+				return false;
+			}
+			if (!parse_number(arg, argv[idx + 1], opt_threads)) {
+				return false;
+			}
+			idx += 2;
+
+		} else if (arg == "--dump-file") {
+			if (idx + 1 >= argc) {
+				std::cout << "error: --dump-file requires 1 argument\n";
+				return false;
+			}
+			opt_dump_file = argv[idx + 1];
+			idx += 2;
+
+		} else if (arg == "--trace") {
+			if (idx + 1 >= argc) {
+				std::cout << "error: --trace requires 1 argument\n";
+				return false;
+			}
+			opt_debug = true;
+			opt_trace_file = argv[idx + 1];
+			idx += 2;
+
 		} else if (arg == "-f" || arg == "--infile") {
 			if (idx + 1 < argc) {
 				opt_infile = argv[idx + 1];
@@ -70,6 +164,25 @@ Options:
   -o/--optimize       turn on compilation optimization
   -j/--jit-run        run the program using JIT after compilation
   -d/--debug          compile the program in debug mode (print each assignment)
+  -s/--stats          print runtime statistics (e.g. malloc calls) to stderr
+                        when the program exits
+  -a/--arena          allocate temporaries from an arena which is reset after
+                        each statement, and variables from a size-class pool
+  -H/--hash           cache string hashes so that comparing long unequal
+                        strings with == or <> takes constant time
+  -e/--evaluate       run the program at compile time and compile only the
+                        resulting values, or the statements left when the
+                        budget runs out (ignored in debug mode)
+  --eval-time <ms>    time budget of -e/--evaluate (default: 1000)
+  --eval-memory <MiB> memory budget of -e/--evaluate (default: 64)
+  --threads <n>       worker threads of the program, which split very large
+                        copies and, with -o, run independent statements in
+                        parallel (default: 0, one per CPU), overridden by
+                        the WORKER_THREADS environment variable
+  --dump-file <path>  write the values of the variables at exit into the
+                        file instead of the standard output
+  --trace <path>      debug mode, but each assignment is recorded into a
+                        binary trace file, which trace-decode prints
 
 By default, the source program is read from "in.txt". The file path can be
 changed using the -f/--infile argument. If -i/--interactive argument is
@@ -108,9 +221,35 @@ static int run(std::istream &in) {
 
 		auto ast = parser.parse();
 		auto tac = compiler::TAC(*ast);
+		// evaluating the program would drop the trace of debug mode
+		if (opt_evaluate && !opt_debug) {
+			std::cout << "Evaluating program at compile time ... ";
+			std::cout.flush();
+			auto total = ast->statements->statements.size();
+			auto result = compiler::Evaluator::evaluate(*ast, opt_eval_budget);
+			if (result.stopped_because.has_value()) {
+				std::cout << "stopped at statement "
+				          << result.evaluated_statements + 1 << " of " << total
+				          << ": " << *result.stopped_because << "\n";
+			} else {
+				std::cout << "OK\n";
+			}
+		}
 		auto llvm_ctx = std::make_unique<llvm::LLVMContext>();
+		compiler::CodeGenOptions codegen_options;
+		codegen_options.debug_mode = opt_debug;
+		codegen_options.stats = opt_stats;
+		codegen_options.arena = opt_arena;
+		codegen_options.hash_strings = opt_hash;
+		codegen_options.optimize = opt_optimize;
+		codegen_options.threads = opt_threads;
+		codegen_options.dump_file = opt_dump_file;
+		codegen_options.trace_file = opt_trace_file;
+		if (opt_optimize) {
+			compiler::Optimizer::optimize(*ast, codegen_options);
+		}
 		auto module =
-		    compiler::LLVMCodeGen::fromAST(*llvm_ctx, *ast, opt_debug);
+		    compiler::LLVMCodeGen::fromAST(*llvm_ctx, *ast, codegen_options);
 
 		{
 			std::cout
@@ -205,7 +344,7 @@ static int run(std::istream &in) {
 		{
 			std::cout << "Invoking cc to link executable ... ";
 			std::cout.flush();
-			int ret = std::system("cc program.o -o program");
+			int ret = std::system("cc program.o -o program -pthread");
 			if (ret == 0) {
 				std::cout << "OK\n";
 			} else {
@@ -216,6 +355,7 @@ static int run(std::istream &in) {
 
 		if (opt_jit_run) {
 			std::cout << "\n---- JIT Execution ----\n";
+			std::cout.flush();
 			compiler::jit::initialize();
 			compiler::jit::invoke_module(std::move(llvm_ctx),
 			                             std::move(module));
@@ -0,0 +1,1154 @@
+#include "optimizer.hpp"
+#include <algorithm>
+
+namespace compiler {
+
+// loops running at most this many times are unrolled if they can't be
+// solved in closed form
+static constexpr uint64_t max_unrolled_trips = 8;
+// trip counts beyond this are not searched for
+static constexpr int64_t max_trip_count = INT32_MAX;
+// longer expressions are only matched item by item for reuse
+static constexpr size_t max_reuse_run = 16;
+
+Optimizer::Optimizer(ProgramNode &program, const CodeGenOptions &options)
+    : program(program), options(options) {}
+
+void Optimizer::optimize(ProgramNode &program,
+                         const CodeGenOptions &options) {
+	Optimizer optimizer(program, options);
+	auto &identifiers = program.variables->identifiers;
+	optimizer.declared.insert(identifiers.begin(), identifiers.end());
+	auto &int_identifiers = program.int_variables->identifiers;
+	optimizer.declared.insert(int_identifiers.begin(), int_identifiers.end());
+	optimizer.int_variables.insert(int_identifiers.begin(),
+	                               int_identifiers.end());
+	optimizer.simplify(*program.statements);
+	optimizer.lengths.emplace(program);
+	optimizer.solveLoops(*program.statements);
+	// solved loops repeat whole expressions
+	optimizer.simplify(*program.statements);
+	Optimizer::AvailableValues available;
+	optimizer.reuseValues(*program.statements, available);
+	// reused values leave parentheses around variables
+	optimizer.simplify(*program.statements);
+	// for the statements the passes above have built, see cannotFail()
+	optimizer.lengths.emplace(program);
+	// every variable is printed at exit
+	optimizer.eliminateDeadStores(*program.statements, optimizer.declared,
+	                              true);
+	optimizer.releaseDeadValues(*program.statements, optimizer.declared, {});
+	if (!options.debug_mode) {
+		// a hoisted expression failing at runtime would skip the prints of
+		// the assignments before it
+		optimizer.hoistLoopInvariants(*program.statements);
+	}
+}
+
+std::string Optimizer::newTemporary() {
+	// identifiers can't start with '_', so this never clashes
+	auto &temporaries = program.variables->temporaries;
+	auto name = "_t" + std::to_string(temporaries.size());
+	temporaries.push_back(name);
+	return name;
+}
+
+std::unique_ptr<AssignStatementNode> Optimizer::newTemporaryAssignment(
+    std::unique_ptr<ExpressionNode> expression) {
+	auto assign = std::make_unique<AssignStatementNode>();
+	assign->position_begin = expression->position_begin;
+	assign->position_end = expression->position_end;
+	assign->variable = newTemporary();
+	assign->expression = std::move(expression);
+	return assign;
+}
+
+static void collectAssigned(const StatementsNode &node,
+                            std::set<std::string> &assigned) {
+	for (auto &statement : node.statements) {
+		if (typeid(*statement) == typeid(AssignStatementNode)) {
+			assigned.insert(
+			    dynamic_cast<const AssignStatementNode &>(*statement).variable);
+		} else if (typeid(*statement) == typeid(IfStatementNode)) {
+			auto &if_statement =
+			    dynamic_cast<const IfStatementNode &>(*statement);
+			collectAssigned(*if_statement.true_action, assigned);
+			collectAssigned(*if_statement.false_action, assigned);
+		} else if (typeid(*statement) == typeid(DoWhileStatementNode)) {
+			collectAssigned(
+			    *dynamic_cast<const DoWhileStatementNode &>(*statement)
+			         .loop_action,
+			    assigned);
+		}
+	}
+}
+
+static void countAssignments(const StatementsNode &node,
+                             std::map<std::string, int> &counts) {
+	for (auto &statement : node.statements) {
+		if (typeid(*statement) == typeid(AssignStatementNode)) {
+			counts[dynamic_cast<const AssignStatementNode &>(*statement)
+			           .variable]++;
+		} else if (typeid(*statement) == typeid(IfStatementNode)) {
+			auto &if_statement =
+			    dynamic_cast<const IfStatementNode &>(*statement);
+			countAssignments(*if_statement.true_action, counts);
+			countAssignments(*if_statement.false_action, counts);
+		} else if (typeid(*statement) == typeid(DoWhileStatementNode)) {
+			countAssignments(
+			    *dynamic_cast<const DoWhileStatementNode &>(*statement)
+			         .loop_action,
+			    counts);
+		}
+	}
+}
+
+static bool isInvariant(const ExpressionNode &node,
+                        const std::set<std::string> &assigned);
+
+static bool isInvariant(const ItemNode &node,
+                        const std::set<std::string> &assigned) {
+	for (auto &repeat_variable : node.repeat_variables) {
+		if (assigned.contains(repeat_variable)) {
+			return false;
+		}
+	}
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(VariableFactorNode)) {
+		return !assigned.contains(
+		    dynamic_cast<const VariableFactorNode &>(factor).identifier);
+	} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		return isInvariant(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression,
+		    assigned);
+	}
+	return true;
+}
+
+static bool isInvariant(const ExpressionNode &node,
+                        const std::set<std::string> &assigned) {
+	for (auto &item : node.items) {
+		if (!isInvariant(*item, assigned)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// var = var + ...
+static bool isAppend(const AssignStatementNode &node) {
+	auto &items = node.expression->items;
+	if (items.size() < 2 || !items[0]->repeat_times.empty() ||
+	    !items[0]->repeat_variables.empty()) {
+		return false;
+	}
+	auto *var = dynamic_cast<const VariableFactorNode *>(&*items[0]->factor);
+	return var != nullptr && var->identifier == node.variable;
+}
+
+static bool readsOnly(const ExpressionNode &node,
+                      const std::set<std::string> &variables);
+
+static bool readsOnly(const ItemNode &node,
+                      const std::set<std::string> &variables) {
+	for (auto &repeat_variable : node.repeat_variables) {
+		if (!variables.contains(repeat_variable)) {
+			return false;
+		}
+	}
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(VariableFactorNode)) {
+		return variables.contains(
+		    dynamic_cast<const VariableFactorNode &>(factor).identifier);
+	} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		return readsOnly(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression,
+		    variables);
+	}
+	return true;
+}
+
+static bool readsOnly(const ExpressionNode &node,
+                      const std::set<std::string> &variables) {
+	for (auto &item : node.items) {
+		if (!readsOnly(*item, variables)) {
+			return false;
+		}
+	}
+	return !node.items.empty();
+}
+
+// Whether two factors are the same literal or variable
+static bool isSameLeaf(const FactorNode &a, const FactorNode &b) {
+	if (typeid(a) != typeid(b)) {
+		return false;
+	} else if (typeid(a) == typeid(StringFactorNode)) {
+		return dynamic_cast<const StringFactorNode &>(a).str ==
+		       dynamic_cast<const StringFactorNode &>(b).str;
+	} else if (typeid(a) == typeid(VariableFactorNode)) {
+		return dynamic_cast<const VariableFactorNode &>(a).identifier ==
+		       dynamic_cast<const VariableFactorNode &>(b).identifier;
+	}
+	return false;
+}
+
+// Unknown if simplifyItem() has kept several factors, whose product would
+// overflow
+static std::optional<int64_t> repeatTimes(const ItemNode &node) {
+	if (node.repeat_times.size() > 1) {
+		return std::nullopt;
+	}
+	return node.repeat_times.empty() ? 1 : node.repeat_times[0];
+}
+
+void Optimizer::simplify(StatementsNode &node) {
+	for (auto &statement : node.statements) {
+		if (typeid(*statement) == typeid(AssignStatementNode)) {
+			auto &assign = dynamic_cast<AssignStatementNode &>(*statement);
+			if (int_variables.contains(assign.variable)) {
+				continue; // the rules are for strings, not int sums
+			}
+			// a = a + ... stays an append, see LLVMCodeGen::genAppendAssign()
+			simplifyExpression(*assign.expression, isAppend(assign));
+		} else if (typeid(*statement) == typeid(IfStatementNode)) {
+			auto &if_statement = dynamic_cast<IfStatementNode &>(*statement);
+			simplifyCondition(*if_statement.condition);
+			simplify(*if_statement.true_action);
+			simplify(*if_statement.false_action);
+		} else if (typeid(*statement) == typeid(DoWhileStatementNode)) {
+			auto &loop = dynamic_cast<DoWhileStatementNode &>(*statement);
+			simplify(*loop.loop_action);
+			simplifyCondition(*loop.condition);
+		}
+	}
+}
+
+void Optimizer::simplifyCondition(ConditionNode &node) {
+	// the rules are for strings, not int sums
+	if (!isIntExpression(*node.lhs, int_variables)) {
+		simplifyExpression(*node.lhs, false);
+		simplifyExpression(*node.rhs, false);
+	}
+}
+
+void Optimizer::simplifyExpression(ExpressionNode &node, bool keep_first) {
+	// (x + y) + z -> x + y + z
+	std::vector<std::unique_ptr<ItemNode>> items;
+	for (auto &item : node.items) {
+		simplifyItem(*item);
+		auto &factor = *item->factor;
+		if (typeid(factor) == typeid(ExpressionFactorNode) &&
+		    item->repeat_times.empty() && item->repeat_variables.empty()) {
+			auto &inner =
+			    *dynamic_cast<ExpressionFactorNode &>(factor).expression;
+			items.insert(items.end(),
+			             std::make_move_iterator(inner.items.begin()),
+			             std::make_move_iterator(inner.items.end()));
+		} else {
+			items.push_back(std::move(item));
+		}
+	}
+
+	// x * 0 + "" + y -> y
+	// x * 2 + x * 3 -> x * 5
+	node.items.clear();
+	for (auto &item : items) {
+		auto *literal = dynamic_cast<StringFactorNode *>(&*item->factor);
+		bool empty = repeatTimes(*item) == 0 ||
+		             (literal != nullptr && literal->str.empty());
+		if (empty && readsOnly(*item, declared)) {
+			continue;
+		}
+		if (!node.items.empty() && !(keep_first && node.items.size() == 1)) {
+			auto &last = *node.items.back();
+			auto times = repeatTimes(last).value_or(-1);
+			auto more = repeatTimes(*item).value_or(-1);
+			if (isSameLeaf(*last.factor, *item->factor) &&
+			    last.repeat_variables.empty() &&
+			    item->repeat_variables.empty() && times >= 0 &&
+			    more >= 0 && times <= INT64_MAX - more && times + more > 0) {
+				last.repeat_times = {times + more};
+				last.position_end = item->position_end;
+				continue;
+			}
+		}
+		node.items.push_back(std::move(item));
+	}
+
+	if (node.items.empty()) {
+		// x * 0 -> ""
+		auto factor = std::make_unique<StringFactorNode>();
+		factor->position_begin = node.position_begin;
+		factor->position_end = node.position_end;
+		auto item = std::make_unique<ItemNode>();
+		item->position_begin = node.position_begin;
+		item->position_end = node.position_end;
+		item->factor = std::move(factor);
+		node.items.push_back(std::move(item));
+	}
+}
+
+void Optimizer::simplifyItem(ItemNode &node) {
+	// (x * 2) * 3 -> x * 2 * 3
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		auto &inner = *dynamic_cast<ExpressionFactorNode &>(factor).expression;
+		simplifyExpression(inner, false);
+		if (inner.items.size() == 1) {
+			auto inner_item = std::move(inner.items[0]);
+			inner_item->repeat_times.insert(inner_item->repeat_times.end(),
+			                                node.repeat_times.begin(),
+			                                node.repeat_times.end());
+			inner_item->repeat_variables.insert(
+			    inner_item->repeat_variables.end(),
+			    node.repeat_variables.begin(), node.repeat_variables.end());
+			node.repeat_times = std::move(inner_item->repeat_times);
+			node.repeat_variables = std::move(inner_item->repeat_variables);
+			node.factor = std::move(inner_item->factor);
+		}
+	}
+
+	// x * 2 * 3 -> x * 6
+	// x * 1 -> x
+	int64_t times = 1;
+	for (auto repeat_time : node.repeat_times) {
+		if (repeat_time < 0) {
+			return; // an error left to LLVMCodeGen
+		}
+		if (repeat_time == 0 && times > 1 && !fitsRepeat(*node.factor, times)) {
+			return; // x * times may be too long, before * 0 empties it
+		}
+		if (repeat_time != 0 && times > INT64_MAX / repeat_time) {
+			return; // too long to be built anyway
+		}
+		times *= repeat_time;
+	}
+	node.repeat_times.clear();
+	if (times != 1) {
+		node.repeat_times.push_back(times);
+	}
+}
+
+bool Optimizer::fitsRepeat(const FactorNode &node, uint64_t times) const {
+	std::optional<uint64_t> max_len;
+	if (typeid(node) == typeid(StringFactorNode)) {
+		max_len = dynamic_cast<const StringFactorNode &>(node).str.size();
+	} else if (lengths.has_value()) {
+		std::optional<LengthInterval> len;
+		if (typeid(node) == typeid(VariableFactorNode)) {
+			len = lengths->lengthOf(
+			    dynamic_cast<const VariableFactorNode &>(node));
+		} else if (typeid(node) == typeid(ExpressionFactorNode)) {
+			len = lengths->lengthOf(
+			    *dynamic_cast<const ExpressionFactorNode &>(node).expression);
+		}
+		if (len.has_value()) {
+			max_len = len->hi;
+		}
+	}
+	return max_len.has_value() &&
+	       (*max_len == 0 || times <= max_string_length / *max_len);
+}
+
+// The length of a string, or the value of an int, after i iterations of a
+// loop is base + slope * i
+struct AffineLength {
+	__int128 base = 0;
+	__int128 slope = 0;
+};
+
+using AffineLengths = std::map<std::string, AffineLength>;
+
+static std::optional<AffineLength>
+affineLength(const ExpressionNode &node, const AffineLengths &known);
+
+static std::optional<AffineLength> affineLength(const ItemNode &node,
+                                                const AffineLengths &known) {
+	std::optional<AffineLength> len;
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(StringFactorNode)) {
+		len = {static_cast<__int128>(
+		           dynamic_cast<const StringFactorNode &>(factor).str.size()),
+		       0};
+	} else if (typeid(factor) == typeid(IntegerFactorNode)) {
+		len = {dynamic_cast<const IntegerFactorNode &>(factor).value, 0};
+	} else if (typeid(factor) == typeid(VariableFactorNode)) {
+		auto it = known.find(
+		    dynamic_cast<const VariableFactorNode &>(factor).identifier);
+		if (it != known.end()) {
+			len = it->second;
+		}
+	} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		len = affineLength(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression,
+		    known);
+	}
+	if (len.has_value()) {
+		std::vector<__int128> repeat_times(node.repeat_times.begin(),
+		                                   node.repeat_times.end());
+		for (auto &repeat_variable : node.repeat_variables) {
+			// an int which the loop doesn't assign
+			auto it = known.find(repeat_variable);
+			if (it == known.end() || it->second.slope != 0) {
+				return std::nullopt;
+			}
+			repeat_times.push_back(it->second.base);
+		}
+		for (auto repeat_time : repeat_times) {
+			len->base *= repeat_time;
+			len->slope *= repeat_time;
+			if (len->base > max_string_length ||
+			    len->slope > max_string_length) {
+				// too long to be built, and to be multiplied again
+				return std::nullopt;
+			}
+		}
+	}
+	return len;
+}
+
+static std::optional<AffineLength>
+affineLength(const ExpressionNode &node, const AffineLengths &known) {
+	AffineLength len;
+	for (auto &item : node.items) {
+		auto item_len = affineLength(*item, known);
+		if (!item_len.has_value()) {
+			return std::nullopt;
+		}
+		len.base += item_len->base;
+		len.slope += item_len->slope;
+		if (len.base > max_string_length || len.slope > max_string_length) {
+			return std::nullopt;
+		}
+	}
+	return len;
+}
+
+void Optimizer::solveLoops(StatementsNode &node) {
+	auto &statements = node.statements;
+	for (size_t i = 0; i < statements.size(); i++) {
+		auto &statement = *statements[i];
+		if (typeid(statement) == typeid(IfStatementNode)) {
+			auto &if_statement = dynamic_cast<IfStatementNode &>(statement);
+			solveLoops(*if_statement.true_action);
+			solveLoops(*if_statement.false_action);
+		} else if (typeid(statement) == typeid(DoWhileStatementNode)) {
+			auto &loop = dynamic_cast<DoWhileStatementNode &>(statement);
+			auto replacement = solveLoop(loop);
+			if (!replacement.has_value()) {
+				solveLoops(*loop.loop_action);
+				continue;
+			}
+			auto count = replacement->size();
+			statements.erase(statements.begin() + i);
+			statements.insert(statements.begin() + i,
+			                  std::make_move_iterator(replacement->begin()),
+			                  std::make_move_iterator(replacement->end()));
+			i += count;
+			i--;
+		}
+	}
+}
+
+std::optional<std::vector<std::unique_ptr<StatementNode>>>
+Optimizer::solveLoop(DoWhileStatementNode &node) {
+	// A loop whose condition only compares lengths which grow by a fixed
+	// amount per iteration runs a number of times that is known at compile
+	// time. The body statements fall into three kinds:
+	//   stable: w = expr, where expr reads no variable assigned in the loop
+	//           except stable ones assigned before, so w is the same after
+	//           every iteration
+	//   append: v = v + expr, with expr as above, so v grows by len(expr),
+	//           or an int v by the value of expr, which must be known
+	//   other:  anything else, as long as it doesn't assign a variable
+	//           assigned by the statements above
+	// If the condition only reads variables which are not assigned in the
+	// loop, stable or append, solving it gives the trip count n. A loop of
+	// stable and append statements then becomes the statements themselves,
+	// with v = v + (expr)*n for every append, or v = v + value*n for an int.
+	// A loop with other statements is unrolled if n is small.
+	auto &op = node.condition->op;
+	if (op == RelationOp::EQUAL || op == RelationOp::NOT_EQUAL) {
+		return std::nullopt;
+	}
+	auto entry = lengths->stateBefore(node);
+	if (!entry.has_value()) {
+		return std::nullopt;
+	}
+	std::map<std::string, int> counts;
+	countAssignments(*node.loop_action, counts);
+	std::set<std::string> unreadable;
+	for (auto &[name, count] : counts) {
+		unreadable.insert(name);
+	}
+	AffineLengths known;
+	for (auto &[name, len] : *entry) {
+		if (len.isExact() && !counts.contains(name)) {
+			known[name] = {len.lo, 0};
+		}
+	}
+
+	enum class Kind { STABLE, APPEND, OTHER };
+	std::vector<Kind> kinds;
+	std::vector<std::string> appended;
+	// what the int appends add per iteration
+	std::map<std::string, __int128> int_deltas;
+	for (auto &statement : node.loop_action->statements) {
+		auto kind = Kind::OTHER;
+		auto *assign = dynamic_cast<AssignStatementNode *>(&*statement);
+		if (assign != nullptr && counts[assign->variable] == 1) {
+			auto &var = assign->variable;
+			auto &items = assign->expression->items;
+			if (isAppend(*assign) &&
+			    std::all_of(items.begin() + 1, items.end(),
+			                [&unreadable](auto &item) {
+				                return isInvariant(*item, unreadable);
+			                })) {
+				AffineLength delta;
+				bool delta_known = true;
+				for (size_t i = 1; i < items.size(); i++) {
+					auto len = affineLength(*items[i], known);
+					if (!len.has_value()) {
+						delta_known = false;
+						break;
+					}
+					delta.base += len->base;
+				}
+				auto &entry_len = (*entry)[var];
+				if (delta_known && entry_len.isExact()) {
+					known[var] = {entry_len.lo, delta.base};
+				}
+				if (int_variables.contains(var) && delta_known) {
+					kind = Kind::APPEND;
+					int_deltas[var] = delta.base;
+					appended.push_back(var);
+				} else if (!int_variables.contains(var)) {
+					kind = Kind::APPEND;
+					appended.push_back(var);
+				}
+			} else if (isInvariant(*assign->expression, unreadable)) {
+				kind = Kind::STABLE;
+				unreadable.erase(var);
+				if (auto len = affineLength(*assign->expression, known)) {
+					known[var] = *len;
+				}
+			}
+		}
+		kinds.push_back(kind);
+	}
+
+	// Solve the condition for the first iteration after which it is false.
+	// diff(i) = len(lhs) - len(rhs) is linear in i, so the condition holds
+	// for a prefix of the iterations.
+	auto lhs = affineLength(*node.condition->lhs, known);
+	auto rhs = affineLength(*node.condition->rhs, known);
+	if (!lhs.has_value() || !rhs.has_value()) {
+		return std::nullopt;
+	}
+	auto holds = [&](__int128 i) {
+		auto diff = lhs->base - rhs->base + (lhs->slope - rhs->slope) * i;
+		switch (op) {
+		case RelationOp::LESS:
+			return diff < 0;
+		case RelationOp::GREATER:
+			return diff > 0;
+		case RelationOp::LESS_EQUAL:
+			return diff <= 0;
+		case RelationOp::GREATER_EQUAL:
+			return diff >= 0;
+		default:
+			throw std::runtime_error("Unknown op");
+		}
+	};
+	if (holds(max_trip_count)) {
+		return std::nullopt; // endless, or too long to bother
+	}
+	int64_t trips = 1;
+	if (holds(1)) {
+		int64_t lo = 1; // holds
+		int64_t hi = max_trip_count; // doesn't hold
+		while (hi - lo > 1) {
+			auto mid = lo + (hi - lo) / 2;
+			if (holds(mid)) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		trips = hi;
+	}
+	for (auto &var : appended) {
+		auto it = known.find(var);
+		if (it != known.end() &&
+		    it->second.base + it->second.slope * trips > max_string_length) {
+			return std::nullopt;
+		}
+	}
+	for (auto &[var, delta] : int_deltas) {
+		if (delta * trips > INT64_MAX) {
+			return std::nullopt; // an overflow left to the compiled program
+		}
+	}
+
+	auto &statements = node.loop_action->statements;
+	std::vector<std::unique_ptr<StatementNode>> result;
+	bool closed_form =
+	    std::find(kinds.begin(), kinds.end(), Kind::OTHER) == kinds.end();
+	if (closed_form && !options.debug_mode) {
+		// do { w = expr; v = v + expr2; i = i + expr3; } while (...);
+		// ---- becomes ----
+		// w = expr;
+		// v = v + (expr2)*n;
+		// i = i + k; // k = expr3 * n, computed for an int
+		for (size_t i = 0; i < statements.size(); i++) {
+			auto *assign = dynamic_cast<AssignStatementNode *>(&*statements[i]);
+			if (kinds[i] == Kind::APPEND && trips > 1 &&
+			    int_variables.contains(assign->variable)) {
+				auto &items = assign->expression->items;
+				auto factor = std::make_unique<IntegerFactorNode>();
+				factor->position_begin = items[1]->position_begin;
+				factor->position_end = items.back()->position_end;
+				factor->value = int_deltas.at(assign->variable) * trips;
+				items.erase(items.begin() + 1, items.end());
+				auto item = std::make_unique<ItemNode>();
+				item->position_begin = factor->position_begin;
+				item->position_end = factor->position_end;
+				item->factor = std::move(factor);
+				items.push_back(std::move(item));
+			} else if (kinds[i] == Kind::APPEND && trips > 1) {
+				auto &items = assign->expression->items;
+				auto appended_expression = std::make_unique<ExpressionNode>();
+				appended_expression->position_begin = items[1]->position_begin;
+				appended_expression->position_end = items.back()->position_end;
+				appended_expression->items.insert(
+				    appended_expression->items.end(),
+				    std::make_move_iterator(items.begin() + 1),
+				    std::make_move_iterator(items.end()));
+				items.erase(items.begin() + 1, items.end());
+				auto factor = std::make_unique<ExpressionFactorNode>();
+				factor->position_begin = appended_expression->position_begin;
+				factor->position_end = appended_expression->position_end;
+				factor->expression = std::move(appended_expression);
+				auto item = std::make_unique<ItemNode>();
+				item->position_begin = factor->position_begin;
+				item->position_end = factor->position_end;
+				item->factor = std::move(factor);
+				item->repeat_times.push_back(trips);
+				items.push_back(std::move(item));
+			}
+			result.push_back(std::move(statements[i]));
+		}
+	} else if (static_cast<uint64_t>(trips) <= max_unrolled_trips) {
+		// Unrolling keeps every assignment, so -d prints the same trace
+		for (int64_t trip = 1; trip < trips; trip++) {
+			for (auto &statement : statements) {
+				result.push_back(statement->clone());
+			}
+		}
+		for (auto &statement : statements) {
+			result.push_back(std::move(statement));
+		}
+	} else {
+		return std::nullopt;
+	}
+	return result;
+}
+
+static void collectReads(const ConditionNode &node,
+                         std::set<std::string> &reads) {
+	collectReads(*node.lhs, reads);
+	collectReads(*node.rhs, reads);
+}
+
+// A string which identifies the value of an expression
+static void appendKey(const ExpressionNode &node, std::string &key);
+
+static void appendKey(const ItemNode &node, std::string &key) {
+	auto &factor = *node.factor;
+	if (typeid(factor) == typeid(StringFactorNode)) {
+		key += '"';
+		key += dynamic_cast<const StringFactorNode &>(factor).str;
+		key += '"';
+	} else if (typeid(factor) == typeid(IntegerFactorNode)) {
+		key += std::to_string(
+		    dynamic_cast<const IntegerFactorNode &>(factor).value);
+	} else if (typeid(factor) == typeid(VariableFactorNode)) {
+		key += dynamic_cast<const VariableFactorNode &>(factor).identifier;
+	} else if (typeid(factor) == typeid(ExpressionFactorNode)) {
+		key += '(';
+		appendKey(
+		    *dynamic_cast<const ExpressionFactorNode &>(factor).expression,
+		    key);
+		key += ')';
+	}
+	for (auto repeat_time : node.repeat_times) {
+		key += '*';
+		key += std::to_string(repeat_time);
+	}
+	for (auto &repeat_variable : node.repeat_variables) {
+		key += '*';
+		key += repeat_variable;
+	}
+}
+
+static void appendKey(const ExpressionNode &node, std::string &key) {
+	for (size_t i = 0; i < node.items.size(); i++) {
+		if (i != 0) {
+			key += '+';
+		}
+		appendKey(*node.items[i], key);
+	}
+}
+
+static std::string expressionKey(const ExpressionNode &node) {
+	std::string key;
+	appendKey(node, key);
+	return key;
+}
+
+// Whether an expression is computed at runtime, i.e. it is not a single
+// variable or a literal which LLVMCodeGen folds
+static bool isComputed(const ExpressionNode &node) {
+	if (node.items.size() == 1 && node.items[0]->repeat_times.empty() &&
+	    node.items[0]->repeat_variables.empty() &&
+	    typeid(*node.items[0]->factor) != typeid(ExpressionFactorNode)) {
+		return false;
+	}
+	return !literalValue(node).has_value();
+}
+
+// Forgets the values which depend on a variable that is assigned
+void Optimizer::killValues(AvailableValues &available,
+                           const std::string &variable) {
+	std::erase_if(available, [&variable](auto &entry) {
+		return entry.second.variable == variable ||
+		       entry.second.reads.contains(variable);
+	});
+}
+
+void Optimizer::reuseValues(StatementsNode &node,
+                            AvailableValues &available) {
+	// Forward pass which tracks which variables hold the values of which
+	// expressions. A later occurrence of such an expression reads the
+	// variable instead, as long as neither the variable nor an operand has
+	// been assigned in between. Variables share their strings with
+	// reference counts, so reading one never makes a second owner.
+	auto &statements = node.statements;
+	for (size_t i = 0; i < statements.size(); i++) {
+		auto &statement = *statements[i];
+		if (typeid(statement) == typeid(AssignStatementNode)) {
+			// ---- before ----
+			// c = a + b;
+			// d = a + b + "x";
+			// ---- after ----
+			// c = a + b;
+			// d = c + "x";
+			auto &assign = dynamic_cast<AssignStatementNode &>(statement);
+			auto &expression = *assign.expression;
+			auto original_key = expressionKey(expression);
+			std::set<std::string> original_reads;
+			collectReads(expression, original_reads);
+			reuseValues(expression, available, isAppend(assign));
+			auto key = expressionKey(expression);
+			if (key == assign.variable && !options.debug_mode) {
+				// already holds the value
+				statements.erase(statements.begin() + i);
+				i--;
+				continue;
+			}
+			std::set<std::string> reads;
+			collectReads(expression, reads);
+			killValues(available, assign.variable);
+			if (isComputed(expression) && !reads.contains(assign.variable)) {
+				available[key] = {assign.variable, std::move(reads)};
+				if (!original_reads.contains(assign.variable)) {
+					available[original_key] = {assign.variable,
+					                           std::move(original_reads)};
+				}
+			}
+		} else if (typeid(statement) == typeid(IfStatementNode)) {
+			// what both branches leave available
+			auto &if_statement = dynamic_cast<IfStatementNode &>(statement);
+			reuseValues(*if_statement.condition->lhs, available, false);
+			reuseValues(*if_statement.condition->rhs, available, false);
+			auto available_false = available;
+			reuseValues(*if_statement.true_action, available);
+			reuseValues(*if_statement.false_action, available_false);
+			std::erase_if(available, [&available_false](auto &entry) {
+				auto it = available_false.find(entry.first);
+				return it == available_false.end() ||
+				       it->second.variable != entry.second.variable;
+			});
+		} else if (typeid(statement) == typeid(DoWhileStatementNode)) {
+			// what holds in every iteration
+			auto &loop = dynamic_cast<DoWhileStatementNode &>(statement);
+			std::set<std::string> assigned;
+			collectAssigned(*loop.loop_action, assigned);
+			for (auto &variable : assigned) {
+				killValues(available, variable);
+			}
+			reuseValues(*loop.loop_action, available);
+			reuseValues(*loop.condition->lhs, available, false);
+			reuseValues(*loop.condition->rhs, available, false);
+		} else if (typeid(statement) == typeid(ReleaseStatementNode)) {
+			auto &release = dynamic_cast<ReleaseStatementNode &>(statement);
+			killValues(available, release.variable);
+		}
+	}
+}
+
+void Optimizer::reuseValues(ExpressionNode &node,
+                            const AvailableValues &available,
+                            bool keep_first) {
+	if (available.empty()) {
+		return;
+	}
+	// Concat is associative, so any run of items can be an available
+	// value. Longer runs are tried first.
+	auto &items = node.items;
+	size_t i = keep_first ? 1 : 0;
+	while (i < items.size()) {
+		auto j = items.size();
+		if (j - i > max_reuse_run) {
+			j = i + 1;
+		}
+		for (; j > i; j--) {
+			std::string key;
+			for (auto k = i; k < j; k++) {
+				if (k != i) {
+					key += '+';
+				}
+				appendKey(*items[k], key);
+			}
+			auto it = available.find(key);
+			if (it == available.end()) {
+				continue;
+			}
+			auto variable = std::make_unique<VariableFactorNode>();
+			variable->position_begin = items[i]->position_begin;
+			variable->position_end = items[j - 1]->position_end;
+			variable->identifier = it->second.variable;
+			auto item = std::make_unique<ItemNode>();
+			item->position_begin = variable->position_begin;
+			item->position_end = variable->position_end;
+			item->factor = std::move(variable);
+			items.erase(items.begin() + i + 1, items.begin() + j);
+			items[i] = std::move(item);
+			break;
+		}
+		auto &factor = *items[i]->factor;
+		if (typeid(factor) == typeid(ExpressionFactorNode)) {
+			auto &inner = dynamic_cast<ExpressionFactorNode &>(factor);
+			reuseValues(*inner.expression, available, false);
+		}
+		i++;
+	}
+}
+
+bool Optimizer::cannotFail(const ExpressionNode &node) const {
+	auto len = lengths->lengthOf(node);
+	return len.has_value() && len->hi <= max_string_length;
+}
+
+std::set<std::string>
+Optimizer::eliminateDeadStores(
+    StatementsNode &node, std::set<std::string> live, bool remove,
+    std::vector<std::set<std::string>> *live_after) {
+	// Backward liveness: live holds the variables whose current value may
+	// still be read, or printed at exit. An assignment to a variable which
+	// isn't live is dead, and its expression isn't evaluated either. With
+	// remove == false, only the variables live before node are computed,
+	// and those live after each statement are stored to live_after.
+	auto &statements = node.statements;
+	if (live_after != nullptr) {
+		live_after->resize(statements.size());
+	}
+	for (size_t i = statements.size(); i-- > 0;) {
+		auto &statement = *statements[i];
+		if (live_after != nullptr) {
+			(*live_after)[i] = live;
+		}
+		if (typeid(statement) == typeid(AssignStatementNode)) {
+			auto &assign = dynamic_cast<AssignStatementNode &>(statement);
+			// -d prints every assignment to a declared variable
+			bool traced =
+			    options.debug_mode && declared.contains(assign.variable);
+			if (!live.contains(assign.variable) && !traced &&
+			    readsOnly(*assign.expression, declared) &&
+			    cannotFail(*assign.expression)) {
+				if (remove) {
+					statements.erase(statements.begin() + i);
+				}
+				continue;
+			}
+			live.erase(assign.variable);
+			collectReads(*assign.expression, live);
+		} else if (typeid(statement) == typeid(IfStatementNode)) {
+			auto &if_statement = dynamic_cast<IfStatementNode &>(statement);
+			auto live_true =
+			    eliminateDeadStores(*if_statement.true_action, live, remove);
+			auto live_false =
+			    eliminateDeadStores(*if_statement.false_action, live, remove);
+			auto &condition = *if_statement.condition;
+			if (remove && if_statement.true_action->statements.empty() &&
+			    if_statement.false_action->statements.empty() &&
+			    cannotFail(*condition.lhs) && cannotFail(*condition.rhs)) {
+				statements.erase(statements.begin() + i);
+				continue;
+			}
+			live = std::move(live_true);
+			live.insert(live_false.begin(), live_false.end());
+			collectReads(*if_statement.condition, live);
+		} else if (typeid(statement) == typeid(DoWhileStatementNode)) {
+			// The body runs again while the condition holds, so what is live
+			// after it is what is live after the loop, what the condition
+			// reads and what is live before the body. Iterate to a fixpoint
+			// before removing anything.
+			auto &loop = dynamic_cast<DoWhileStatementNode &>(statement);
+			auto live_after_body = live;
+			collectReads(*loop.condition, live_after_body);
+			while (true) {
+				auto live_before_body = eliminateDeadStores(
+				    *loop.loop_action, live_after_body, false);
+				auto size = live_after_body.size();
+				live_after_body.insert(live_before_body.begin(),
+				                       live_before_body.end());
+				if (live_after_body.size() == size) {
+					break;
+				}
+			}
+			live = eliminateDeadStores(*loop.loop_action, live_after_body,
+			                           remove);
+		} else if (typeid(statement) == typeid(ReleaseStatementNode)) {
+			auto &release = dynamic_cast<ReleaseStatementNode &>(statement);
+			live.erase(release.variable);
+		}
+	}
+	return live;
+}
+
+// var is assigned by the statement
+static bool assigns(const StatementNode &node, const std::string &variable) {
+	auto *assign = dynamic_cast<const AssignStatementNode *>(&node);
+	return assign != nullptr && assign->variable == variable;
+}
+
+void Optimizer::releaseDeadValues(StatementsNode &node,
+                                  const std::set<std::string> &live,
+                                  const std::set<std::string> &live_on_entry) {
+	// A value is released right after its last read, so that it doesn't
+	// add to the memory use until the variable is assigned again. Not
+	// when that assignment comes right away, which reuses the buffer (see
+	// LLVMCodeGen::genOverwriteAssign()), and not inside loops, where the
+	// next iteration does.
+	// ---- before ----
+	// b = a + a;
+	// c = b * 9;
+	// d = c + c;
+	// b = d;
+	// ---- after ----
+	// b = a + a;
+	// c = b * 9;
+	// release b;
+	// d = c + c;
+	// b = d;
+	std::vector<std::set<std::string>> live_after;
+	auto live_before = eliminateDeadStores(node, live, false, &live_after);
+	auto &statements = node.statements;
+	std::vector<std::unique_ptr<StatementNode>> result;
+	auto release = [&](const std::set<std::string> &before,
+	                   const std::set<std::string> &after, size_t next) {
+		for (auto &variable : before) {
+			if (after.contains(variable) || !declared.contains(variable) ||
+			    int_variables.contains(variable) ||
+			    (next < statements.size() &&
+			     assigns(*statements[next], variable))) {
+				continue;
+			}
+			auto statement = std::make_unique<ReleaseStatementNode>();
+			auto position = next < statements.size()
+			                    ? statements[next]->position_begin
+			                    : node.position_end;
+			statement->position_begin = position;
+			statement->position_end = position;
+			statement->variable = variable;
+			result.push_back(std::move(statement));
+		}
+	};
+	// what an enclosing if read, and this branch doesn't
+	release(live_on_entry, live_before, 0);
+	for (size_t i = 0; i < statements.size(); i++) {
+		auto &statement = *statements[i];
+		auto before = i == 0 ? live_before : live_after[i - 1];
+		if (typeid(statement) == typeid(IfStatementNode)) {
+			auto &if_statement = dynamic_cast<IfStatementNode &>(statement);
+			releaseDeadValues(*if_statement.true_action, live_after[i],
+			                  before);
+			releaseDeadValues(*if_statement.false_action, live_after[i],
+			                  before);
+			result.push_back(std::move(statements[i]));
+			continue;
+		}
+		if (auto *assign = dynamic_cast<AssignStatementNode *>(&statement)) {
+			// only -d keeps assignments of dead values
+			before.insert(assign->variable);
+		}
+		result.push_back(std::move(statements[i]));
+		release(before, live_after[i], i + 1);
+	}
+	statements = std::move(result);
+}
+
+void Optimizer::hoistLoopInvariants(StatementsNode &node) {
+	auto &statements = node.statements;
+	for (size_t i = 0; i < statements.size(); i++) {
+		auto &statement = *statements[i];
+		if (typeid(statement) == typeid(IfStatementNode)) {
+			auto &if_statement = dynamic_cast<IfStatementNode &>(statement);
+			hoistLoopInvariants(*if_statement.true_action);
+			hoistLoopInvariants(*if_statement.false_action);
+		} else if (typeid(statement) == typeid(DoWhileStatementNode)) {
+			// Everything invariant in this loop is hoisted right before it,
+			// so that the expressions which are also invariant in enclosing
+			// loops have already been hoisted further out.
+			auto &loop = dynamic_cast<DoWhileStatementNode &>(statement);
+			std::set<std::string> assigned;
+			collectAssigned(*loop.loop_action, assigned);
+			std::vector<std::unique_ptr<StatementNode>> hoisted;
+			hoistFromStatements(*loop.loop_action, assigned, hoisted);
+			hoistFromCondition(*loop.condition, assigned, hoisted);
+			hoistLoopInvariants(*loop.loop_action);
+
+			// ---- before ----
+			// do ... (expr) ... while (...);
+			// ---- after ----
+			// _t0 = expr;
+			// do ... _t0 ... while (...);
+			// release _t0;
+			std::vector<std::unique_ptr<StatementNode>> releases;
+			for (auto &assign : hoisted) {
+				auto release = std::make_unique<ReleaseStatementNode>();
+				release->position_begin = loop.position_end;
+				release->position_end = loop.position_end;
+				release->variable =
+				    dynamic_cast<AssignStatementNode &>(*assign).variable;
+				releases.push_back(std::move(release));
+			}
+			auto count = hoisted.size();
+			statements.insert(statements.begin() + i,
+			                  std::make_move_iterator(hoisted.begin()),
+			                  std::make_move_iterator(hoisted.end()));
+			i += count;
+			statements.insert(statements.begin() + i + 1,
+			                  std::make_move_iterator(releases.begin()),
+			                  std::make_move_iterator(releases.end()));
+			i += count;
+		}
+	}
+}
+
+void Optimizer::hoistFromStatements(
+    StatementsNode &node, const std::set<std::string> &assigned,
+    std::vector<std::unique_ptr<StatementNode>> &hoisted) {
+	// Only from what runs on every iteration: a hoisted expression is
+	// computed even if the loop never reaches it, and may fail at runtime.
+	// The branches of an if are left to hoistLoopInvariants(), which hoists
+	// from the loops inside them right before those loops.
+	for (auto &statement : node.statements) {
+		if (typeid(*statement) == typeid(AssignStatementNode)) {
+			auto &assign = dynamic_cast<AssignStatementNode &>(*statement);
+			// a sum of ints has no string to hoist
+			if (!int_variables.contains(assign.variable)) {
+				hoistFromExpression(*assign.expression, assigned, hoisted);
+			}
+		} else if (typeid(*statement) == typeid(DoWhileStatementNode)) {
+			// a do-while body runs at least once
+			auto &loop = dynamic_cast<DoWhileStatementNode &>(*statement);
+			hoistFromStatements(*loop.loop_action, assigned, hoisted);
+			hoistFromCondition(*loop.condition, assigned, hoisted);
+		}
+	}
+}
+
+void Optimizer::hoistFromCondition(
+    ConditionNode &node, const std::set<std::string> &assigned,
+    std::vector<std::unique_ptr<StatementNode>> &hoisted) {
+	// The other relational operators only compute lengths, which is cheaper
+	// than keeping a hoisted string around
+	if ((node.op == RelationOp::EQUAL || node.op == RelationOp::NOT_EQUAL) &&
+	    !isIntExpression(*node.lhs, int_variables)) {
+		hoistFromExpression(*node.lhs, assigned, hoisted);
+		hoistFromExpression(*node.rhs, assigned, hoisted);
+	}
+}
+
+void Optimizer::hoistFromExpression(
+    ExpressionNode &node, const std::set<std::string> &assigned,
+    std::vector<std::unique_ptr<StatementNode>> &hoisted) {
+	// Concat is associative, so each maximal run of invariant items is
+	// hoisted as a whole. A run of a single literal or variable is already
+	// as cheap as reading a temporary, and so is a run of literals, which
+	// LLVMCodeGen folds into one.
+	auto &items = node.items;
+	size_t i = 0;
+	while (i < items.size()) {
+		if (!isInvariant(*items[i], assigned)) {
+			auto &factor = *items[i]->factor;
+			if (typeid(factor) == typeid(ExpressionFactorNode)) {
+				hoistFromExpression(
+				    *dynamic_cast<ExpressionFactorNode &>(factor).expression,
+				    assigned, hoisted);
+			}
+			i++;
+			continue;
+		}
+		auto j = i + 1;
+		while (j < items.size() && isInvariant(*items[j], assigned)) {
+			j++;
+		}
+		bool trivial = j == i + 1 && items[i]->repeat_times.empty() &&
+		               items[i]->repeat_variables.empty() &&
+		               typeid(*items[i]->factor) != typeid(ExpressionFactorNode);
+		bool literals = std::all_of(
+		    items.begin() + i, items.begin() + j,
+		    [](auto &item) { return literalValue(*item).has_value(); });
+		if (trivial || literals) {
+			i = j;
+			continue;
+		}
+
+		auto expression = std::make_unique<ExpressionNode>();
+		expression->position_begin = items[i]->position_begin;
+		expression->position_end = items[j - 1]->position_end;
+		expression->items.insert(expression->items.end(),
+		                         std::make_move_iterator(items.begin() + i),
+		                         std::make_move_iterator(items.begin() + j));
+		auto variable = std::make_unique<VariableFactorNode>();
+		variable->position_begin = expression->position_begin;
+		variable->position_end = expression->position_end;
+		// the same expression hoisted twice shares a temporary
+		auto key = expressionKey(*expression);
+		for (auto &statement : hoisted) {
+			auto &assign = dynamic_cast<AssignStatementNode &>(*statement);
+			if (expressionKey(*assign.expression) == key) {
+				variable->identifier = assign.variable;
+				break;
+			}
+		}
+		if (variable->identifier.empty()) {
+			auto assign = newTemporaryAssignment(std::move(expression));
+			variable->identifier = assign->variable;
+			hoisted.push_back(std::move(assign));
+		}
+
+		auto item = std::make_unique<ItemNode>();
+		item->position_begin = variable->position_begin;
+		item->position_end = variable->position_end;
+		item->factor = std::move(variable);
+		items.erase(items.begin() + i + 1, items.begin() + j);
+		items[i] = std::move(item);
+		i++;
+	}
+}
+
+} // namespace compiler
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "analysis.hpp"
+#include "ast.hpp"
+#include "codegen_options.hpp"
+#include <map>
+#include <set>
+
+namespace compiler {
+
+// AST-level optimizations, enabled by -o/--optimize. They run after the TAC
+// is generated, so they only affect the compiled program.
+class Optimizer {
+  public:
+	static void optimize(ProgramNode &program, const CodeGenOptions &options);
+
+  private:
+	Optimizer(ProgramNode &program, const CodeGenOptions &options);
+
+	ProgramNode &program;
+	const CodeGenOptions options;
+	std::optional<LengthAnalysis> lengths;
+	std::set<std::string> declared;
+	// the declared variables of type int
+	std::set<std::string> int_variables;
+
+	std::string newTemporary();
+	std::unique_ptr<AssignStatementNode>
+	newTemporaryAssignment(std::unique_ptr<ExpressionNode> expression);
+
+	void simplify(StatementsNode &node);
+	void simplifyCondition(ConditionNode &node);
+	void simplifyExpression(ExpressionNode &node, bool keep_first);
+	void simplifyItem(ItemNode &node);
+	// Whether a factor repeated times is known to be at most
+	// max_string_length long
+	bool fitsRepeat(const FactorNode &node, uint64_t times) const;
+
+	void solveLoops(StatementsNode &node);
+	std::optional<std::vector<std::unique_ptr<StatementNode>>>
+	solveLoop(DoWhileStatementNode &node);
+
+	// An expression whose value a variable holds
+	struct AvailableValue {
+		std::string variable;
+		// the variables the expression reads
+		std::set<std::string> reads;
+	};
+	// keyed by expressionKey()
+	using AvailableValues = std::map<std::string, AvailableValue>;
+
+	static void killValues(AvailableValues &available,
+	                       const std::string &variable);
+	void reuseValues(StatementsNode &node, AvailableValues &available);
+	void reuseValues(ExpressionNode &node, const AvailableValues &available,
+	                 bool keep_first);
+
+	// Whether evaluating an expression never fails at runtime, since its
+	// length, or the value of an int sum, is known to stay within
+	// max_string_length.
+	bool cannotFail(const ExpressionNode &node) const;
+	std::set<std::string> eliminateDeadStores(
+	    StatementsNode &node, std::set<std::string> live, bool remove,
+	    std::vector<std::set<std::string>> *live_after = nullptr);
+	void releaseDeadValues(StatementsNode &node,
+	                       const std::set<std::string> &live,
+	                       const std::set<std::string> &live_on_entry);
+
+	void hoistLoopInvariants(StatementsNode &node);
+	void hoistFromStatements(
+	    StatementsNode &node, const std::set<std::string> &assigned,
+	    std::vector<std::unique_ptr<StatementNode>> &hoisted);
+	void hoistFromCondition(
+	    ConditionNode &node, const std::set<std::string> &assigned,
+	    std::vector<std::unique_ptr<StatementNode>> &hoisted);
+	void hoistFromExpression(
+	    ExpressionNode &node, const std::set<std::string> &assigned,
+	    std::vector<std::unique_ptr<StatementNode>> &hoisted);
+};
+
+} // namespace compiler
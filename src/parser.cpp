@@ -1,5 +1,6 @@
 #include "parser.hpp"
 #include "error.hpp"
+#include <stdexcept>
 
 namespace compiler {
 
@@ -36,36 +37,87 @@ std::unique_ptr<ProgramNode> Parser::parse() {
 }
 
 std::unique_ptr<ProgramNode> Parser::parseProgram() {
-	logp("<PROGRAM> ::= <VAR_DECLARES> SEMICOLON <STATEMENTS>");
+	logp("<PROGRAM> ::= <VAR_DECLARES> <STATEMENTS>");
 	auto ast = std::make_unique<ProgramNode>();
 	ast->position_begin = current.position;
-	ast->variables = parseVarDeclares();
-	match(TokenType::SEMICOLON);
+	parseVarDeclares(*ast);
 	ast->statements = parseStatements();
 	ast->position_end = last_token_end;
 	return ast;
 }
 
-std::unique_ptr<VariableDeclarationNode> Parser::parseVarDeclares() {
-	logp("<VAR_DECLARES> ::= <VAR_TYPE> <IDENTIFIER_LIST>");
-	auto ast = std::make_unique<VariableDeclarationNode>();
-	ast->position_begin = current.position;
-	parseVarType(*ast);
-	parseIdentifierList(*ast);
-	ast->position_end = last_token_end;
-	return ast;
+void Parser::parseVarDeclares(ProgramNode &parent) {
+	logp("<VAR_DECLARES> ::= <VAR_DECLARE> SEMICOLON <VAR_DECLARES_MORE>");
+	parent.variables = std::make_unique<VariableDeclarationNode>();
+	parent.variables->type = "string";
+	parent.int_variables = std::make_unique<VariableDeclarationNode>();
+	parent.int_variables->type = "int";
+	for (auto *declaration : {&*parent.variables, &*parent.int_variables}) {
+		declaration->position_begin = current.position;
+	}
+	parseVarDeclare(parent);
+	match(TokenType::SEMICOLON);
+	parseVarDeclaresMore(parent);
+	for (auto *declaration : {&*parent.variables, &*parent.int_variables}) {
+		declaration->position_end = last_token_end;
+	}
 }
 
-void Parser::parseVarType(VariableDeclarationNode &parent) {
-	logp("<VAR_TYPE> ::= KEYWORD_STRING");
-	auto type = match(TokenType::KEYWORD_STRING);
-	parent.type = std::move(type.str);
+void Parser::parseVarDeclaresMore(ProgramNode &parent) {
+	switch (current.type) {
+
+	case TokenType::KEYWORD_STRING:
+	case TokenType::KEYWORD_INT: {
+		logp("<VAR_DECLARES_MORE> ::= <VAR_DECLARE> SEMICOLON "
+		     "<VAR_DECLARES_MORE>");
+		parseVarDeclare(parent);
+		match(TokenType::SEMICOLON);
+		parseVarDeclaresMore(parent);
+		return;
+	}
+
+	case TokenType::IDENTIFIER:
+	case TokenType::KEYWORD_IF:
+	case TokenType::KEYWORD_DO:
+		logp("<VAR_DECLARES_MORE> ::= none");
+		return;
+
+	default:
+		error("Expect KEYWORD_STRING, KEYWORD_INT, IDENTIFIER, KEYWORD_IF or "
+		      "KEYWORD_DO, got " +
+		      to_string(current.type));
+	}
+}
+
+void Parser::parseVarDeclare(ProgramNode &parent) {
+	logp("<VAR_DECLARE> ::= <VAR_TYPE> <IDENTIFIER_LIST>");
+	// declarations of the same type are merged
+	auto &declaration = parseVarType(parent);
+	parseIdentifierList(declaration);
+}
+
+VariableDeclarationNode &Parser::parseVarType(ProgramNode &parent) {
+	switch (current.type) {
+
+	case TokenType::KEYWORD_STRING:
+		logp("<VAR_TYPE> ::= KEYWORD_STRING");
+		match(TokenType::KEYWORD_STRING);
+		return *parent.variables;
+
+	case TokenType::KEYWORD_INT:
+		logp("<VAR_TYPE> ::= KEYWORD_INT");
+		match(TokenType::KEYWORD_INT);
+		return *parent.int_variables;
+
+	default:
+		error("Expect KEYWORD_STRING or KEYWORD_INT, got " +
+		      to_string(current.type));
+	}
 }
 
 void Parser::parseIdentifierList(VariableDeclarationNode &parent) {
 	logp("<IDENTIFIER_LIST> ::= IDENTIFIER <IDENTIFIER_LIST_MORE>");
-	auto identifier = match(TokenType::IDENTIFIER);
-	parent.identifiers.push_back(std::move(identifier.str));
+	declare(parent, match(TokenType::IDENTIFIER));
 	parseIdentifierListMore(parent);
 }
 
@@ -76,8 +128,7 @@ void Parser::parseIdentifierListMore(VariableDeclarationNode &parent) {
 		logp("<IDENTIFIER_LIST_MORE> ::= COMMA IDENTIFIER "
 		     "<IDENTIFIER_LIST_MORE>");
 		match(TokenType::COMMA);
-		auto identifier = match(TokenType::IDENTIFIER);
-		parent.identifiers.push_back(std::move(identifier.str));
+		declare(parent, match(TokenType::IDENTIFIER));
 		parseIdentifierListMore(parent);
 		return;
 	}
@@ -91,6 +142,15 @@ void Parser::parseIdentifierListMore(VariableDeclarationNode &parent) {
 	}
 }
 
+void Parser::declare(VariableDeclarationNode &parent, Token identifier) {
+	if (!declared.insert(identifier.str).second) {
+		throw CompileException(identifier.position,
+		                       "Variable " + identifier.str +
+		                           " is declared twice");
+	}
+	parent.identifiers.push_back(std::move(identifier.str));
+}
+
 std::unique_ptr<StatementsNode> Parser::parseStatements() {
 	logp("<STATEMENTS> ::= <STATEMENT> SEMICOLON <STATEMENTS_MORE>");
 	auto ast = std::make_unique<StatementsNode>();
@@ -250,10 +310,22 @@ void Parser::parseItemMore(ItemNode &parent) {
 	switch (current.type) {
 
 	case TokenType::OP_REPEAT: {
-		logp("<ITEM_MORE> ::= OP_REPEAT NUMBER <ITEM_MORE>");
 		match(TokenType::OP_REPEAT);
+		if (current.type == TokenType::IDENTIFIER) {
+			logp("<ITEM_MORE> ::= OP_REPEAT IDENTIFIER <ITEM_MORE>");
+			auto repeat_variable = match(TokenType::IDENTIFIER);
+			parent.repeat_variables.push_back(std::move(repeat_variable.str));
+			parseItemMore(parent);
+			return;
+		}
+		logp("<ITEM_MORE> ::= OP_REPEAT NUMBER <ITEM_MORE>");
 		auto repeat_time = match(TokenType::NUMBER);
-		parent.repeat_times.push_back(std::stoi(repeat_time.str));
+		try {
+			parent.repeat_times.push_back(std::stoll(repeat_time.str));
+		} catch (std::out_of_range &) {
+			throw CompileException(repeat_time.position,
+			                       "Repeat count is too large");
+		}
 		parseItemMore(parent);
 		return;
 	}
@@ -304,6 +376,20 @@ std::unique_ptr<FactorNode> Parser::parseFactor() {
 		return ast;
 	}
 
+	case TokenType::NUMBER: {
+		logp("<FACTOR> ::= NUMBER");
+		auto ast = std::make_unique<IntegerFactorNode>();
+		ast->position_begin = current.position;
+		auto number = match(TokenType::NUMBER);
+		try {
+			ast->value = std::stoll(number.str);
+		} catch (std::out_of_range &) {
+			throw CompileException(number.position, "Integer is too large");
+		}
+		ast->position_end = last_token_end;
+		return ast;
+	}
+
 	case TokenType::LEFT_BRACKET: {
 		logp("<FACTOR> ::= LEFT_BRACKET <EXPRESSION> RIGHT_BRACKET");
 		auto ast = std::make_unique<ExpressionFactorNode>();
@@ -316,7 +402,7 @@ std::unique_ptr<FactorNode> Parser::parseFactor() {
 	}
 
 	default:
-		error("Expect IDENTIFIER, STRING or LEFT_BRACKET, got " +
+		error("Expect IDENTIFIER, STRING, NUMBER or LEFT_BRACKET, got " +
 		      to_string(current.type));
 	}
 }
@@ -3,6 +3,7 @@
 #include "ast.hpp"
 #include "tokenizer.hpp"
 #include <memory>
+#include <set>
 
 namespace compiler {
 
@@ -22,6 +23,7 @@ class Parser {
 	int last_token_end;
 	Token current;
 	std::function<void(const std::string &)> production_cb;
+	std::set<std::string> declared;
 
 	void next();
 	Token match(TokenType type);
@@ -29,10 +31,13 @@ class Parser {
 	void logp(const std::string &msg);
 
 	std::unique_ptr<ProgramNode> parseProgram();
-	std::unique_ptr<VariableDeclarationNode> parseVarDeclares();
-	void parseVarType(VariableDeclarationNode &parent);
+	void parseVarDeclares(ProgramNode &parent);
+	void parseVarDeclaresMore(ProgramNode &parent);
+	void parseVarDeclare(ProgramNode &parent);
+	VariableDeclarationNode &parseVarType(ProgramNode &parent);
 	void parseIdentifierList(VariableDeclarationNode &parent);
 	void parseIdentifierListMore(VariableDeclarationNode &parent);
+	void declare(VariableDeclarationNode &parent, Token identifier);
 	std::unique_ptr<StatementsNode> parseStatements();
 	void parseStatementsMore(StatementsNode &parent);
 	std::unique_ptr<StatementNode> parseStatement();
@@ -0,0 +1,2776 @@
+#include "runtime.hpp"
+#include "trace.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/MDBuilder.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace compiler {
+
+// size of a fresh arena chunk, larger requests get a chunk of their own
+static constexpr uint64_t arena_chunk_size = 64 * 1024;
+// size classes of the variable pool are 32 << 0 ... 32 << (pool_classes - 1)
+static constexpr uint64_t pool_min_size = 32;
+static constexpr uint64_t pool_classes = 16;
+// blocks of at least this size are mapped from the kernel in whole huge
+// pages, which wastes at most an eighth of them
+static constexpr uint64_t huge_page_size = 2 << 20;
+static constexpr uint64_t large_alloc_threshold = 8 * huge_page_size;
+static_assert((pool_min_size << (pool_classes - 1)) < large_alloc_threshold,
+              "pooled blocks are freed with free()");
+// used when the cache size is unknown
+static constexpr uint64_t default_cache_size = 32 << 20;
+// a bulk copy is split into parts of at least this size, one per thread
+static constexpr uint64_t parallel_copy_min_part = 4 << 20;
+// of the worker pool, including the thread which hands out the jobs
+static constexpr uint64_t max_threads = 64;
+// the output of the program is buffered in this many bytes
+static constexpr uint64_t out_buffer_size = 1 << 16;
+// constants of the string hash
+static constexpr uint64_t hash_seed = 0x9e3779b97f4a7c15;
+static constexpr uint64_t hash_multiplier = 0xff51afd7ed558ccd;
+
+uint64_t hashString(llvm::StringRef str) {
+	uint64_t hash = hash_seed ^ str.size();
+	size_t idx = 0;
+	for (; idx + 8 <= str.size(); idx += 8) {
+		uint64_t word;
+		std::memcpy(&word, str.data() + idx, 8);
+		hash = (hash ^ word) * hash_multiplier;
+		hash ^= hash >> 32;
+	}
+	for (; idx < str.size(); idx++) {
+		hash = (hash ^ static_cast<uint8_t>(str[idx])) * hash_multiplier;
+	}
+	hash ^= hash >> 29;
+	return hash == 0 ? 1 : hash;
+}
+
+// Copies of at least this many bytes bypass the cache with non-temporal
+// stores, since they would evict all of it anyway. It is the size of the
+// last-level cache of the machine compiling the program.
+static uint64_t nontemporalCopyThreshold() {
+	static const uint64_t threshold = []() -> uint64_t {
+		// sysconf() reports 0 for a cache it doesn't know about
+#ifdef _SC_LEVEL3_CACHE_SIZE
+		for (int name : {_SC_LEVEL3_CACHE_SIZE, _SC_LEVEL2_CACHE_SIZE}) {
+			auto size = sysconf(name);
+			if (size > 0) {
+				return size;
+			}
+		}
+#endif
+		return default_cache_size;
+	}();
+	return threshold;
+}
+
+uint64_t bulkCopyThreshold() {
+	return std::min(nontemporalCopyThreshold(), 2 * parallel_copy_min_part);
+}
+
+LLVMRuntime::LLVMRuntime(llvm::Module &module, const CodeGenOptions &options)
+    : module(module), ctx(module.getContext()), options(options),
+      builder(module.getContext()) {}
+
+llvm::Function *LLVMRuntime::beginFunction(const std::string &name,
+                                           llvm::Type *return_type,
+                                           llvm::ArrayRef<llvm::Type *> params) {
+	auto *func = llvm::Function::Create(
+	    llvm::FunctionType::get(return_type, params, false),
+	    llvm::Function::InternalLinkage, name, module);
+	builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", func));
+	return func;
+}
+
+llvm::GlobalVariable *LLVMRuntime::createGlobal(llvm::Type *type,
+                                                const std::string &name) {
+	return new llvm::GlobalVariable(module, type, false,
+	                                llvm::GlobalValue::InternalLinkage,
+	                                llvm::Constant::getNullValue(type), name);
+}
+
+llvm::Value *LLVMRuntime::genHugePageRound(llvm::Value *size) {
+	// (size + huge_page_size - 1) & ~(huge_page_size - 1)
+	return builder.CreateAnd(
+	    builder.CreateAdd(size, builder.getInt64(huge_page_size - 1)),
+	    builder.getInt64(~(huge_page_size - 1)), "mapped_size");
+}
+
+llvm::FunctionCallee LLVMRuntime::malloc() {
+	if (auto *func = module.getFunction("_malloc_checked")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto libc_malloc = module.getOrInsertFunction(
+	    "malloc", llvm::FunctionType::get(ptr_type, {size_type}, false));
+	auto mmap_func = module.getOrInsertFunction(
+	    "mmap", llvm::FunctionType::get(
+	                ptr_type,
+	                {ptr_type, size_type, builder.getInt32Ty(),
+	                 builder.getInt32Ty(), builder.getInt32Ty(), size_type},
+	                false));
+	auto madvise_func = module.getOrInsertFunction(
+	    "madvise", llvm::FunctionType::get(
+	                   builder.getInt32Ty(),
+	                   {ptr_type, size_type, builder.getInt32Ty()}, false));
+	auto error_func = runtimeError();
+	if (options.stats) {
+		stats_malloc_count = createGlobal(size_type, "_stats_malloc_count");
+	}
+	auto *no_hugetlb = createGlobal(builder.getInt8Ty(), "_no_hugetlb");
+
+	// Large blocks are mapped directly, so that they are backed by huge
+	// pages and _string_grow() can remap them instead of copying them.
+	// Reserved huge pages are tried first, transparent ones after that.
+	// ---- C code ----
+	// char *_malloc_checked(size_t size) {
+	//   _stats_malloc_count++; // only with stats
+	//   char *ptr;
+	//   if (size < large_alloc_threshold) {
+	//     ptr = malloc(size);
+	//   } else {
+	//     size = round_up(size, huge_page_size);
+	//     ptr = MAP_FAILED;
+	//     if (!_no_hugetlb) {
+	//       ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	//                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	//       _no_hugetlb = ptr == MAP_FAILED;
+	//     }
+	//     if (ptr == MAP_FAILED) {
+	//       ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	//                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	//       if (ptr == MAP_FAILED) ptr = NULL;
+	//       else madvise(ptr, size, MADV_HUGEPAGE);
+	//     }
+	//   }
+	//   if (ptr == NULL) _runtime_error("out of memory");
+	//   return ptr;
+	// }
+	auto *func = beginFunction("_malloc_checked", ptr_type, {size_type});
+	auto *small = llvm::BasicBlock::Create(ctx, "small", func);
+	auto *large = llvm::BasicBlock::Create(ctx, "large", func);
+	auto *map_huge = llvm::BasicBlock::Create(ctx, "map_huge", func);
+	auto *check_huge = llvm::BasicBlock::Create(ctx, "check_huge", func);
+	auto *map = llvm::BasicBlock::Create(ctx, "map", func);
+	auto *advise = llvm::BasicBlock::Create(ctx, "advise", func);
+	auto *check = llvm::BasicBlock::Create(ctx, "check", func);
+	auto *fail = llvm::BasicBlock::Create(ctx, "fail", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	auto *size = func->getArg(0);
+	if (options.stats) {
+		// statements may allocate on several threads
+		builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, stats_malloc_count,
+		                        builder.getInt64(1), llvm::Align(8),
+		                        llvm::AtomicOrdering::Monotonic);
+	}
+	builder.CreateCondBr(
+	    builder.CreateICmpULT(size, builder.getInt64(large_alloc_threshold)),
+	    small, large,
+	    llvm::MDBuilder(ctx).createBranchWeights(1 << 20, 1));
+
+	builder.SetInsertPoint(small);
+	auto *small_ptr = builder.CreateCall(libc_malloc, {size}, "small_ptr");
+	builder.CreateBr(check);
+
+	builder.SetInsertPoint(large);
+	auto *mapped_size = genHugePageRound(size);
+	auto *map_failed = builder.CreateIntToPtr(builder.getInt64(-1), ptr_type);
+	auto gen_mmap = [&](int flags, const std::string &name) {
+		return builder.CreateCall(
+		    mmap_func, {llvm::ConstantPointerNull::get(ptr_type), mapped_size,
+		                builder.getInt32(PROT_READ | PROT_WRITE),
+		                builder.getInt32(MAP_PRIVATE | MAP_ANONYMOUS | flags),
+		                builder.getInt32(-1), builder.getInt64(0)},
+		    name);
+	};
+	// an atomic flag, as statements may allocate on several threads
+	auto *known_no_hugetlb = builder.CreateAlignedLoad(
+	    builder.getInt8Ty(), no_hugetlb, llvm::Align(1), "no_hugetlb");
+	known_no_hugetlb->setAtomic(llvm::AtomicOrdering::Monotonic);
+	builder.CreateCondBr(
+	    builder.CreateICmpNE(known_no_hugetlb, builder.getInt8(0)), map,
+	    map_huge);
+
+	builder.SetInsertPoint(map_huge);
+	auto *huge_ptr = gen_mmap(MAP_HUGETLB, "huge_ptr");
+	auto *huge_failed = builder.CreateICmpEQ(huge_ptr, map_failed);
+	builder.CreateAlignedStore(
+	    builder.CreateZExt(huge_failed, builder.getInt8Ty()), no_hugetlb,
+	    llvm::Align(1))
+	    ->setAtomic(llvm::AtomicOrdering::Monotonic);
+	builder.CreateCondBr(huge_failed, map, check_huge);
+
+	builder.SetInsertPoint(check_huge);
+	builder.CreateBr(check);
+
+	builder.SetInsertPoint(map);
+	auto *mapped_ptr = gen_mmap(0, "mapped_ptr");
+	builder.CreateCondBr(builder.CreateICmpEQ(mapped_ptr, map_failed), fail,
+	                     advise);
+
+	builder.SetInsertPoint(advise);
+	builder.CreateCall(madvise_func, {mapped_ptr, mapped_size,
+	                                  builder.getInt32(MADV_HUGEPAGE)});
+	builder.CreateBr(check);
+
+	builder.SetInsertPoint(check);
+	auto *ptr = builder.CreatePHI(ptr_type, 3, "ptr");
+	ptr->addIncoming(small_ptr, small);
+	ptr->addIncoming(huge_ptr, check_huge);
+	ptr->addIncoming(mapped_ptr, advise);
+	builder.CreateCondBr(builder.CreateIsNull(ptr), fail, done,
+	                     llvm::MDBuilder(ctx).createBranchWeights(1, 1 << 20));
+
+	builder.SetInsertPoint(fail);
+	builder.CreateCall(error_func,
+	                   {builder.CreateGlobalStringPtr("out of memory")});
+	builder.CreateUnreachable();
+
+	builder.SetInsertPoint(done);
+	builder.CreateRet(ptr);
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::freeSized() {
+	if (auto *func = module.getFunction("_free_sized")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto munmap_func = module.getOrInsertFunction(
+	    "munmap", llvm::FunctionType::get(builder.getInt32Ty(),
+	                                      {ptr_type, size_type}, false));
+
+	// ---- C code ----
+	// void _free_sized(char *ptr, size_t size) {
+	//   if (size < large_alloc_threshold) free(ptr);
+	//   else munmap(ptr, round_up(size, huge_page_size));
+	// }
+	auto *func = beginFunction("_free_sized", builder.getVoidTy(),
+	                           {ptr_type, size_type});
+	auto *small = llvm::BasicBlock::Create(ctx, "small", func);
+	auto *large = llvm::BasicBlock::Create(ctx, "large", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	auto *size = func->getArg(1);
+	builder.CreateCondBr(
+	    builder.CreateICmpULT(size, builder.getInt64(large_alloc_threshold)),
+	    small, large);
+
+	builder.SetInsertPoint(small);
+	builder.CreateCall(free(), {func->getArg(0)});
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(large);
+	builder.CreateCall(munmap_func, {func->getArg(0), genHugePageRound(size)});
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::runtimeError() {
+	if (auto *func = module.getFunction("_runtime_error")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+
+	auto flush_func = outFlush();
+
+	// ---- C code ----
+	// void _runtime_error(const char *msg) {
+	//   _out_flush();
+	//   fprintf(stderr, "runtime error: %s\n", msg);
+	//   exit(1);
+	// }
+	auto *func = beginFunction("_runtime_error", builder.getVoidTy(),
+	                           {builder.getInt8PtrTy()});
+	func->setDoesNotReturn();
+	func->addFnAttr(llvm::Attribute::Cold);
+	auto dprintf_func = module.getOrInsertFunction(
+	    "dprintf",
+	    llvm::FunctionType::get(builder.getInt32Ty(),
+	                            {builder.getInt32Ty(), builder.getInt8PtrTy()},
+	                            true));
+	auto exit_func = module.getOrInsertFunction(
+	    "exit", llvm::FunctionType::get(builder.getVoidTy(),
+	                                    {builder.getInt32Ty()}, false));
+	builder.CreateCall(flush_func);
+	auto *error_template =
+	    builder.CreateGlobalStringPtr("runtime error: %s\n", "_error_template");
+	builder.CreateCall(dprintf_func,
+	                   {builder.getInt32(2), error_template, func->getArg(0)});
+	builder.CreateCall(exit_func, {builder.getInt32(1)});
+	builder.CreateUnreachable();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::free() {
+	return module.getOrInsertFunction(
+	    "free", llvm::FunctionType::get(builder.getVoidTy(),
+	                                    {builder.getInt8PtrTy()}, false));
+}
+
+llvm::FunctionCallee LLVMRuntime::memcmp() {
+	return module.getOrInsertFunction(
+	    "memcmp",
+	    llvm::FunctionType::get(
+	        builder.getInt32Ty(),
+	        {builder.getInt8PtrTy(), builder.getInt8PtrTy(), builder.getInt64Ty()},
+	        false));
+}
+
+llvm::FunctionCallee LLVMRuntime::copyNontemporal() {
+	if (auto *func = module.getFunction("_copy_nontemporal")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *vector_type = llvm::FixedVectorType::get(builder.getInt8Ty(), 16);
+
+	// Streaming stores write whole cache lines around the cache, so dst is
+	// aligned to a cache line first.
+	// ---- C code ----
+	// void _copy_nontemporal(char *dst, const char *src, size_t n) {
+	//   size_t idx = min(-(uintptr_t)dst & 63, n);
+	//   memcpy(dst, src, idx);
+	//   for (; n - idx >= 64; idx += 64) {
+	//     for (int k = 0; k < 64; k += 16) // unrolled
+	//       __builtin_nontemporal_store(*(v16qi *)(src + idx + k),
+	//                                   (v16qi *)(dst + idx + k));
+	//   }
+	//   memcpy(dst + idx, src + idx, n - idx);
+	//   __sync_synchronize(); // orders the streaming stores
+	// }
+	auto *func = beginFunction("_copy_nontemporal", builder.getVoidTy(),
+	                           {ptr_type, ptr_type, size_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *loop = llvm::BasicBlock::Create(ctx, "loop", func);
+	auto *body = llvm::BasicBlock::Create(ctx, "body", func);
+	auto *tail = llvm::BasicBlock::Create(ctx, "tail", func);
+	auto *dst = func->getArg(0);
+	auto *src = func->getArg(1);
+	auto *n = func->getArg(2);
+	auto *misalign = builder.CreateAnd(
+	    builder.CreateNeg(builder.CreatePtrToInt(dst, size_type)),
+	    builder.getInt64(63), "misalign");
+	auto *head = builder.CreateBinaryIntrinsic(llvm::Intrinsic::umin,
+	                                           misalign, n, nullptr, "head");
+	builder.CreateMemCpy(dst, llvm::Align(1), src, llvm::Align(1), head);
+	builder.CreateBr(loop);
+
+	builder.SetInsertPoint(loop);
+	auto *idx = builder.CreatePHI(size_type, 2, "idx");
+	builder.CreateCondBr(
+	    builder.CreateICmpUGE(builder.CreateSub(n, idx), builder.getInt64(64)),
+	    body, tail);
+
+	builder.SetInsertPoint(body);
+	auto *nontemporal = llvm::MDNode::get(
+	    ctx, llvm::ConstantAsMetadata::get(builder.getInt32(1)));
+	for (uint64_t k = 0; k < 64; k += 16) {
+		auto *offset = builder.CreateAdd(idx, builder.getInt64(k));
+		auto *from = builder.CreatePointerCast(
+		    builder.CreateInBoundsGEP(builder.getInt8Ty(), src, offset),
+		    vector_type->getPointerTo());
+		auto *to = builder.CreatePointerCast(
+		    builder.CreateInBoundsGEP(builder.getInt8Ty(), dst, offset),
+		    vector_type->getPointerTo());
+		auto *chunk =
+		    builder.CreateAlignedLoad(vector_type, from, llvm::Align(1));
+		builder.CreateAlignedStore(chunk, to, llvm::Align(16))
+		    ->setMetadata(llvm::LLVMContext::MD_nontemporal, nontemporal);
+	}
+	auto *next_idx = builder.CreateAdd(idx, builder.getInt64(64), "next_idx");
+	builder.CreateBr(loop);
+	idx->addIncoming(head, entry);
+	idx->addIncoming(next_idx, body);
+
+	builder.SetInsertPoint(tail);
+	builder.CreateMemCpy(
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), dst, idx),
+	    llvm::Align(1),
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), src, idx),
+	    llvm::Align(1), builder.CreateSub(n, idx));
+	builder.CreateFence(llvm::AtomicOrdering::SequentiallyConsistent);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::StructType *LLVMRuntime::jobType() {
+	// struct job { void (*run)(void *); void *arg; }
+	auto *run_type = llvm::FunctionType::get(
+	    builder.getVoidTy(), {builder.getInt8PtrTy()}, false);
+	return llvm::StructType::get(
+	    ctx, {run_type->getPointerTo(), builder.getInt8PtrTy()});
+}
+
+llvm::FunctionCallee LLVMRuntime::pthreadFunction(const std::string &name,
+                                                  unsigned params) {
+	// int pthread_xxx(void *, ...) on mutexes and condition variables
+	return module.getOrInsertFunction(
+	    name, llvm::FunctionType::get(
+	              builder.getInt32Ty(),
+	              std::vector<llvm::Type *>(params, builder.getInt8PtrTy()),
+	              false));
+}
+
+void LLVMRuntime::genRunJob(llvm::Value *job) {
+	// ---- C code ----
+	// job->run(job->arg);
+	auto *job_type = jobType();
+	auto *run = builder.CreateLoad(job_type->getElementType(0),
+	                               builder.CreateStructGEP(job_type, job, 0),
+	                               "run");
+	auto *arg = builder.CreateLoad(job_type->getElementType(1),
+	                               builder.CreateStructGEP(job_type, job, 1),
+	                               "arg");
+	builder.CreateCall(
+	    llvm::FunctionCallee(llvm::cast<llvm::FunctionType>(
+	                             run->getType()->getPointerElementType()),
+	                         run),
+	    {arg});
+}
+
+// The workers sleep on _worker_wake until _worker_generation changes. Then
+// worker idx runs _worker_jobs[idx] unless it is empty, and the last one to
+// finish signals _worker_done. Everything is guarded by _worker_lock. The
+// pthread objects are zero-initialized, which is their static initializer
+// in glibc.
+
+llvm::Function *LLVMRuntime::genWorkerMain() {
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *jobs_type = llvm::ArrayType::get(jobType(), max_threads);
+	auto lock_func = pthreadFunction("pthread_mutex_lock", 1);
+	auto unlock_func = pthreadFunction("pthread_mutex_unlock", 1);
+	auto wait_func = pthreadFunction("pthread_cond_wait", 2);
+	auto signal_func = pthreadFunction("pthread_cond_signal", 1);
+	auto *lock = builder.CreatePointerCast(worker_lock, ptr_type);
+
+	// ---- C code ----
+	// void *_worker_main(void *arg) {
+	//   size_t idx = (size_t)arg;
+	//   uint64_t seen = 0;
+	//   pthread_mutex_lock(&_worker_lock);
+	//   for (;;) {
+	//     while (_worker_generation == seen && !_worker_quit)
+	//       pthread_cond_wait(&_worker_wake, &_worker_lock);
+	//     if (_worker_quit) break;
+	//     seen = _worker_generation;
+	//     struct job job = _worker_jobs[idx];
+	//     pthread_mutex_unlock(&_worker_lock);
+	//     if (job.run != NULL) job.run(job.arg);
+	//     pthread_mutex_lock(&_worker_lock);
+	//     if (--_worker_pending == 0) pthread_cond_signal(&_worker_done);
+	//   }
+	//   pthread_mutex_unlock(&_worker_lock);
+	//   return NULL;
+	// }
+	auto *func = beginFunction("_worker_main", ptr_type, {ptr_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *wait = llvm::BasicBlock::Create(ctx, "wait", func);
+	auto *check_generation =
+	    llvm::BasicBlock::Create(ctx, "check_generation", func);
+	auto *sleep = llvm::BasicBlock::Create(ctx, "sleep", func);
+	auto *work = llvm::BasicBlock::Create(ctx, "work", func);
+	auto *run = llvm::BasicBlock::Create(ctx, "run", func);
+	auto *ran = llvm::BasicBlock::Create(ctx, "ran", func);
+	auto *finish = llvm::BasicBlock::Create(ctx, "finish", func);
+	auto *quit = llvm::BasicBlock::Create(ctx, "quit", func);
+	auto *idx = builder.CreatePtrToInt(func->getArg(0), size_type, "idx");
+	builder.CreateCall(lock_func, {lock});
+	builder.CreateBr(wait);
+
+	builder.SetInsertPoint(wait);
+	auto *seen = builder.CreatePHI(size_type, 3, "seen");
+	auto *generation =
+	    builder.CreateLoad(size_type, worker_generation, "generation");
+	builder.CreateCondBr(
+	    builder.CreateLoad(builder.getInt1Ty(), worker_quit, "quitting"), quit,
+	    check_generation);
+
+	builder.SetInsertPoint(check_generation);
+	builder.CreateCondBr(builder.CreateICmpEQ(generation, seen), sleep, work);
+
+	builder.SetInsertPoint(sleep);
+	builder.CreateCall(
+	    wait_func, {builder.CreatePointerCast(worker_wake, ptr_type), lock});
+	builder.CreateBr(wait);
+
+	builder.SetInsertPoint(work);
+	auto *job = builder.CreateInBoundsGEP(jobs_type, worker_jobs,
+	                                      {builder.getInt64(0), idx}, "job");
+	auto *local_job = builder.CreateAlloca(jobType(), nullptr, "local_job");
+	builder.CreateStore(builder.CreateLoad(jobType(), job), local_job);
+	builder.CreateCall(unlock_func, {lock});
+	auto *run_ptr = builder.CreateLoad(
+	    jobType()->getElementType(0),
+	    builder.CreateStructGEP(jobType(), local_job, 0), "run_ptr");
+	builder.CreateCondBr(builder.CreateIsNull(run_ptr), ran, run);
+
+	builder.SetInsertPoint(run);
+	genRunJob(local_job);
+	builder.CreateBr(ran);
+
+	builder.SetInsertPoint(ran);
+	builder.CreateCall(lock_func, {lock});
+	auto *pending = builder.CreateSub(
+	    builder.CreateLoad(size_type, worker_pending), builder.getInt64(1),
+	    "pending");
+	builder.CreateStore(pending, worker_pending);
+	builder.CreateCondBr(builder.CreateICmpEQ(pending, builder.getInt64(0)),
+	                     finish, wait);
+
+	builder.SetInsertPoint(finish);
+	builder.CreateCall(signal_func,
+	                   {builder.CreatePointerCast(worker_done, ptr_type)});
+	builder.CreateBr(wait);
+	seen->addIncoming(builder.getInt64(0), entry);
+	seen->addIncoming(seen, sleep);
+	seen->addIncoming(generation, ran);
+	seen->addIncoming(generation, finish);
+
+	builder.SetInsertPoint(quit);
+	builder.CreateCall(unlock_func, {lock});
+	builder.CreateRet(llvm::ConstantPointerNull::get(ptr_type));
+	return func;
+}
+
+llvm::Function *LLVMRuntime::genWorkersStart() {
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *workers_type = llvm::ArrayType::get(size_type, max_threads);
+	auto *worker_func = genWorkerMain();
+	auto create_func = module.getOrInsertFunction(
+	    "pthread_create",
+	    llvm::FunctionType::get(builder.getInt32Ty(),
+	                            {size_type->getPointerTo(), ptr_type,
+	                             worker_func->getType(), ptr_type},
+	                            false));
+	auto getenv_func = module.getOrInsertFunction(
+	    "getenv", llvm::FunctionType::get(ptr_type, {ptr_type}, false));
+	auto atol_func = module.getOrInsertFunction(
+	    "atol", llvm::FunctionType::get(size_type, {ptr_type}, false));
+	auto sysconf_func = module.getOrInsertFunction(
+	    "sysconf", llvm::FunctionType::get(size_type, {builder.getInt32Ty()},
+	                                       false));
+
+	// Returns the number of threads including the calling one. The workers
+	// are started by the first call, before any other thread exists.
+	// ---- C code ----
+	// size_t _workers_start(void) {
+	//   if (_worker_count == 0) {
+	//     char *env = getenv("WORKER_THREADS");
+	//     long threads = env != NULL ? atol(env) : options.threads;
+	//     if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+	//     threads = clamp(threads, 1, max_threads);
+	//     size_t started = 1;
+	//     while (started < threads &&
+	//            pthread_create(&_workers[started], NULL, _worker_main,
+	//                           (void *)started) == 0)
+	//       started++;
+	//     _worker_count = started;
+	//   }
+	//   return _worker_count;
+	// }
+	auto *func = beginFunction("_workers_start", size_type, {});
+	auto *start = llvm::BasicBlock::Create(ctx, "start", func);
+	auto *parse_env = llvm::BasicBlock::Create(ctx, "parse_env", func);
+	auto *configure = llvm::BasicBlock::Create(ctx, "configure", func);
+	auto *start_loop = llvm::BasicBlock::Create(ctx, "start_loop", func);
+	auto *start_worker = llvm::BasicBlock::Create(ctx, "start_worker", func);
+	auto *started_worker =
+	    llvm::BasicBlock::Create(ctx, "started_worker", func);
+	auto *start_done = llvm::BasicBlock::Create(ctx, "start_done", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	builder.CreateCondBr(
+	    builder.CreateICmpEQ(builder.CreateLoad(size_type, worker_count),
+	                         builder.getInt64(0)),
+	    start, done);
+
+	builder.SetInsertPoint(start);
+	auto *env = builder.CreateCall(
+	    getenv_func, {builder.CreateGlobalStringPtr("WORKER_THREADS")}, "env");
+	builder.CreateCondBr(builder.CreateIsNull(env), configure, parse_env);
+
+	builder.SetInsertPoint(parse_env);
+	auto *env_threads = builder.CreateCall(atol_func, {env}, "env_threads");
+	builder.CreateBr(configure);
+
+	builder.SetInsertPoint(configure);
+	auto *requested = builder.CreatePHI(size_type, 2, "requested");
+	requested->addIncoming(builder.getInt64(options.threads), start);
+	requested->addIncoming(env_threads, parse_env);
+	auto *threads = builder.CreateSelect(
+	    builder.CreateICmpSLE(requested, builder.getInt64(0)),
+	    builder.CreateCall(sysconf_func,
+	                       {builder.getInt32(_SC_NPROCESSORS_ONLN)}),
+	    requested, "threads");
+	threads = builder.CreateBinaryIntrinsic(
+	    llvm::Intrinsic::smax,
+	    builder.CreateBinaryIntrinsic(llvm::Intrinsic::smin, threads,
+	                                  builder.getInt64(max_threads)),
+	    builder.getInt64(1), nullptr, "clamped_threads");
+	builder.CreateBr(start_loop);
+
+	builder.SetInsertPoint(start_loop);
+	auto *started = builder.CreatePHI(size_type, 2, "started");
+	started->addIncoming(builder.getInt64(1), configure);
+	builder.CreateCondBr(builder.CreateICmpULT(started, threads), start_worker,
+	                     start_done);
+
+	builder.SetInsertPoint(start_worker);
+	auto *worker = builder.CreateInBoundsGEP(
+	    workers_type, workers, {builder.getInt64(0), started}, "worker");
+	auto *created = builder.CreateCall(
+	    create_func, {worker, llvm::ConstantPointerNull::get(ptr_type),
+	                  worker_func, builder.CreateIntToPtr(started, ptr_type)});
+	builder.CreateCondBr(builder.CreateICmpEQ(created, builder.getInt32(0)),
+	                     started_worker, start_done);
+
+	builder.SetInsertPoint(started_worker);
+	started->addIncoming(
+	    builder.CreateAdd(started, builder.getInt64(1), "next_started"),
+	    started_worker);
+	builder.CreateBr(start_loop);
+
+	builder.SetInsertPoint(start_done);
+	builder.CreateStore(started, worker_count);
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRet(builder.CreateLoad(size_type, worker_count, "count"));
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::runJobs() {
+	if (auto *func = module.getFunction("_run_jobs")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *job_type = jobType();
+	auto *jobs_type = llvm::ArrayType::get(job_type, max_threads);
+	auto *workers_type = llvm::ArrayType::get(size_type, max_threads);
+	// as arrays of words, for their alignment
+	auto *mutex_type =
+	    llvm::ArrayType::get(size_type, (sizeof(pthread_mutex_t) + 7) / 8);
+	auto *cond_type =
+	    llvm::ArrayType::get(size_type, (sizeof(pthread_cond_t) + 7) / 8);
+	static_assert(sizeof(pthread_t) == 8, "pthread_t is stored in an i64");
+	worker_count = createGlobal(size_type, "_worker_count");
+	workers = createGlobal(workers_type, "_workers");
+	worker_jobs = createGlobal(jobs_type, "_worker_jobs");
+	worker_lock = createGlobal(mutex_type, "_worker_lock");
+	worker_wake = createGlobal(cond_type, "_worker_wake");
+	worker_done = createGlobal(cond_type, "_worker_done");
+	worker_generation = createGlobal(size_type, "_worker_generation");
+	worker_pending = createGlobal(size_type, "_worker_pending");
+	worker_quit = createGlobal(builder.getInt1Ty(), "_worker_quit");
+	workers_busy = createGlobal(builder.getInt8Ty(), "_workers_busy");
+	auto *start_func = genWorkersStart();
+	auto lock_func = pthreadFunction("pthread_mutex_lock", 1);
+	auto unlock_func = pthreadFunction("pthread_mutex_unlock", 1);
+	auto wait_func = pthreadFunction("pthread_cond_wait", 2);
+	auto broadcast_func = pthreadFunction("pthread_cond_broadcast", 1);
+
+	// The workers run one batch of jobs at a time. A job which runs jobs
+	// itself, or a thread which finds the workers busy, runs them alone.
+	// ---- C code ----
+	// void _run_jobs(struct job *jobs, size_t count) {
+	//   if (count <= 1 || atomic_exchange(&_workers_busy, 1)) {
+	//     for (size_t idx = 0; idx < count; idx++)
+	//       jobs[idx].run(jobs[idx].arg);
+	//     return;
+	//   }
+	//   size_t threads = _workers_start();
+	//   pthread_mutex_lock(&_worker_lock);
+	//   for (size_t idx = 1; idx < threads; idx++)
+	//     _worker_jobs[idx] = idx < count ? jobs[idx] : (struct job){0};
+	//   _worker_pending = threads - 1;
+	//   _worker_generation++;
+	//   pthread_cond_broadcast(&_worker_wake);
+	//   pthread_mutex_unlock(&_worker_lock);
+	//   jobs[0].run(jobs[0].arg);
+	//   for (size_t idx = threads; idx < count; idx++)
+	//     jobs[idx].run(jobs[idx].arg);
+	//   pthread_mutex_lock(&_worker_lock);
+	//   while (_worker_pending != 0)
+	//     pthread_cond_wait(&_worker_done, &_worker_lock);
+	//   pthread_mutex_unlock(&_worker_lock);
+	//   atomic_store(&_workers_busy, 0);
+	// }
+	auto *func = beginFunction("_run_jobs", builder.getVoidTy(),
+	                           {job_type->getPointerTo(), size_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *try_acquire = llvm::BasicBlock::Create(ctx, "try_acquire", func);
+	auto *parallel = llvm::BasicBlock::Create(ctx, "parallel", func);
+	auto *assign_loop = llvm::BasicBlock::Create(ctx, "assign_loop", func);
+	auto *assign = llvm::BasicBlock::Create(ctx, "assign", func);
+	auto *dispatch = llvm::BasicBlock::Create(ctx, "dispatch", func);
+	auto *rest_loop = llvm::BasicBlock::Create(ctx, "rest_loop", func);
+	auto *rest = llvm::BasicBlock::Create(ctx, "rest", func);
+	auto *join = llvm::BasicBlock::Create(ctx, "join", func);
+	auto *join_loop = llvm::BasicBlock::Create(ctx, "join_loop", func);
+	auto *join_wait = llvm::BasicBlock::Create(ctx, "join_wait", func);
+	auto *joined = llvm::BasicBlock::Create(ctx, "joined", func);
+	auto *alone_loop = llvm::BasicBlock::Create(ctx, "alone_loop", func);
+	auto *alone = llvm::BasicBlock::Create(ctx, "alone", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	auto *jobs = func->getArg(0);
+	auto *count = func->getArg(1);
+	auto *lock = builder.CreatePointerCast(worker_lock, ptr_type);
+	builder.CreateCondBr(builder.CreateICmpULE(count, builder.getInt64(1)),
+	                     alone_loop, try_acquire);
+
+	builder.SetInsertPoint(try_acquire);
+	auto *was_busy = builder.CreateAtomicRMW(
+	    llvm::AtomicRMWInst::Xchg, workers_busy, builder.getInt8(1),
+	    llvm::Align(1), llvm::AtomicOrdering::Acquire);
+	builder.CreateCondBr(builder.CreateICmpNE(was_busy, builder.getInt8(0)),
+	                     alone_loop, parallel);
+
+	builder.SetInsertPoint(parallel);
+	auto *threads = builder.CreateCall(start_func, {}, "threads");
+	builder.CreateCall(lock_func, {lock});
+	builder.CreateBr(assign_loop);
+
+	builder.SetInsertPoint(assign_loop);
+	auto *idx = builder.CreatePHI(size_type, 2, "idx");
+	idx->addIncoming(builder.getInt64(1), parallel);
+	builder.CreateCondBr(builder.CreateICmpULT(idx, threads), assign,
+	                     dispatch);
+
+	builder.SetInsertPoint(assign);
+	auto *job = builder.CreateSelect(
+	    builder.CreateICmpULT(idx, count),
+	    builder.CreateLoad(job_type,
+	                       builder.CreateInBoundsGEP(job_type, jobs, idx)),
+	    llvm::Constant::getNullValue(job_type), "job");
+	builder.CreateStore(job, builder.CreateInBoundsGEP(
+	                             jobs_type, worker_jobs,
+	                             {builder.getInt64(0), idx}));
+	idx->addIncoming(builder.CreateAdd(idx, builder.getInt64(1), "next_idx"),
+	                 assign);
+	builder.CreateBr(assign_loop);
+
+	builder.SetInsertPoint(dispatch);
+	builder.CreateStore(builder.CreateSub(threads, builder.getInt64(1)),
+	                    worker_pending);
+	builder.CreateStore(
+	    builder.CreateAdd(builder.CreateLoad(size_type, worker_generation),
+	                      builder.getInt64(1)),
+	    worker_generation);
+	builder.CreateCall(broadcast_func,
+	                   {builder.CreatePointerCast(worker_wake, ptr_type)});
+	builder.CreateCall(unlock_func, {lock});
+	genRunJob(jobs);
+	builder.CreateBr(rest_loop);
+
+	builder.SetInsertPoint(rest_loop);
+	auto *rest_idx = builder.CreatePHI(size_type, 2, "rest_idx");
+	rest_idx->addIncoming(threads, dispatch);
+	builder.CreateCondBr(builder.CreateICmpULT(rest_idx, count), rest, join);
+
+	builder.SetInsertPoint(rest);
+	genRunJob(builder.CreateInBoundsGEP(job_type, jobs, rest_idx));
+	rest_idx->addIncoming(
+	    builder.CreateAdd(rest_idx, builder.getInt64(1), "next_rest_idx"),
+	    builder.GetInsertBlock());
+	builder.CreateBr(rest_loop);
+
+	builder.SetInsertPoint(join);
+	builder.CreateCall(lock_func, {lock});
+	builder.CreateBr(join_loop);
+
+	builder.SetInsertPoint(join_loop);
+	builder.CreateCondBr(
+	    builder.CreateICmpEQ(builder.CreateLoad(size_type, worker_pending),
+	                         builder.getInt64(0)),
+	    joined, join_wait);
+
+	builder.SetInsertPoint(join_wait);
+	builder.CreateCall(
+	    wait_func, {builder.CreatePointerCast(worker_done, ptr_type), lock});
+	builder.CreateBr(join_loop);
+
+	builder.SetInsertPoint(joined);
+	builder.CreateCall(unlock_func, {lock});
+	builder.CreateAlignedStore(builder.getInt8(0), workers_busy,
+	                           llvm::Align(1))
+	    ->setAtomic(llvm::AtomicOrdering::Release);
+	builder.CreateRetVoid();
+
+	builder.SetInsertPoint(alone_loop);
+	auto *alone_idx = builder.CreatePHI(size_type, 3, "alone_idx");
+	alone_idx->addIncoming(builder.getInt64(0), entry);
+	alone_idx->addIncoming(builder.getInt64(0), try_acquire);
+	builder.CreateCondBr(builder.CreateICmpULT(alone_idx, count), alone,
+	                     done);
+
+	builder.SetInsertPoint(alone);
+	genRunJob(builder.CreateInBoundsGEP(job_type, jobs, alone_idx));
+	alone_idx->addIncoming(
+	    builder.CreateAdd(alone_idx, builder.getInt64(1), "next_alone_idx"),
+	    builder.GetInsertBlock());
+	builder.CreateBr(alone_loop);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::StructType *LLVMRuntime::copyPartType() {
+	// struct copy_part {
+	//   char *dst; const char *src; size_t n; bool streaming;
+	// }
+	return llvm::StructType::get(
+	    ctx, {builder.getInt8PtrTy(), builder.getInt8PtrTy(),
+	          builder.getInt64Ty(), builder.getInt1Ty()});
+}
+
+void LLVMRuntime::genCopyPart(llvm::Value *dst, llvm::Value *src,
+                              llvm::Value *n, llvm::Value *streaming) {
+	// ---- C code ----
+	// if (streaming) _copy_nontemporal(dst, src, n);
+	// else memcpy(dst, src, n);
+	auto *func = builder.GetInsertBlock()->getParent();
+	auto *stream = llvm::BasicBlock::Create(ctx, "copy_stream", func);
+	auto *plain = llvm::BasicBlock::Create(ctx, "copy_plain", func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "copy_cont", func);
+	builder.CreateCondBr(streaming, stream, plain);
+
+	builder.SetInsertPoint(stream);
+	builder.CreateCall(copyNontemporal(), {dst, src, n});
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(plain);
+	builder.CreateMemCpy(dst, llvm::Align(1), src, llvm::Align(1), n);
+	builder.CreateBr(cont);
+
+	builder.SetInsertPoint(cont);
+}
+
+llvm::FunctionCallee LLVMRuntime::copyBulk() {
+	if (auto *func = module.getFunction("_copy_bulk")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *job_type = jobType();
+	auto *part_type = copyPartType();
+	auto run_func = runJobs();
+	auto *start_func = module.getFunction("_workers_start");
+
+	// ---- C code ----
+	// void _copy_part(void *arg) {
+	//   struct copy_part *part = arg;
+	//   copy_part(part->dst, part->src, part->n, part->streaming);
+	// }
+	auto *part_func =
+	    beginFunction("_copy_part", builder.getVoidTy(), {ptr_type});
+	auto *part_arg = builder.CreatePointerCast(part_func->getArg(0),
+	                                           part_type->getPointerTo());
+	auto part_field = [&](int field, const std::string &name) {
+		return builder.CreateLoad(
+		    part_type->getElementType(field),
+		    builder.CreateStructGEP(part_type, part_arg, field), name);
+	};
+	genCopyPart(part_field(0, "dst"), part_field(1, "src"),
+	            part_field(2, "n"), part_field(3, "streaming"));
+	builder.CreateRetVoid();
+
+	// ---- C code ----
+	// void _copy_bulk(char *dst, const char *src, size_t n) {
+	//   bool streaming = n >= nontemporal_copy_threshold;
+	//   size_t parts = n / parallel_copy_min_part;
+	//   if (parts > 1) parts = min(parts, _workers_start());
+	//   if (parts <= 1) {
+	//     copy_part(dst, src, n, streaming);
+	//     return;
+	//   }
+	//   size_t part = round_up(n / parts, 64);
+	//   struct copy_part copies[max_threads];
+	//   struct job jobs[max_threads];
+	//   for (size_t idx = 0; idx < parts; idx++) {
+	//     size_t start = min(idx * part, n);
+	//     copies[idx] = (struct copy_part){
+	//         dst + start, src + start, min(part, n - start), streaming};
+	//     jobs[idx] = (struct job){_copy_part, &copies[idx]};
+	//   }
+	//   _run_jobs(jobs, parts);
+	// }
+	auto *func = beginFunction("_copy_bulk", builder.getVoidTy(),
+	                           {ptr_type, ptr_type, size_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *count_threads = llvm::BasicBlock::Create(ctx, "count_threads", func);
+	auto *split = llvm::BasicBlock::Create(ctx, "split", func);
+	auto *single = llvm::BasicBlock::Create(ctx, "single", func);
+	auto *parallel = llvm::BasicBlock::Create(ctx, "parallel", func);
+	auto *assign_loop = llvm::BasicBlock::Create(ctx, "assign_loop", func);
+	auto *assign = llvm::BasicBlock::Create(ctx, "assign", func);
+	auto *run = llvm::BasicBlock::Create(ctx, "run", func);
+	auto *dst = func->getArg(0);
+	auto *src = func->getArg(1);
+	auto *n = func->getArg(2);
+	auto *copies = builder.CreateAlloca(
+	    llvm::ArrayType::get(part_type, max_threads), nullptr, "copies");
+	auto *jobs = builder.CreateAlloca(
+	    llvm::ArrayType::get(job_type, max_threads), nullptr, "jobs");
+	auto *streaming = builder.CreateICmpUGE(
+	    n, builder.getInt64(nontemporalCopyThreshold()), "streaming");
+	auto *parts = builder.CreateUDiv(
+	    n, builder.getInt64(parallel_copy_min_part), "parts");
+	builder.CreateCondBr(builder.CreateICmpUGT(parts, builder.getInt64(1)),
+	                     count_threads, split);
+
+	builder.SetInsertPoint(count_threads);
+	auto *threads = builder.CreateCall(start_func, {}, "threads");
+	auto *thread_parts = builder.CreateBinaryIntrinsic(
+	    llvm::Intrinsic::umin, parts, threads, nullptr, "thread_parts");
+	builder.CreateBr(split);
+
+	builder.SetInsertPoint(split);
+	auto *used_parts = builder.CreatePHI(size_type, 2, "used_parts");
+	used_parts->addIncoming(parts, entry);
+	used_parts->addIncoming(thread_parts, count_threads);
+	builder.CreateCondBr(
+	    builder.CreateICmpUGT(used_parts, builder.getInt64(1)), parallel,
+	    single);
+
+	builder.SetInsertPoint(single);
+	genCopyPart(dst, src, n, streaming);
+	builder.CreateRetVoid();
+
+	builder.SetInsertPoint(parallel);
+	auto *part = builder.CreateAnd(
+	    builder.CreateAdd(builder.CreateUDiv(n, used_parts),
+	                      builder.getInt64(63)),
+	    builder.getInt64(~uint64_t(63)), "part");
+	builder.CreateBr(assign_loop);
+
+	builder.SetInsertPoint(assign_loop);
+	auto *idx = builder.CreatePHI(size_type, 2, "idx");
+	idx->addIncoming(builder.getInt64(0), parallel);
+	builder.CreateCondBr(builder.CreateICmpULT(idx, used_parts), assign, run);
+
+	builder.SetInsertPoint(assign);
+	auto *offset = builder.CreateBinaryIntrinsic(
+	    llvm::Intrinsic::umin, builder.CreateMul(idx, part), n, nullptr,
+	    "offset");
+	auto *copy = builder.CreateInBoundsGEP(
+	    copies->getAllocatedType(), copies, {builder.getInt64(0), idx},
+	    "copy");
+	builder.CreateStore(
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), dst, offset),
+	    builder.CreateStructGEP(part_type, copy, 0));
+	builder.CreateStore(
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), src, offset),
+	    builder.CreateStructGEP(part_type, copy, 1));
+	builder.CreateStore(
+	    builder.CreateBinaryIntrinsic(llvm::Intrinsic::umin, part,
+	                                  builder.CreateSub(n, offset)),
+	    builder.CreateStructGEP(part_type, copy, 2));
+	builder.CreateStore(streaming, builder.CreateStructGEP(part_type, copy, 3));
+	auto *job = builder.CreateInBoundsGEP(
+	    jobs->getAllocatedType(), jobs, {builder.getInt64(0), idx}, "job");
+	builder.CreateStore(part_func, builder.CreateStructGEP(job_type, job, 0));
+	builder.CreateStore(builder.CreatePointerCast(copy, ptr_type),
+	                    builder.CreateStructGEP(job_type, job, 1));
+	idx->addIncoming(builder.CreateAdd(idx, builder.getInt64(1), "next_idx"),
+	                 assign);
+	builder.CreateBr(assign_loop);
+
+	builder.SetInsertPoint(run);
+	builder.CreateCall(run_func,
+	                   {builder.CreateInBoundsGEP(jobs->getAllocatedType(),
+	                                              jobs,
+	                                              {builder.getInt64(0),
+	                                               builder.getInt64(0)}),
+	                    used_parts});
+	builder.CreateRetVoid();
+	return func;
+}
+
+void LLVMRuntime::genWorkersStop() {
+	// ---- C code ----
+	// pthread_mutex_lock(&_worker_lock);
+	// _worker_quit = true;
+	// pthread_cond_broadcast(&_worker_wake);
+	// pthread_mutex_unlock(&_worker_lock);
+	// for (size_t idx = 1; idx < _worker_count; idx++)
+	//   pthread_join(_workers[idx], NULL);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *workers_type = llvm::ArrayType::get(size_type, max_threads);
+	auto join_func = module.getOrInsertFunction(
+	    "pthread_join", llvm::FunctionType::get(builder.getInt32Ty(),
+	                                            {size_type, ptr_type}, false));
+	auto *lock = builder.CreatePointerCast(worker_lock, ptr_type);
+	auto *entry = builder.GetInsertBlock();
+	auto *func = entry->getParent();
+	auto *loop = llvm::BasicBlock::Create(ctx, "join_worker_loop", func);
+	auto *join = llvm::BasicBlock::Create(ctx, "join_worker", func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "join_worker_cont", func);
+	builder.CreateCall(pthreadFunction("pthread_mutex_lock", 1), {lock});
+	builder.CreateStore(builder.getTrue(), worker_quit);
+	builder.CreateCall(pthreadFunction("pthread_cond_broadcast", 1),
+	                   {builder.CreatePointerCast(worker_wake, ptr_type)});
+	builder.CreateCall(pthreadFunction("pthread_mutex_unlock", 1), {lock});
+	auto *threads = builder.CreateLoad(size_type, worker_count, "threads");
+	builder.CreateBr(loop);
+
+	builder.SetInsertPoint(loop);
+	auto *idx = builder.CreatePHI(size_type, 2, "idx");
+	idx->addIncoming(builder.getInt64(1), entry);
+	builder.CreateCondBr(builder.CreateICmpULT(idx, threads), join, cont);
+
+	builder.SetInsertPoint(join);
+	auto *worker = builder.CreateLoad(
+	    size_type,
+	    builder.CreateInBoundsGEP(workers_type, workers,
+	                              {builder.getInt64(0), idx}),
+	    "worker");
+	builder.CreateCall(join_func,
+	                   {worker, llvm::ConstantPointerNull::get(ptr_type)});
+	idx->addIncoming(builder.CreateAdd(idx, builder.getInt64(1), "next_idx"),
+	                 join);
+	builder.CreateBr(loop);
+
+	builder.SetInsertPoint(cont);
+}
+
+// An arena chunk is laid out as
+//   struct chunk {
+//     struct chunk *prev;
+//     size_t cap;
+//     char data[cap];
+//   };
+// and the chunks in use form a list through prev.
+
+llvm::FunctionCallee LLVMRuntime::arenaAlloc() {
+	if (auto *func = module.getFunction("_arena_alloc")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	arena_chunk = createGlobal(ptr_type, "_arena_chunk");
+	arena_ptr = createGlobal(ptr_type, "_arena_ptr");
+	arena_end = createGlobal(ptr_type, "_arena_end");
+	arena_total = createGlobal(size_type, "_arena_total");
+	auto malloc_func = malloc();
+
+	// ---- C code ----
+	// char *_arena_alloc(size_t size) {
+	//   size = (size + 7) & ~7;
+	//   if (_arena_end - _arena_ptr < size) {
+	//     size_t cap = size > arena_chunk_size ? size : arena_chunk_size;
+	//     struct chunk *chunk = malloc(sizeof(struct chunk) + cap);
+	//     chunk->prev = _arena_chunk;
+	//     chunk->cap = cap;
+	//     _arena_chunk = chunk;
+	//     _arena_total += cap;
+	//     _arena_ptr = chunk->data;
+	//     _arena_end = chunk->data + cap;
+	//   }
+	//   char *result = _arena_ptr;
+	//   _arena_ptr += size;
+	//   return result;
+	// }
+	auto *func = beginFunction("_arena_alloc", ptr_type, {size_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *grow = llvm::BasicBlock::Create(ctx, "grow", func);
+	auto *bump = llvm::BasicBlock::Create(ctx, "bump", func);
+	auto *size = builder.CreateAnd(
+	    builder.CreateAdd(func->getArg(0), builder.getInt64(7)),
+	    builder.getInt64(~uint64_t(7)), "size");
+	auto *ptr = builder.CreateLoad(ptr_type, arena_ptr, "ptr");
+	auto *end = builder.CreateLoad(ptr_type, arena_end, "end");
+	auto *avail = builder.CreateSub(builder.CreatePtrToInt(end, size_type),
+	                                builder.CreatePtrToInt(ptr, size_type),
+	                                "avail");
+	auto *fits = builder.CreateICmpULE(size, avail, "fits");
+	builder.CreateCondBr(fits, bump, grow);
+
+	builder.SetInsertPoint(grow);
+	auto *cap = builder.CreateSelect(
+	    builder.CreateICmpUGT(size, builder.getInt64(arena_chunk_size)), size,
+	    builder.getInt64(arena_chunk_size), "cap");
+	auto *chunk = builder.CreateCall(
+	    malloc_func, {builder.CreateAdd(cap, builder.getInt64(16))}, "chunk");
+	builder.CreateStore(builder.CreateLoad(ptr_type, arena_chunk),
+	                    builder.CreatePointerCast(chunk, ptr_type->getPointerTo()));
+	auto *cap_ptr = builder.CreatePointerCast(
+	    builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), chunk, 8),
+	    size_type->getPointerTo());
+	builder.CreateStore(cap, cap_ptr);
+	builder.CreateStore(chunk, arena_chunk);
+	builder.CreateStore(
+	    builder.CreateAdd(builder.CreateLoad(size_type, arena_total), cap),
+	    arena_total);
+	auto *data =
+	    builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), chunk, 16);
+	builder.CreateStore(
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), data, cap), arena_end);
+	builder.CreateBr(bump);
+
+	builder.SetInsertPoint(bump);
+	auto *result = builder.CreatePHI(ptr_type, 2, "result");
+	result->addIncoming(ptr, entry);
+	result->addIncoming(data, grow);
+	builder.CreateStore(
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), result, size),
+	    arena_ptr);
+	builder.CreateRet(result);
+	return func;
+}
+
+void LLVMRuntime::genArenaFreeChunks() {
+	// ---- C code ----
+	// for (struct chunk *chunk = _arena_chunk; chunk != NULL;) {
+	//   struct chunk *prev = chunk->prev;
+	//   _free_sized(chunk, sizeof(struct chunk) + chunk->cap);
+	//   chunk = prev;
+	// }
+	// _arena_chunk = NULL;
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *entry = builder.GetInsertBlock();
+	auto *func = entry->getParent();
+	auto *loop = llvm::BasicBlock::Create(ctx, "free_chunks", func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "free_chunks_cont", func);
+	auto *first = builder.CreateLoad(ptr_type, arena_chunk, "first");
+	builder.CreateCondBr(builder.CreateIsNull(first), cont, loop);
+
+	builder.SetInsertPoint(loop);
+	auto *chunk = builder.CreatePHI(ptr_type, 2, "chunk");
+	auto *prev = builder.CreateLoad(
+	    ptr_type, builder.CreatePointerCast(chunk, ptr_type->getPointerTo()),
+	    "prev");
+	auto *cap = builder.CreateLoad(
+	    size_type,
+	    builder.CreatePointerCast(
+	        builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), chunk, 8),
+	        size_type->getPointerTo()),
+	    "cap");
+	builder.CreateCall(freeSized(),
+	                   {chunk, builder.CreateAdd(cap, builder.getInt64(16))});
+	builder.CreateCondBr(builder.CreateIsNull(prev), cont, loop);
+	chunk->addIncoming(first, entry);
+	chunk->addIncoming(prev, loop);
+
+	builder.SetInsertPoint(cont);
+	builder.CreateStore(llvm::ConstantPointerNull::get(ptr_type), arena_chunk);
+}
+
+llvm::FunctionCallee LLVMRuntime::arenaReset() {
+	if (auto *func = module.getFunction("_arena_reset")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto malloc_func = malloc();
+	arenaAlloc();
+
+	// ---- C code ----
+	// void _arena_reset() {
+	//   if (_arena_chunk == NULL) return;
+	//   if (_arena_chunk->prev != NULL) {
+	//     // several chunks were needed, replace them with one chunk which
+	//     // is large enough, so that the next round needs no malloc
+	//     (free all chunks)
+	//     _arena_chunk = malloc(sizeof(struct chunk) + _arena_total);
+	//     _arena_chunk->prev = NULL;
+	//     _arena_chunk->cap = _arena_total;
+	//   }
+	//   _arena_ptr = _arena_chunk->data;
+	//   _arena_end = _arena_chunk->data + _arena_chunk->cap;
+	// }
+	auto *func = beginFunction("_arena_reset", builder.getVoidTy(), {});
+	auto *check_prev = llvm::BasicBlock::Create(ctx, "check_prev", func);
+	auto *coalesce = llvm::BasicBlock::Create(ctx, "coalesce", func);
+	auto *rewind = llvm::BasicBlock::Create(ctx, "rewind", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	auto *chunk = builder.CreateLoad(ptr_type, arena_chunk, "chunk");
+	builder.CreateCondBr(builder.CreateIsNull(chunk), done, check_prev);
+
+	builder.SetInsertPoint(check_prev);
+	auto *prev = builder.CreateLoad(
+	    ptr_type, builder.CreatePointerCast(chunk, ptr_type->getPointerTo()),
+	    "prev");
+	builder.CreateCondBr(builder.CreateIsNull(prev), rewind, coalesce);
+
+	builder.SetInsertPoint(coalesce);
+	genArenaFreeChunks();
+	auto *total = builder.CreateLoad(size_type, arena_total, "total");
+	auto *merged = builder.CreateCall(
+	    malloc_func, {builder.CreateAdd(total, builder.getInt64(16))},
+	    "merged");
+	builder.CreateStore(
+	    llvm::ConstantPointerNull::get(ptr_type),
+	    builder.CreatePointerCast(merged, ptr_type->getPointerTo()));
+	builder.CreateStore(
+	    total, builder.CreatePointerCast(
+	               builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(),
+	                                                  merged, 8),
+	               size_type->getPointerTo()));
+	builder.CreateStore(merged, arena_chunk);
+	auto *coalesce_end = builder.GetInsertBlock();
+	builder.CreateBr(rewind);
+
+	builder.SetInsertPoint(rewind);
+	auto *current = builder.CreatePHI(ptr_type, 2, "current");
+	current->addIncoming(chunk, check_prev);
+	current->addIncoming(merged, coalesce_end);
+	auto *cap = builder.CreateLoad(
+	    size_type,
+	    builder.CreatePointerCast(
+	        builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), current, 8),
+	        size_type->getPointerTo()),
+	    "cap");
+	auto *data =
+	    builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), current, 16);
+	builder.CreateStore(data, arena_ptr);
+	builder.CreateStore(
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), data, cap), arena_end);
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRetVoid();
+	return func;
+}
+
+void LLVMRuntime::genArenaRelease() {
+	auto *ptr_type = builder.getInt8PtrTy();
+	genArenaFreeChunks();
+	builder.CreateStore(llvm::ConstantPointerNull::get(ptr_type), arena_ptr);
+	builder.CreateStore(llvm::ConstantPointerNull::get(ptr_type), arena_end);
+	builder.CreateStore(builder.getInt64(0), arena_total);
+}
+
+// A pool block is preceded by an 8-byte header holding its size class.
+// Free blocks of each class are kept in a list linked through their first
+// word. A block too large for the pool holds its size instead, which is at
+// least pool_classes, and is handed back to _free_sized directly.
+
+llvm::FunctionCallee LLVMRuntime::poolAlloc() {
+	if (auto *func = module.getFunction("_pool_alloc")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *lists_type = llvm::ArrayType::get(ptr_type, pool_classes);
+	pool_free_lists = createGlobal(lists_type, "_pool_free_lists");
+	auto malloc_func = malloc();
+
+	// ---- C code ----
+	// char *_pool_alloc(size_t size) {
+	//   size_t need = size + 8;
+	//   size_t cls = 0;
+	//   while ((pool_min_size << cls) < need) {
+	//     if (++cls == pool_classes) {
+	//       block = malloc(need);
+	//       cls = need;
+	//       goto done;
+	//     }
+	//   }
+	//   if (_pool_free_lists[cls] != NULL) {
+	//     block = _pool_free_lists[cls];
+	//     _pool_free_lists[cls] = *(void **)block;
+	//   } else {
+	//     block = malloc(pool_min_size << cls);
+	//   }
+	// done:
+	//   *(size_t *)block = cls;
+	//   return block + 8;
+	// }
+	auto *func = beginFunction("_pool_alloc", ptr_type, {size_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *loop = llvm::BasicBlock::Create(ctx, "find_class", func);
+	auto *next_class = llvm::BasicBlock::Create(ctx, "next_class", func);
+	auto *found = llvm::BasicBlock::Create(ctx, "found", func);
+	auto *reuse = llvm::BasicBlock::Create(ctx, "reuse", func);
+	auto *fresh = llvm::BasicBlock::Create(ctx, "fresh", func);
+	auto *large = llvm::BasicBlock::Create(ctx, "large", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	auto *need =
+	    builder.CreateAdd(func->getArg(0), builder.getInt64(8), "need");
+	builder.CreateBr(loop);
+
+	builder.SetInsertPoint(loop);
+	auto *cls = builder.CreatePHI(size_type, 2, "cls");
+	auto *cap = builder.CreateShl(builder.getInt64(pool_min_size), cls, "cap");
+	builder.CreateCondBr(builder.CreateICmpUGE(cap, need), found, next_class);
+
+	builder.SetInsertPoint(next_class);
+	auto *next_cls = builder.CreateAdd(cls, builder.getInt64(1), "next_cls");
+	builder.CreateCondBr(
+	    builder.CreateICmpEQ(next_cls, builder.getInt64(pool_classes)), large,
+	    loop);
+	cls->addIncoming(builder.getInt64(0), entry);
+	cls->addIncoming(next_cls, next_class);
+
+	builder.SetInsertPoint(found);
+	auto *head_ptr = builder.CreateInBoundsGEP(
+	    lists_type, pool_free_lists, {builder.getInt64(0), cls}, "head_ptr");
+	auto *head = builder.CreateLoad(ptr_type, head_ptr, "head");
+	builder.CreateCondBr(builder.CreateIsNull(head), fresh, reuse);
+
+	builder.SetInsertPoint(reuse);
+	auto *next = builder.CreateLoad(
+	    ptr_type, builder.CreatePointerCast(head, ptr_type->getPointerTo()),
+	    "next");
+	builder.CreateStore(next, head_ptr);
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(fresh);
+	auto *fresh_block = builder.CreateCall(malloc_func, {cap}, "fresh_block");
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(large);
+	auto *large_block = builder.CreateCall(malloc_func, {need}, "large_block");
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	auto *block = builder.CreatePHI(ptr_type, 3, "block");
+	block->addIncoming(head, reuse);
+	block->addIncoming(fresh_block, fresh);
+	block->addIncoming(large_block, large);
+	auto *block_cls = builder.CreatePHI(size_type, 3, "block_cls");
+	block_cls->addIncoming(cls, reuse);
+	block_cls->addIncoming(cls, fresh);
+	block_cls->addIncoming(need, large);
+	builder.CreateStore(
+	    block_cls, builder.CreatePointerCast(block, size_type->getPointerTo()));
+	builder.CreateRet(
+	    builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), block, 8));
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::poolFree() {
+	if (auto *func = module.getFunction("_pool_free")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *lists_type = llvm::ArrayType::get(ptr_type, pool_classes);
+	poolAlloc();
+
+	// ---- C code ----
+	// void _pool_free(char *str) {
+	//   if (str == NULL) return;
+	//   char *block = str - 8;
+	//   size_t cls = *(size_t *)block;
+	//   if (cls >= pool_classes) {
+	//     _free_sized(block, cls);
+	//   } else {
+	//     *(void **)block = _pool_free_lists[cls];
+	//     _pool_free_lists[cls] = block;
+	//   }
+	// }
+	auto *func = beginFunction("_pool_free", builder.getVoidTy(), {ptr_type});
+	auto *not_null = llvm::BasicBlock::Create(ctx, "not_null", func);
+	auto *large = llvm::BasicBlock::Create(ctx, "large", func);
+	auto *pooled = llvm::BasicBlock::Create(ctx, "pooled", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	builder.CreateCondBr(builder.CreateIsNull(func->getArg(0)), done,
+	                     not_null);
+
+	builder.SetInsertPoint(not_null);
+	auto *block = builder.CreateConstInBoundsGEP1_64(
+	    builder.getInt8Ty(), func->getArg(0), -8, "block");
+	auto *cls = builder.CreateLoad(
+	    size_type, builder.CreatePointerCast(block, size_type->getPointerTo()),
+	    "cls");
+	builder.CreateCondBr(
+	    builder.CreateICmpUGE(cls, builder.getInt64(pool_classes)), large,
+	    pooled);
+
+	builder.SetInsertPoint(large);
+	builder.CreateCall(freeSized(), {block, cls});
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(pooled);
+	auto *head_ptr = builder.CreateInBoundsGEP(
+	    lists_type, pool_free_lists, {builder.getInt64(0), cls}, "head_ptr");
+	builder.CreateStore(
+	    builder.CreateLoad(ptr_type, head_ptr),
+	    builder.CreatePointerCast(block, ptr_type->getPointerTo()));
+	builder.CreateStore(block, head_ptr);
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRetVoid();
+	return func;
+}
+
+void LLVMRuntime::genPoolRelease() {
+	// ---- C code ----
+	// for (size_t cls = 0; cls < pool_classes; cls++) {
+	//   while (_pool_free_lists[cls] != NULL) {
+	//     char *block = _pool_free_lists[cls];
+	//     _pool_free_lists[cls] = *(void **)block;
+	//     free(block);
+	//   }
+	// }
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *lists_type = llvm::ArrayType::get(ptr_type, pool_classes);
+	auto *entry = builder.GetInsertBlock();
+	auto *func = entry->getParent();
+	auto *outer = llvm::BasicBlock::Create(ctx, "release_class", func);
+	auto *inner = llvm::BasicBlock::Create(ctx, "release_block", func);
+	auto *next_class = llvm::BasicBlock::Create(ctx, "release_next", func);
+	auto *cont = llvm::BasicBlock::Create(ctx, "release_cont", func);
+	builder.CreateBr(outer);
+
+	builder.SetInsertPoint(outer);
+	auto *cls = builder.CreatePHI(size_type, 2, "cls");
+	auto *head_ptr = builder.CreateInBoundsGEP(
+	    lists_type, pool_free_lists, {builder.getInt64(0), cls}, "head_ptr");
+	builder.CreateBr(inner);
+
+	builder.SetInsertPoint(inner);
+	auto *head = builder.CreateLoad(ptr_type, head_ptr, "head");
+	auto *release = llvm::BasicBlock::Create(ctx, "release", func);
+	builder.CreateCondBr(builder.CreateIsNull(head), next_class, release);
+
+	builder.SetInsertPoint(release);
+	builder.CreateStore(
+	    builder.CreateLoad(
+	        ptr_type, builder.CreatePointerCast(head, ptr_type->getPointerTo())),
+	    head_ptr);
+	builder.CreateCall(free(), {head});
+	builder.CreateBr(inner);
+
+	builder.SetInsertPoint(next_class);
+	auto *next_cls = builder.CreateAdd(cls, builder.getInt64(1), "next_cls");
+	builder.CreateCondBr(
+	    builder.CreateICmpEQ(next_cls, builder.getInt64(pool_classes)), cont,
+	    outer);
+	cls->addIncoming(builder.getInt64(0), entry);
+	cls->addIncoming(next_cls, next_class);
+
+	builder.SetInsertPoint(cont);
+}
+
+llvm::FunctionCallee LLVMRuntime::stringRelease() {
+	if (auto *func = module.getFunction("_string_release")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto free_func = stringFree();
+
+	// ---- C code ----
+	// void _string_release(char *str) {
+	//   if (str == NULL) return;
+	//   struct string_header *header = str - string_header_size;
+	//   if (header->refcount < 0) return; // immortal
+	//   if (--header->refcount == 0) _string_free(str);
+	// }
+	auto *func =
+	    beginFunction("_string_release", builder.getVoidTy(), {ptr_type});
+	auto *not_null = llvm::BasicBlock::Create(ctx, "not_null", func);
+	auto *mortal = llvm::BasicBlock::Create(ctx, "mortal", func);
+	auto *release = llvm::BasicBlock::Create(ctx, "release", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	builder.CreateCondBr(builder.CreateIsNull(func->getArg(0)), done,
+	                     not_null);
+
+	builder.SetInsertPoint(not_null);
+	auto *header = builder.CreateConstInBoundsGEP1_64(
+	    builder.getInt8Ty(), func->getArg(0),
+	    -static_cast<int64_t>(string_header_size), "header");
+	auto *refcount_ptr =
+	    builder.CreatePointerCast(header, size_type->getPointerTo());
+	auto *refcount = builder.CreateAlignedLoad(size_type, refcount_ptr,
+	                                           llvm::Align(8), "refcount");
+	builder.CreateCondBr(
+	    builder.CreateICmpSLT(refcount, builder.getInt64(0)), done, mortal);
+
+	builder.SetInsertPoint(mortal);
+	llvm::Value *new_refcount;
+	if (options.parallelStatements()) {
+		// statements on other threads may hold references to it as well
+		refcount->setAtomic(llvm::AtomicOrdering::Monotonic);
+		new_refcount = builder.CreateSub(
+		    builder.CreateAtomicRMW(llvm::AtomicRMWInst::Sub, refcount_ptr,
+		                            builder.getInt64(1), llvm::Align(8),
+		                            llvm::AtomicOrdering::AcquireRelease),
+		    builder.getInt64(1), "new_refcount");
+	} else {
+		new_refcount =
+		    builder.CreateSub(refcount, builder.getInt64(1), "new_refcount");
+		builder.CreateStore(new_refcount, refcount_ptr);
+	}
+	builder.CreateCondBr(
+	    builder.CreateICmpEQ(new_refcount, builder.getInt64(0)), release,
+	    done);
+
+	builder.SetInsertPoint(release);
+	builder.CreateCall(free_func, {func->getArg(0)});
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::stringRetire() {
+	if (auto *func = module.getFunction("_string_retire")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto release_func = stringRelease();
+	auto free_func = stringFree();
+
+	// Of the two uniquely owned buffers, the larger one is kept.
+	// ---- C code ----
+	// void _string_retire(char **spare, char *str) {
+	//   if (str == NULL) return;
+	//   struct string_header *header = str - string_header_size;
+	//   if (header->refcount != 1) {
+	//     _string_release(str);
+	//   } else if (*spare == NULL) {
+	//     *spare = str;
+	//   } else if (header(*spare)->capacity < header->capacity) {
+	//     _string_free(*spare);
+	//     *spare = str;
+	//   } else {
+	//     _string_free(str);
+	//   }
+	// }
+	auto *func = beginFunction("_string_retire", builder.getVoidTy(),
+	                           {ptr_type->getPointerTo(), ptr_type});
+	auto *spare_ptr = func->getArg(0);
+	auto *str = func->getArg(1);
+	auto *not_null = llvm::BasicBlock::Create(ctx, "not_null", func);
+	auto *shared = llvm::BasicBlock::Create(ctx, "shared", func);
+	auto *unique = llvm::BasicBlock::Create(ctx, "unique", func);
+	auto *compare = llvm::BasicBlock::Create(ctx, "compare", func);
+	auto *replace = llvm::BasicBlock::Create(ctx, "replace", func);
+	auto *keep = llvm::BasicBlock::Create(ctx, "keep", func);
+	auto *discard = llvm::BasicBlock::Create(ctx, "discard", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	builder.CreateCondBr(builder.CreateIsNull(str), done, not_null);
+
+	auto header = [&](llvm::Value *ptr) {
+		return builder.CreateConstInBoundsGEP1_64(
+		    builder.getInt8Ty(), ptr,
+		    -static_cast<int64_t>(string_header_size), "header");
+	};
+	auto header_field = [&](llvm::Value *ptr, int field) {
+		auto *addr = builder.CreateConstInBoundsGEP1_64(
+		    builder.getInt8Ty(), header(ptr), 8 * field);
+		return builder.CreatePointerCast(addr, size_type->getPointerTo());
+	};
+
+	builder.SetInsertPoint(not_null);
+	auto *refcount = builder.CreateAlignedLoad(
+	    size_type, header_field(str, 0), llvm::Align(8), "refcount");
+	if (options.parallelStatements()) {
+		refcount->setAtomic(llvm::AtomicOrdering::Acquire);
+	}
+	builder.CreateCondBr(builder.CreateICmpEQ(refcount, builder.getInt64(1)),
+	                     unique, shared);
+
+	builder.SetInsertPoint(shared);
+	builder.CreateCall(release_func, {str});
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(unique);
+	auto *spare = builder.CreateLoad(ptr_type, spare_ptr, "spare");
+	builder.CreateCondBr(builder.CreateIsNull(spare), keep, compare);
+
+	builder.SetInsertPoint(compare);
+	auto *spare_capacity =
+	    builder.CreateLoad(size_type, header_field(spare, 1), "spare_capacity");
+	auto *capacity =
+	    builder.CreateLoad(size_type, header_field(str, 1), "capacity");
+	builder.CreateCondBr(builder.CreateICmpULT(spare_capacity, capacity),
+	                     replace, discard);
+
+	builder.SetInsertPoint(replace);
+	builder.CreateCall(free_func, {spare});
+	builder.CreateBr(keep);
+
+	builder.SetInsertPoint(keep);
+	builder.CreateStore(str, spare_ptr);
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(discard);
+	builder.CreateCall(free_func, {str});
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::stringFree() {
+	if (auto *func = module.getFunction("_string_free")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto free_func = options.arena ? poolFree() : freeSized();
+
+	// ---- C code ----
+	// void _string_free(char *str) {
+	//   struct string_header *header = str - string_header_size;
+	//   _free_sized(header, string_header_size + header->capacity + 1);
+	//   // in arena mode: _pool_free(header);
+	// }
+	auto *func = beginFunction("_string_free", builder.getVoidTy(), {ptr_type});
+	auto *header = builder.CreateConstInBoundsGEP1_64(
+	    builder.getInt8Ty(), func->getArg(0),
+	    -static_cast<int64_t>(string_header_size), "header");
+	if (options.arena) {
+		builder.CreateCall(free_func, {header});
+	} else {
+		auto *capacity = builder.CreateLoad(
+		    size_type,
+		    builder.CreatePointerCast(
+		        builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), header,
+		                                           8),
+		        size_type->getPointerTo()),
+		    "capacity");
+		auto *size = builder.CreateAdd(
+		    capacity, builder.getInt64(string_header_size + 1), "size");
+		builder.CreateCall(free_func, {header, size});
+	}
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::stringGrow() {
+	if (auto *func = module.getFunction("_string_grow")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto alloc_func = options.arena ? poolAlloc() : malloc();
+	auto free_func = options.arena ? poolFree() : freeSized();
+	auto copy_func = copyBulk();
+	auto mremap_func = module.getOrInsertFunction(
+	    "mremap",
+	    llvm::FunctionType::get(
+	        ptr_type, {ptr_type, size_type, size_type, builder.getInt32Ty()},
+	        true));
+
+	// A mapped buffer is remapped, which moves its pages instead of copying
+	// them. The arena pool keeps its own header in front of the buffer, so
+	// in arena mode the string is always copied.
+	// ---- C code ----
+	// char *_string_grow(char *str, size_t len, size_t cap) {
+	//   struct string_header *header = str - string_header_size;
+	//   size_t size = string_header_size + header->capacity + 1;
+	//   size_t new_size = string_header_size + cap + 1;
+	//   struct string_header *moved = MAP_FAILED;
+	//   if (size >= large_alloc_threshold) { // never in arena mode
+	//     moved = mremap(header, round_up(size, huge_page_size),
+	//                    round_up(new_size, huge_page_size), MREMAP_MAYMOVE);
+	//   }
+	//   if (moved == MAP_FAILED) {
+	//     moved = malloc(new_size);
+	//     size_t n = string_header_size + len;
+	//     if (n < bulk_copy_threshold) memcpy(moved, header, n);
+	//     else _copy_bulk(moved, header, n);
+	//     _free_sized(header, size);
+	//   }
+	//   moved->capacity = cap;
+	//   moved->hash = 0;
+	//   return (char *)moved + string_header_size;
+	// }
+	auto *func = beginFunction("_string_grow", ptr_type,
+	                           {ptr_type, size_type, size_type});
+	auto *relocate = llvm::BasicBlock::Create(ctx, "relocate", func);
+	auto *copy = llvm::BasicBlock::Create(ctx, "copy", func);
+	auto *copy_bulk = llvm::BasicBlock::Create(ctx, "copy_bulk", func);
+	auto *release = llvm::BasicBlock::Create(ctx, "release", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	auto *len = func->getArg(1);
+	auto *cap = func->getArg(2);
+	auto *header = builder.CreateConstInBoundsGEP1_64(
+	    builder.getInt8Ty(), func->getArg(0),
+	    -static_cast<int64_t>(string_header_size), "header");
+	auto header_field = [&](llvm::Value *ptr, int field) {
+		return builder.CreatePointerCast(
+		    builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), ptr,
+		                                       8 * field),
+		    size_type->getPointerTo());
+	};
+	auto *capacity =
+	    builder.CreateLoad(size_type, header_field(header, 1), "capacity");
+	auto *size = builder.CreateAdd(
+	    capacity, builder.getInt64(string_header_size + 1), "size");
+	auto *new_size = builder.CreateAdd(
+	    cap, builder.getInt64(string_header_size + 1), "new_size");
+	llvm::Value *remapped = nullptr;
+	llvm::BasicBlock *remapped_end = nullptr;
+	if (options.arena) {
+		builder.CreateBr(relocate);
+	} else {
+		auto *remap = llvm::BasicBlock::Create(ctx, "remap", func, relocate);
+		remapped_end =
+		    llvm::BasicBlock::Create(ctx, "remapped", func, relocate);
+		auto *large = builder.CreateICmpUGE(
+		    size, builder.getInt64(large_alloc_threshold), "large");
+		builder.CreateCondBr(large, remap, relocate);
+
+		builder.SetInsertPoint(remap);
+		remapped = builder.CreateCall(
+		    mremap_func,
+		    {header, genHugePageRound(size), genHugePageRound(new_size),
+		     builder.getInt32(MREMAP_MAYMOVE)},
+		    "remapped");
+		auto *map_failed =
+		    builder.CreateIntToPtr(builder.getInt64(-1), ptr_type);
+		builder.CreateCondBr(builder.CreateICmpEQ(remapped, map_failed),
+		                     relocate, remapped_end);
+
+		builder.SetInsertPoint(remapped_end);
+		builder.CreateBr(done);
+	}
+
+	builder.SetInsertPoint(relocate);
+	auto *relocated = builder.CreateCall(alloc_func, {new_size}, "relocated");
+	auto *used = builder.CreateAdd(len, builder.getInt64(string_header_size),
+	                               "used");
+	builder.CreateCondBr(
+	    builder.CreateICmpULT(used,
+	                          builder.getInt64(bulkCopyThreshold())),
+	    copy, copy_bulk);
+
+	builder.SetInsertPoint(copy);
+	builder.CreateMemCpy(relocated, llvm::Align(8), header, llvm::Align(8),
+	                     used);
+	builder.CreateBr(release);
+
+	builder.SetInsertPoint(copy_bulk);
+	builder.CreateCall(copy_func, {relocated, header, used});
+	builder.CreateBr(release);
+
+	builder.SetInsertPoint(release);
+	if (options.arena) {
+		builder.CreateCall(free_func, {header});
+	} else {
+		builder.CreateCall(free_func, {header, size});
+	}
+	builder.CreateBr(done);
+
+	builder.SetInsertPoint(done);
+	auto *moved = builder.CreatePHI(ptr_type, 2, "moved");
+	moved->addIncoming(relocated, release);
+	if (remapped != nullptr) {
+		moved->addIncoming(remapped, remapped_end);
+	}
+	builder.CreateStore(cap, header_field(moved, 1));
+	builder.CreateStore(builder.getInt64(0), header_field(moved, 2));
+	builder.CreateRet(builder.CreateConstInBoundsGEP1_64(
+	    builder.getInt8Ty(), moved, string_header_size));
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::stringHash() {
+	if (auto *func = module.getFunction("_string_hash")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+
+	// ---- C code ----
+	// uint64_t _string_hash(char *str, size_t len) {
+	//   struct string_header *header = str - string_header_size;
+	//   if (header->hash != 0) return header->hash;
+	//   uint64_t hash = hash_seed ^ len;
+	//   size_t idx = 0;
+	//   for (; idx + 8 <= len; idx += 8) {
+	//     hash = (hash ^ *(uint64_t *)(str + idx)) * hash_multiplier;
+	//     hash ^= hash >> 32;
+	//   }
+	//   for (; idx < len; idx++) {
+	//     hash = (hash ^ (uint8_t)str[idx]) * hash_multiplier;
+	//   }
+	//   hash ^= hash >> 29;
+	//   return header->hash = hash == 0 ? 1 : hash;
+	// }
+	auto *func =
+	    beginFunction("_string_hash", size_type, {ptr_type, size_type});
+	auto *return_cached = llvm::BasicBlock::Create(ctx, "return_cached", func);
+	auto *compute = llvm::BasicBlock::Create(ctx, "compute", func);
+	auto *word_loop = llvm::BasicBlock::Create(ctx, "word_loop", func);
+	auto *word_body = llvm::BasicBlock::Create(ctx, "word_body", func);
+	auto *byte_loop = llvm::BasicBlock::Create(ctx, "byte_loop", func);
+	auto *byte_body = llvm::BasicBlock::Create(ctx, "byte_body", func);
+	auto *finish = llvm::BasicBlock::Create(ctx, "finish", func);
+	auto *str = func->getArg(0);
+	auto *hash_ptr = builder.CreatePointerCast(
+	    builder.CreateConstInBoundsGEP1_64(
+	        builder.getInt8Ty(), str,
+	        -static_cast<int64_t>(string_header_size) + 16),
+	    size_type->getPointerTo());
+	auto *cached = builder.CreateLoad(size_type, hash_ptr, "cached");
+	auto *is_cached = builder.CreateICmpNE(cached, builder.getInt64(0));
+	auto *len = func->getArg(1);
+	auto *words_end =
+	    builder.CreateAnd(len, builder.getInt64(~uint64_t(7)), "words_end");
+	auto *seeded =
+	    builder.CreateXor(len, builder.getInt64(hash_seed), "seeded");
+	builder.CreateCondBr(is_cached, return_cached, compute);
+
+	builder.SetInsertPoint(compute);
+	builder.CreateBr(word_loop);
+
+	builder.SetInsertPoint(word_loop);
+	auto *word_idx = builder.CreatePHI(size_type, 2, "word_idx");
+	auto *word_hash = builder.CreatePHI(size_type, 2, "word_hash");
+	builder.CreateCondBr(builder.CreateICmpEQ(word_idx, words_end), byte_loop,
+	                     word_body);
+
+	builder.SetInsertPoint(word_body);
+	auto *word_ptr = builder.CreatePointerCast(
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), str, word_idx),
+	    size_type->getPointerTo());
+	auto *word = builder.CreateAlignedLoad(size_type, word_ptr, llvm::Align(1),
+	                                       "word");
+	auto *mixed =
+	    builder.CreateMul(builder.CreateXor(word_hash, word),
+	                      builder.getInt64(hash_multiplier), "mixed");
+	auto *next_word_hash = builder.CreateXor(
+	    mixed, builder.CreateLShr(mixed, 32), "next_word_hash");
+	auto *next_word_idx =
+	    builder.CreateAdd(word_idx, builder.getInt64(8), "next_word_idx");
+	builder.CreateBr(word_loop);
+	word_idx->addIncoming(builder.getInt64(0), compute);
+	word_idx->addIncoming(next_word_idx, word_body);
+	word_hash->addIncoming(seeded, compute);
+	word_hash->addIncoming(next_word_hash, word_body);
+
+	builder.SetInsertPoint(byte_loop);
+	auto *byte_idx = builder.CreatePHI(size_type, 2, "byte_idx");
+	auto *byte_hash = builder.CreatePHI(size_type, 2, "byte_hash");
+	builder.CreateCondBr(builder.CreateICmpEQ(byte_idx, len), finish,
+	                     byte_body);
+
+	builder.SetInsertPoint(byte_body);
+	auto *byte = builder.CreateZExt(
+	    builder.CreateLoad(
+	        builder.getInt8Ty(),
+	        builder.CreateInBoundsGEP(builder.getInt8Ty(), str, byte_idx)),
+	    size_type, "byte");
+	auto *next_byte_hash =
+	    builder.CreateMul(builder.CreateXor(byte_hash, byte),
+	                      builder.getInt64(hash_multiplier), "next_byte_hash");
+	auto *next_byte_idx =
+	    builder.CreateAdd(byte_idx, builder.getInt64(1), "next_byte_idx");
+	builder.CreateBr(byte_loop);
+	byte_idx->addIncoming(words_end, word_loop);
+	byte_idx->addIncoming(next_byte_idx, byte_body);
+	byte_hash->addIncoming(word_hash, word_loop);
+	byte_hash->addIncoming(next_byte_hash, byte_body);
+
+	builder.SetInsertPoint(finish);
+	auto *spread = builder.CreateXor(
+	    byte_hash, builder.CreateLShr(byte_hash, 29), "spread");
+	auto *hash = builder.CreateSelect(
+	    builder.CreateICmpEQ(spread, builder.getInt64(0)), builder.getInt64(1),
+	    spread, "hash");
+	builder.CreateStore(hash, hash_ptr);
+	builder.CreateRet(hash);
+
+	builder.SetInsertPoint(return_cached);
+	builder.CreateRet(cached);
+	return func;
+}
+
+llvm::StructType *LLVMRuntime::segmentType() {
+	return llvm::StructType::get(
+	    ctx, {builder.getInt8PtrTy(), builder.getInt64Ty()});
+}
+
+llvm::FunctionCallee LLVMRuntime::segmentsEqual() {
+	if (auto *func = module.getFunction("_segments_equal")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *len_type = builder.getInt64Ty();
+	auto *segment_type = segmentType();
+	auto *segment_ptr_type = segment_type->getPointerTo();
+	auto memcmp_func = memcmp();
+
+	// ---- C code ----
+	// bool _segments_equal(struct segment *a, size_t na,
+	//                      struct segment *b, size_t nb) {
+	//   size_t i = 0, j = 0, len_a = 0, len_b = 0;
+	//   char *str_a = NULL, *str_b = NULL;
+	//   for (;;) {
+	//     while (len_a == 0) {
+	//       if (i == na) return true; // b is exhausted as well
+	//       str_a = a[i].str, len_a = a[i].len, i++;
+	//     }
+	//     while (len_b == 0) {
+	//       if (j == nb) return true;
+	//       str_b = b[j].str, len_b = b[j].len, j++;
+	//     }
+	//     size_t n = len_a < len_b ? len_a : len_b;
+	//     if (memcmp(str_a, str_b, n) != 0) return false;
+	//     str_a += n, len_a -= n;
+	//     str_b += n, len_b -= n;
+	//   }
+	// }
+	auto *func =
+	    beginFunction("_segments_equal", builder.getInt1Ty(),
+	                  {segment_ptr_type, len_type, segment_ptr_type, len_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *refill_a = llvm::BasicBlock::Create(ctx, "refill_a", func);
+	auto *check_a = llvm::BasicBlock::Create(ctx, "check_a", func);
+	auto *load_a = llvm::BasicBlock::Create(ctx, "load_a", func);
+	auto *refill_b = llvm::BasicBlock::Create(ctx, "refill_b", func);
+	auto *check_b = llvm::BasicBlock::Create(ctx, "check_b", func);
+	auto *load_b = llvm::BasicBlock::Create(ctx, "load_b", func);
+	auto *compare = llvm::BasicBlock::Create(ctx, "compare", func);
+	auto *advance = llvm::BasicBlock::Create(ctx, "advance", func);
+	auto *equal = llvm::BasicBlock::Create(ctx, "equal", func);
+	auto *not_equal = llvm::BasicBlock::Create(ctx, "not_equal", func);
+	auto *a = func->getArg(0);
+	auto *na = func->getArg(1);
+	auto *b = func->getArg(2);
+	auto *nb = func->getArg(3);
+	auto *null = llvm::ConstantPointerNull::get(ptr_type);
+	builder.CreateBr(refill_a);
+
+	builder.SetInsertPoint(refill_a);
+	auto *i = builder.CreatePHI(len_type, 3, "i");
+	auto *str_a = builder.CreatePHI(ptr_type, 3, "str_a");
+	auto *len_a = builder.CreatePHI(len_type, 3, "len_a");
+	auto *j_outer = builder.CreatePHI(len_type, 3, "j_outer");
+	auto *str_b_outer = builder.CreatePHI(ptr_type, 3, "str_b_outer");
+	auto *len_b_outer = builder.CreatePHI(len_type, 3, "len_b_outer");
+	builder.CreateCondBr(builder.CreateICmpEQ(len_a, builder.getInt64(0)),
+	                     check_a, refill_b);
+
+	builder.SetInsertPoint(check_a);
+	builder.CreateCondBr(builder.CreateICmpEQ(i, na), equal, load_a);
+
+	builder.SetInsertPoint(load_a);
+	auto *segment_a = builder.CreateInBoundsGEP(segment_type, a, i);
+	auto *next_str_a = builder.CreateLoad(
+	    ptr_type, builder.CreateStructGEP(segment_type, segment_a, 0));
+	auto *next_len_a = builder.CreateLoad(
+	    len_type, builder.CreateStructGEP(segment_type, segment_a, 1));
+	auto *next_i = builder.CreateAdd(i, builder.getInt64(1), "next_i");
+	builder.CreateBr(refill_a);
+
+	builder.SetInsertPoint(refill_b);
+	auto *j = builder.CreatePHI(len_type, 2, "j");
+	auto *str_b = builder.CreatePHI(ptr_type, 2, "str_b");
+	auto *len_b = builder.CreatePHI(len_type, 2, "len_b");
+	builder.CreateCondBr(builder.CreateICmpEQ(len_b, builder.getInt64(0)),
+	                     check_b, compare);
+
+	builder.SetInsertPoint(check_b);
+	builder.CreateCondBr(builder.CreateICmpEQ(j, nb), equal, load_b);
+
+	builder.SetInsertPoint(load_b);
+	auto *segment_b = builder.CreateInBoundsGEP(segment_type, b, j);
+	auto *next_str_b = builder.CreateLoad(
+	    ptr_type, builder.CreateStructGEP(segment_type, segment_b, 0));
+	auto *next_len_b = builder.CreateLoad(
+	    len_type, builder.CreateStructGEP(segment_type, segment_b, 1));
+	auto *next_j = builder.CreateAdd(j, builder.getInt64(1), "next_j");
+	builder.CreateBr(refill_b);
+
+	builder.SetInsertPoint(compare);
+	auto *n = builder.CreateSelect(builder.CreateICmpULT(len_a, len_b), len_a,
+	                               len_b, "n");
+	auto *cmp = builder.CreateCall(memcmp_func, {str_a, str_b, n}, "cmp");
+	builder.CreateCondBr(builder.CreateICmpEQ(cmp, builder.getInt32(0)),
+	                     advance, not_equal);
+
+	builder.SetInsertPoint(advance);
+	auto *rest_str_a =
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), str_a, n, "rest_str_a");
+	auto *rest_len_a = builder.CreateSub(len_a, n, "rest_len_a");
+	auto *rest_str_b =
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), str_b, n, "rest_str_b");
+	auto *rest_len_b = builder.CreateSub(len_b, n, "rest_len_b");
+	builder.CreateBr(refill_a);
+
+	i->addIncoming(builder.getInt64(0), entry);
+	i->addIncoming(next_i, load_a);
+	i->addIncoming(i, advance);
+	str_a->addIncoming(null, entry);
+	str_a->addIncoming(next_str_a, load_a);
+	str_a->addIncoming(rest_str_a, advance);
+	len_a->addIncoming(builder.getInt64(0), entry);
+	len_a->addIncoming(next_len_a, load_a);
+	len_a->addIncoming(rest_len_a, advance);
+	j_outer->addIncoming(builder.getInt64(0), entry);
+	j_outer->addIncoming(j_outer, load_a);
+	j_outer->addIncoming(j, advance);
+	str_b_outer->addIncoming(null, entry);
+	str_b_outer->addIncoming(str_b_outer, load_a);
+	str_b_outer->addIncoming(rest_str_b, advance);
+	len_b_outer->addIncoming(builder.getInt64(0), entry);
+	len_b_outer->addIncoming(len_b_outer, load_a);
+	len_b_outer->addIncoming(rest_len_b, advance);
+	j->addIncoming(j_outer, refill_a);
+	j->addIncoming(next_j, load_b);
+	str_b->addIncoming(str_b_outer, refill_a);
+	str_b->addIncoming(next_str_b, load_b);
+	len_b->addIncoming(len_b_outer, refill_a);
+	len_b->addIncoming(next_len_b, load_b);
+
+	builder.SetInsertPoint(equal);
+	builder.CreateRet(builder.getTrue());
+
+	builder.SetInsertPoint(not_equal);
+	builder.CreateRet(builder.getFalse());
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::lengthOverflow() {
+	if (auto *func = module.getFunction("_length_overflow")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto error_func = runtimeError();
+
+	// ---- C code ----
+	// void _length_overflow() {
+	//   _runtime_error("string too long");
+	// }
+	auto *func = beginFunction("_length_overflow", builder.getVoidTy(), {});
+	func->setDoesNotReturn();
+	func->addFnAttr(llvm::Attribute::Cold);
+	builder.CreateCall(error_func,
+	                   {builder.CreateGlobalStringPtr("string too long")});
+	builder.CreateUnreachable();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::intOverflow() {
+	if (auto *func = module.getFunction("_int_overflow")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto error_func = runtimeError();
+
+	// ---- C code ----
+	// void _int_overflow() {
+	//   _runtime_error("integer overflow");
+	// }
+	auto *func = beginFunction("_int_overflow", builder.getVoidTy(), {});
+	func->setDoesNotReturn();
+	func->addFnAttr(llvm::Attribute::Cold);
+	builder.CreateCall(error_func,
+	                   {builder.CreateGlobalStringPtr("integer overflow")});
+	builder.CreateUnreachable();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::formatInt() {
+	if (auto *func = module.getFunction("_format_int")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *size_type = builder.getInt64Ty();
+
+	// ---- C code ----
+	// size_t _format_int(char *buf, int64_t value) {
+	//   size_t len = 0;
+	//   uint64_t rest = value;
+	//   do len++; while ((rest /= 10) != 0);
+	//   size_t idx = len;
+	//   rest = value;
+	//   do {
+	//     buf[--idx] = '0' + rest % 10;
+	//     rest /= 10;
+	//   } while (idx != 0);
+	//   return len;
+	// }
+	auto *func = beginFunction("_format_int", size_type,
+	                           {builder.getInt8PtrTy(), size_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *count = llvm::BasicBlock::Create(ctx, "count", func);
+	auto *write = llvm::BasicBlock::Create(ctx, "write", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	auto *buf = func->getArg(0);
+	auto *value = func->getArg(1);
+	auto *ten = builder.getInt64(10);
+	builder.CreateBr(count);
+
+	builder.SetInsertPoint(count);
+	auto *len = builder.CreatePHI(size_type, 2, "len");
+	auto *count_rest = builder.CreatePHI(size_type, 2, "count_rest");
+	auto *next_len = builder.CreateAdd(len, builder.getInt64(1), "next_len");
+	auto *next_count_rest =
+	    builder.CreateUDiv(count_rest, ten, "next_count_rest");
+	len->addIncoming(builder.getInt64(0), entry);
+	len->addIncoming(next_len, count);
+	count_rest->addIncoming(value, entry);
+	count_rest->addIncoming(next_count_rest, count);
+	builder.CreateCondBr(builder.CreateIsNull(next_count_rest), write, count);
+
+	builder.SetInsertPoint(write);
+	auto *idx = builder.CreatePHI(size_type, 2, "idx");
+	auto *rest = builder.CreatePHI(size_type, 2, "rest");
+	auto *next_idx = builder.CreateSub(idx, builder.getInt64(1), "next_idx");
+	auto *digit = builder.CreateAdd(
+	    builder.CreateTrunc(builder.CreateURem(rest, ten), builder.getInt8Ty()),
+	    builder.getInt8('0'), "digit");
+	builder.CreateStore(
+	    digit, builder.CreateInBoundsGEP(builder.getInt8Ty(), buf, next_idx));
+	auto *next_rest = builder.CreateUDiv(rest, ten, "next_rest");
+	idx->addIncoming(next_len, count);
+	idx->addIncoming(next_idx, write);
+	rest->addIncoming(value, count);
+	rest->addIncoming(next_rest, write);
+	builder.CreateCondBr(builder.CreateIsNull(next_idx), done, write);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRet(next_len);
+	return func;
+}
+
+llvm::StructType *LLVMRuntime::iovecType() {
+	// struct iovec { void *iov_base; size_t iov_len; }
+	return llvm::StructType::get(
+	    ctx, {builder.getInt8PtrTy(), builder.getInt64Ty()});
+}
+
+llvm::Function *LLVMRuntime::genWriteVectors() {
+	auto *iovec_type = iovecType();
+	auto *size_type = builder.getInt64Ty();
+	auto writev_func = module.getOrInsertFunction(
+	    "writev", llvm::FunctionType::get(size_type,
+	                                      {builder.getInt32Ty(),
+	                                       iovec_type->getPointerTo(),
+	                                       builder.getInt32Ty()},
+	                                      false));
+
+	// A failed write drops the rest, like printf() does.
+	// ---- C code ----
+	// void _write_vectors(int fd, struct iovec *iov, int count) {
+	//   while (count > 0) {
+	//     ssize_t written = writev(fd, iov, count);
+	//     if (written <= 0) return;
+	//     while (count > 0 && written >= iov->iov_len) {
+	//       written -= iov->iov_len;
+	//       iov++;
+	//       count--;
+	//     }
+	//     if (count > 0) {
+	//       iov->iov_base += written;
+	//       iov->iov_len -= written;
+	//     }
+	//   }
+	// }
+	auto *int_type = builder.getInt32Ty();
+	auto *func =
+	    beginFunction("_write_vectors", builder.getVoidTy(),
+	                  {int_type, iovec_type->getPointerTo(), int_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *loop = llvm::BasicBlock::Create(ctx, "loop", func);
+	auto *write = llvm::BasicBlock::Create(ctx, "write", func);
+	auto *skip_loop = llvm::BasicBlock::Create(ctx, "skip_loop", func);
+	auto *check_skip = llvm::BasicBlock::Create(ctx, "check_skip", func);
+	auto *skip = llvm::BasicBlock::Create(ctx, "skip", func);
+	auto *partial = llvm::BasicBlock::Create(ctx, "partial", func);
+	auto *done = llvm::BasicBlock::Create(ctx, "done", func);
+	auto *fd = func->getArg(0);
+	builder.CreateBr(loop);
+
+	builder.SetInsertPoint(loop);
+	auto *iov = builder.CreatePHI(iovec_type->getPointerTo(), 2, "iov");
+	auto *count = builder.CreatePHI(builder.getInt32Ty(), 2, "count");
+	iov->addIncoming(func->getArg(1), entry);
+	count->addIncoming(func->getArg(2), entry);
+	builder.CreateCondBr(builder.CreateICmpSGT(count, builder.getInt32(0)),
+	                     write, done);
+
+	builder.SetInsertPoint(write);
+	auto *written =
+	    builder.CreateCall(writev_func, {fd, iov, count}, "written");
+	builder.CreateCondBr(builder.CreateICmpSLE(written, builder.getInt64(0)),
+	                     done, skip_loop);
+
+	builder.SetInsertPoint(skip_loop);
+	auto *left = builder.CreatePHI(size_type, 2, "left");
+	auto *rest_iov = builder.CreatePHI(iov->getType(), 2, "rest_iov");
+	auto *rest_count = builder.CreatePHI(count->getType(), 2, "rest_count");
+	left->addIncoming(written, write);
+	rest_iov->addIncoming(iov, write);
+	rest_count->addIncoming(count, write);
+	builder.CreateCondBr(
+	    builder.CreateICmpSGT(rest_count, builder.getInt32(0)), check_skip,
+	    done);
+
+	builder.SetInsertPoint(check_skip);
+	auto *len_ptr = builder.CreateStructGEP(iovec_type, rest_iov, 1);
+	auto *len = builder.CreateLoad(size_type, len_ptr, "len");
+	builder.CreateCondBr(builder.CreateICmpUGE(left, len), skip, partial);
+
+	builder.SetInsertPoint(skip);
+	left->addIncoming(builder.CreateSub(left, len), skip);
+	rest_iov->addIncoming(
+	    builder.CreateConstInBoundsGEP1_64(iovec_type, rest_iov, 1), skip);
+	rest_count->addIncoming(builder.CreateSub(rest_count, builder.getInt32(1)),
+	                        skip);
+	builder.CreateBr(skip_loop);
+
+	builder.SetInsertPoint(partial);
+	auto *base_ptr = builder.CreateStructGEP(iovec_type, rest_iov, 0);
+	builder.CreateStore(
+	    builder.CreateInBoundsGEP(
+	        builder.getInt8Ty(),
+	        builder.CreateLoad(builder.getInt8PtrTy(), base_ptr), left),
+	    base_ptr);
+	builder.CreateStore(builder.CreateSub(len, left), len_ptr);
+	iov->addIncoming(rest_iov, partial);
+	count->addIncoming(rest_count, partial);
+	builder.CreateBr(loop);
+
+	builder.SetInsertPoint(done);
+	builder.CreateRetVoid();
+	return func;
+}
+
+// The output of the program goes through _out_buf, so that printing many
+// short strings takes few system calls. Strings which don't fit are
+// written from where they are stored, together with what is buffered.
+
+void LLVMRuntime::createOutput() {
+	if (out_buf != nullptr) {
+		return;
+	}
+	out_buf = createGlobal(
+	    llvm::ArrayType::get(builder.getInt8Ty(), out_buffer_size), "_out_buf");
+	out_len = createGlobal(builder.getInt64Ty(), "_out_len");
+	out_fd = createGlobal(builder.getInt32Ty(), "_out_fd");
+	out_fd->setInitializer(builder.getInt32(STDOUT_FILENO));
+}
+
+llvm::FunctionCallee LLVMRuntime::outFlush() {
+	if (auto *func = module.getFunction("_out_flush")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	createOutput();
+	auto *iovec_type = iovecType();
+	auto *write_func = genWriteVectors();
+
+	// ---- C code ----
+	// void _out_flush(void) {
+	//   struct iovec iov = {_out_buf, _out_len};
+	//   _write_vectors(_out_fd, &iov, 1);
+	//   _out_len = 0;
+	// }
+	auto *func = beginFunction("_out_flush", builder.getVoidTy(), {});
+	auto *iov = builder.CreateAlloca(iovec_type, nullptr, "iov");
+	auto *buf = builder.CreatePointerCast(out_buf, builder.getInt8PtrTy());
+	builder.CreateStore(buf, builder.CreateStructGEP(iovec_type, iov, 0));
+	builder.CreateStore(builder.CreateLoad(builder.getInt64Ty(), out_len),
+	                    builder.CreateStructGEP(iovec_type, iov, 1));
+	builder.CreateCall(write_func,
+	                   {builder.CreateLoad(builder.getInt32Ty(), out_fd), iov,
+	                    builder.getInt32(1)});
+	builder.CreateStore(builder.getInt64(0), out_len);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::outWrite() {
+	if (auto *func = module.getFunction("_out_write")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *iovec_type = iovecType();
+	auto flush_func = outFlush();
+	auto *write_func = module.getFunction("_write_vectors");
+
+	// ---- C code ----
+	// void _out_write(const char *str, size_t len) {
+	//   if (len <= out_buffer_size - _out_len) {
+	//     memcpy(_out_buf + _out_len, str, len);
+	//     _out_len += len;
+	//   } else if (len < out_buffer_size) {
+	//     _out_flush();
+	//     memcpy(_out_buf, str, len);
+	//     _out_len = len;
+	//   } else {
+	//     struct iovec iov[2] = {{_out_buf, _out_len}, {str, len}};
+	//     _write_vectors(_out_fd, iov, 2);
+	//     _out_len = 0;
+	//   }
+	// }
+	auto *func = beginFunction("_out_write", builder.getVoidTy(),
+	                           {ptr_type, size_type});
+	auto *append = llvm::BasicBlock::Create(ctx, "append", func);
+	auto *check_short = llvm::BasicBlock::Create(ctx, "check_short", func);
+	auto *refill = llvm::BasicBlock::Create(ctx, "refill", func);
+	auto *direct = llvm::BasicBlock::Create(ctx, "direct", func);
+	auto *str = func->getArg(0);
+	auto *len = func->getArg(1);
+	auto *buffered = builder.CreateLoad(size_type, out_len, "buffered");
+	auto *buf = builder.CreatePointerCast(out_buf, ptr_type);
+	auto *room = builder.CreateSub(builder.getInt64(out_buffer_size),
+	                               buffered, "room");
+	builder.CreateCondBr(
+	    builder.CreateICmpULE(len, room), append, check_short,
+	    llvm::MDBuilder(ctx).createBranchWeights(1 << 10, 1));
+
+	builder.SetInsertPoint(append);
+	builder.CreateMemCpy(
+	    builder.CreateInBoundsGEP(builder.getInt8Ty(), buf, buffered),
+	    llvm::Align(1), str, llvm::Align(1), len);
+	builder.CreateStore(builder.CreateAdd(buffered, len), out_len);
+	builder.CreateRetVoid();
+
+	builder.SetInsertPoint(check_short);
+	builder.CreateCondBr(
+	    builder.CreateICmpULT(len, builder.getInt64(out_buffer_size)), refill,
+	    direct);
+
+	builder.SetInsertPoint(refill);
+	builder.CreateCall(flush_func);
+	builder.CreateMemCpy(buf, llvm::Align(1), str, llvm::Align(1), len);
+	builder.CreateStore(len, out_len);
+	builder.CreateRetVoid();
+
+	builder.SetInsertPoint(direct);
+	auto *iov_type = llvm::ArrayType::get(iovec_type, 2);
+	auto *iov = builder.CreateAlloca(iov_type, nullptr, "iov");
+	auto iov_field = [&](int idx, int field) {
+		auto *elem = builder.CreateConstInBoundsGEP2_64(iov_type, iov, 0, idx);
+		return builder.CreateStructGEP(iovec_type, elem, field);
+	};
+	builder.CreateStore(buf, iov_field(0, 0));
+	builder.CreateStore(buffered, iov_field(0, 1));
+	builder.CreateStore(str, iov_field(1, 0));
+	builder.CreateStore(len, iov_field(1, 1));
+	builder.CreateCall(write_func,
+	                   {builder.CreateLoad(builder.getInt32Ty(), out_fd),
+	                    builder.CreateConstInBoundsGEP2_64(iov_type, iov, 0, 0),
+	                    builder.getInt32(2)});
+	builder.CreateStore(builder.getInt64(0), out_len);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::outOpen() {
+	if (auto *func = module.getFunction("_out_open")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto flush_func = outFlush();
+	auto error_func = runtimeError();
+	auto *int_type = builder.getInt32Ty();
+	auto open_func = module.getOrInsertFunction(
+	    "open", llvm::FunctionType::get(int_type, {ptr_type, int_type}, true));
+
+	// ---- C code ----
+	// void _out_open(const char *path) {
+	//   _out_flush();
+	//   int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	//   if (fd < 0) _runtime_error("cannot open the output file");
+	//   _out_fd = fd;
+	// }
+	auto *func = beginFunction("_out_open", builder.getVoidTy(), {ptr_type});
+	auto *fail = llvm::BasicBlock::Create(ctx, "fail", func);
+	auto *opened = llvm::BasicBlock::Create(ctx, "opened", func);
+	builder.CreateCall(flush_func);
+	auto *fd = builder.CreateCall(
+	    open_func,
+	    {func->getArg(0), builder.getInt32(O_WRONLY | O_CREAT | O_TRUNC),
+	     builder.getInt32(0666)},
+	    "fd");
+	builder.CreateCondBr(builder.CreateICmpSLT(fd, builder.getInt32(0)), fail,
+	                     opened);
+
+	builder.SetInsertPoint(fail);
+	builder.CreateCall(error_func, {builder.CreateGlobalStringPtr(
+	                                   "cannot open the output file")});
+	builder.CreateUnreachable();
+
+	builder.SetInsertPoint(opened);
+	builder.CreateStore(fd, out_fd);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::outClose() {
+	if (auto *func = module.getFunction("_out_close")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto flush_func = outFlush();
+	auto close_func = module.getOrInsertFunction(
+	    "close", llvm::FunctionType::get(builder.getInt32Ty(),
+	                                     {builder.getInt32Ty()}, false));
+
+	// ---- C code ----
+	// void _out_close(void) {
+	//   _out_flush();
+	//   close(_out_fd);
+	//   _out_fd = STDOUT_FILENO;
+	// }
+	auto *func = beginFunction("_out_close", builder.getVoidTy(), {});
+	builder.CreateCall(flush_func);
+	builder.CreateCall(close_func,
+	                   {builder.CreateLoad(builder.getInt32Ty(), out_fd)});
+	builder.CreateStore(builder.getInt32(STDOUT_FILENO), out_fd);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::StructType *LLVMRuntime::traceHeaderType() {
+	// struct TraceHeader in trace.hpp
+	auto *size_type = builder.getInt64Ty();
+	return llvm::StructType::get(
+	    ctx, {llvm::ArrayType::get(builder.getInt8Ty(), sizeof(trace_magic)),
+	          builder.getInt32Ty(), builder.getInt32Ty(), size_type, size_type,
+	          size_type, size_type});
+}
+
+llvm::StructType *LLVMRuntime::traceRecordType() {
+	// struct TraceRecord in trace.hpp
+	auto *size_type = builder.getInt64Ty();
+	return llvm::StructType::get(
+	    ctx, {builder.getInt32Ty(), builder.getInt32Ty(), size_type, size_type,
+	          llvm::ArrayType::get(builder.getInt8Ty(), trace_prefix_size)});
+}
+
+llvm::FunctionCallee LLVMRuntime::traceOpen() {
+	if (auto *func = module.getFunction("_trace_open")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *int_type = builder.getInt32Ty();
+	auto *header_type = traceHeaderType();
+	auto error_func = runtimeError();
+	auto open_func = module.getOrInsertFunction(
+	    "open", llvm::FunctionType::get(int_type, {ptr_type, int_type}, true));
+	auto ftruncate_func = module.getOrInsertFunction(
+	    "ftruncate",
+	    llvm::FunctionType::get(int_type, {int_type, size_type}, false));
+	auto mmap_func = module.getOrInsertFunction(
+	    "mmap",
+	    llvm::FunctionType::get(ptr_type,
+	                            {ptr_type, size_type, int_type, int_type,
+	                             int_type, size_type},
+	                            false));
+	auto close_func = module.getOrInsertFunction(
+	    "close", llvm::FunctionType::get(int_type, {int_type}, false));
+	trace_header = createGlobal(header_type->getPointerTo(), "_trace_header");
+	trace_records =
+	    createGlobal(traceRecordType()->getPointerTo(), "_trace_records");
+	trace_size = createGlobal(size_type, "_trace_size");
+
+	// The records are stored into a shared mapping of the file, so that the
+	// trace costs no system calls and survives a crash of the program.
+	// ---- C code ----
+	// void _trace_open(const char *path, const char *names,
+	//                  size_t names_size) {
+	//   size_t records_offset =
+	//       round_up(sizeof(TraceHeader) + names_size, sizeof(TraceRecord));
+	//   size_t size = records_offset + trace_capacity * sizeof(TraceRecord);
+	//   int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	//   if (fd < 0 || ftruncate(fd, size) != 0)
+	//     _runtime_error("cannot open the trace file");
+	//   char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	//                     fd, 0);
+	//   close(fd);
+	//   if (base == MAP_FAILED) _runtime_error("cannot map the trace file");
+	//   _trace_header = (TraceHeader *)base;
+	//   *_trace_header = (TraceHeader){trace_magic, trace_version,
+	//                                  sizeof(TraceRecord), trace_capacity,
+	//                                  0, names_size, records_offset};
+	//   memcpy(base + sizeof(TraceHeader), names, names_size);
+	//   _trace_records = (TraceRecord *)(base + records_offset);
+	//   _trace_size = size;
+	// }
+	auto *func = beginFunction("_trace_open", builder.getVoidTy(),
+	                           {ptr_type, ptr_type, size_type});
+	auto *resize = llvm::BasicBlock::Create(ctx, "resize", func);
+	auto *map = llvm::BasicBlock::Create(ctx, "map", func);
+	auto *open_fail = llvm::BasicBlock::Create(ctx, "open_fail", func);
+	auto *mapped = llvm::BasicBlock::Create(ctx, "mapped", func);
+	auto *map_fail = llvm::BasicBlock::Create(ctx, "map_fail", func);
+	auto *names_size = func->getArg(2);
+	auto *records_offset = builder.CreateAnd(
+	    builder.CreateAdd(names_size,
+	                      builder.getInt64(sizeof(TraceHeader) +
+	                                       sizeof(TraceRecord) - 1)),
+	    builder.getInt64(~(sizeof(TraceRecord) - 1)), "records_offset");
+	auto *size = builder.CreateAdd(
+	    records_offset,
+	    builder.getInt64(trace_capacity * sizeof(TraceRecord)), "size");
+	auto *fd = builder.CreateCall(
+	    open_func,
+	    {func->getArg(0), builder.getInt32(O_RDWR | O_CREAT | O_TRUNC),
+	     builder.getInt32(0666)},
+	    "fd");
+	builder.CreateCondBr(builder.CreateICmpSLT(fd, builder.getInt32(0)),
+	                     open_fail, resize);
+
+	builder.SetInsertPoint(resize);
+	auto *resized = builder.CreateCall(ftruncate_func, {fd, size}, "resized");
+	builder.CreateCondBr(builder.CreateICmpNE(resized, builder.getInt32(0)),
+	                     open_fail, map);
+
+	builder.SetInsertPoint(open_fail);
+	builder.CreateCall(error_func, {builder.CreateGlobalStringPtr(
+	                                   "cannot open the trace file")});
+	builder.CreateUnreachable();
+
+	builder.SetInsertPoint(map);
+	auto *base = builder.CreateCall(
+	    mmap_func,
+	    {llvm::ConstantPointerNull::get(ptr_type), size,
+	     builder.getInt32(PROT_READ | PROT_WRITE), builder.getInt32(MAP_SHARED),
+	     fd, builder.getInt64(0)},
+	    "base");
+	builder.CreateCall(close_func, {fd});
+	builder.CreateCondBr(
+	    builder.CreateICmpEQ(
+	        base, builder.CreateIntToPtr(builder.getInt64(-1), ptr_type)),
+	    map_fail, mapped);
+
+	builder.SetInsertPoint(map_fail);
+	builder.CreateCall(error_func, {builder.CreateGlobalStringPtr(
+	                                   "cannot map the trace file")});
+	builder.CreateUnreachable();
+
+	builder.SetInsertPoint(mapped);
+	auto *header = builder.CreatePointerCast(
+	    base, header_type->getPointerTo(), "header");
+	builder.CreateMemCpy(
+	    base, llvm::Align(1),
+	    builder.CreateGlobalStringPtr(
+	        llvm::StringRef(trace_magic, sizeof(trace_magic)), "_trace_magic"),
+	    llvm::Align(1), sizeof(trace_magic));
+	builder.CreateStore(builder.getInt32(trace_version),
+	                    builder.CreateStructGEP(header_type, header, 1));
+	builder.CreateStore(builder.getInt32(sizeof(TraceRecord)),
+	                    builder.CreateStructGEP(header_type, header, 2));
+	builder.CreateStore(builder.getInt64(trace_capacity),
+	                    builder.CreateStructGEP(header_type, header, 3));
+	builder.CreateStore(names_size,
+	                    builder.CreateStructGEP(header_type, header, 5));
+	builder.CreateStore(records_offset,
+	                    builder.CreateStructGEP(header_type, header, 6));
+	builder.CreateMemCpy(builder.CreateConstInBoundsGEP1_64(
+	                         builder.getInt8Ty(), base, sizeof(TraceHeader)),
+	                     llvm::Align(1), func->getArg(1), llvm::Align(1),
+	                     names_size);
+	builder.CreateStore(header, trace_header);
+	builder.CreateStore(
+	    builder.CreatePointerCast(
+	        builder.CreateInBoundsGEP(builder.getInt8Ty(), base,
+	                                  records_offset),
+	        traceRecordType()->getPointerTo()),
+	    trace_records);
+	builder.CreateStore(size, trace_size);
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::traceRecord() {
+	if (auto *func = module.getFunction("_trace_record")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto *int_type = builder.getInt32Ty();
+	auto *header_type = traceHeaderType();
+	auto *record_type = traceRecordType();
+	traceOpen();
+
+	// Hashing the value would make tracing a growing string quadratic, so
+	// only a hash which is cached already is recorded.
+	// ---- C code ----
+	// void _trace_record(uint32_t position, uint32_t variable,
+	//                    const char *str, size_t len) {
+	//   uint64_t count = _trace_header->count;
+	//   TraceRecord *record =
+	//       &_trace_records[count & (trace_capacity - 1)];
+	//   record->position = position;
+	//   record->variable = variable;
+	//   record->length = len;
+	//   record->hash = 0;
+	//   if (len > trace_prefix_size) {
+	//     // only with hash_strings, where such a string has a header
+	//     record->hash = ((string_header *)(str - string_header_size))->hash;
+	//     len = trace_prefix_size;
+	//   }
+	//   memcpy(record->prefix, str, len);
+	//   _trace_header->count = count + 1;
+	// }
+	auto *func = beginFunction("_trace_record", builder.getVoidTy(),
+	                           {int_type, int_type, ptr_type, size_type});
+	auto *entry = builder.GetInsertBlock();
+	auto *truncate = llvm::BasicBlock::Create(ctx, "truncate", func);
+	auto *copy = llvm::BasicBlock::Create(ctx, "copy", func);
+	auto *str = func->getArg(2);
+	auto *len = func->getArg(3);
+	auto *header = builder.CreateLoad(header_type->getPointerTo(),
+	                                  trace_header, "header");
+	auto *count_ptr = builder.CreateStructGEP(header_type, header, 4);
+	auto *count = builder.CreateLoad(size_type, count_ptr, "count");
+	auto *record = builder.CreateInBoundsGEP(
+	    record_type,
+	    builder.CreateLoad(record_type->getPointerTo(), trace_records),
+	    builder.CreateAnd(count, builder.getInt64(trace_capacity - 1)),
+	    "record");
+	builder.CreateStore(func->getArg(0),
+	                    builder.CreateStructGEP(record_type, record, 0));
+	builder.CreateStore(func->getArg(1),
+	                    builder.CreateStructGEP(record_type, record, 1));
+	builder.CreateStore(len, builder.CreateStructGEP(record_type, record, 2));
+	auto *hash_ptr = builder.CreateStructGEP(record_type, record, 3);
+	builder.CreateStore(builder.getInt64(0), hash_ptr);
+	builder.CreateCondBr(
+	    builder.CreateICmpUGT(len, builder.getInt64(trace_prefix_size)),
+	    truncate, copy);
+
+	builder.SetInsertPoint(truncate);
+	if (options.hash_strings) {
+		auto *cached_ptr = builder.CreatePointerCast(
+		    builder.CreateConstInBoundsGEP1_64(
+		        builder.getInt8Ty(), str,
+		        -static_cast<int64_t>(string_header_size) + 16),
+		    size_type->getPointerTo());
+		builder.CreateStore(builder.CreateLoad(size_type, cached_ptr, "cached"),
+		                    hash_ptr);
+	}
+	builder.CreateBr(copy);
+
+	builder.SetInsertPoint(copy);
+	auto *prefix_len = builder.CreatePHI(size_type, 2, "prefix_len");
+	prefix_len->addIncoming(len, entry);
+	prefix_len->addIncoming(builder.getInt64(trace_prefix_size), truncate);
+	builder.CreateMemCpy(
+	    builder.CreatePointerCast(
+	        builder.CreateStructGEP(record_type, record, 4), ptr_type),
+	    llvm::Align(1), str, llvm::Align(1), prefix_len);
+	builder.CreateStore(builder.CreateAdd(count, builder.getInt64(1)),
+	                    count_ptr);
+	builder.CreateRetVoid();
+	return func;
+}
+
+void LLVMRuntime::genTraceClose() {
+	// ---- C code ----
+	// munmap(_trace_header, _trace_size);
+	auto *ptr_type = builder.getInt8PtrTy();
+	auto *size_type = builder.getInt64Ty();
+	auto munmap_func = module.getOrInsertFunction(
+	    "munmap", llvm::FunctionType::get(builder.getInt32Ty(),
+	                                      {ptr_type, size_type}, false));
+	auto *header = builder.CreateLoad(trace_header->getValueType(),
+	                                  trace_header, "trace_header");
+	builder.CreateCall(munmap_func,
+	                   {builder.CreatePointerCast(header, ptr_type),
+	                    builder.CreateLoad(size_type, trace_size)});
+}
+
+llvm::FunctionCallee LLVMRuntime::shutdown() {
+	if (auto *func = module.getFunction("_runtime_shutdown")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	if (options.arena) {
+		arenaReset();
+		poolFree();
+	}
+	auto flush_func = outFlush();
+	auto *func = beginFunction("_runtime_shutdown", builder.getVoidTy(), {});
+	builder.CreateCall(flush_func);
+	if (options.arena) {
+		genArenaRelease();
+		genPoolRelease();
+	}
+	if (worker_count != nullptr) {
+		// the workers run code of the program, which may be unloaded next
+		genWorkersStop();
+	}
+	if (trace_header != nullptr) {
+		genTraceClose();
+	}
+	builder.CreateRetVoid();
+	return func;
+}
+
+llvm::FunctionCallee LLVMRuntime::printStats() {
+	if (auto *func = module.getFunction("_runtime_print_stats")) {
+		return func;
+	}
+	llvm::IRBuilderBase::InsertPointGuard guard(builder);
+	malloc();
+
+	// ---- C code ----
+	// struct rusage usage;
+	// getrusage(RUSAGE_SELF, &usage);
+	// dprintf(2, "---- Runtime Stats ----\n" ...);
+	auto *func = beginFunction("_runtime_print_stats", builder.getVoidTy(), {});
+	auto *count = builder.CreateLoad(builder.getInt64Ty(), stats_malloc_count,
+	                                 "count");
+	// struct rusage on Linux is 18 longs, ru_maxrss (in KiB) is the fifth
+	auto *rusage_type = llvm::ArrayType::get(builder.getInt64Ty(), 18);
+	auto *usage = builder.CreateAlloca(rusage_type, nullptr, "usage");
+	auto getrusage_func = module.getOrInsertFunction(
+	    "getrusage",
+	    llvm::FunctionType::get(
+	        builder.getInt32Ty(),
+	        {builder.getInt32Ty(), rusage_type->getPointerTo()}, false));
+	builder.CreateCall(getrusage_func, {builder.getInt32(0), usage});
+	auto *maxrss = builder.CreateLoad(
+	    builder.getInt64Ty(),
+	    builder.CreateConstInBoundsGEP2_32(rusage_type, usage, 0, 4),
+	    "maxrss");
+	auto *stats_template = builder.CreateGlobalStringPtr(
+	    "---- Runtime Stats ----\nmalloc calls: %lu\npeak RSS: %ld KiB\n",
+	    "_stats_template");
+	auto dprintf_func = module.getOrInsertFunction(
+	    "dprintf",
+	    llvm::FunctionType::get(builder.getInt32Ty(),
+	                            {builder.getInt32Ty(), builder.getInt8PtrTy()},
+	                            true));
+	builder.CreateCall(dprintf_func,
+	                   {builder.getInt32(2), stats_template, count, maxrss});
+	builder.CreateRetVoid();
+	return func;
+}
+
+} // namespace compiler
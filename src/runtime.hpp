@@ -0,0 +1,171 @@
+#pragma once
+
+#include "codegen_options.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+namespace compiler {
+
+// A heap string is preceded by a header
+//   struct string_header {
+//     int64_t refcount; // negative for immortal strings (literals)
+//     int64_t capacity; // excluding the terminating NUL
+//     uint64_t hash;    // 0 until computed by _string_hash
+//   };
+// and the string pointer points right after the header.
+static constexpr uint64_t string_header_size = 24;
+
+// The hash _string_hash computes, for hashing literals at compile time.
+// Never 0, which marks a hash that is not computed yet.
+uint64_t hashString(llvm::StringRef str);
+
+// Copies of at least this many bytes are left to _copy_bulk(), shorter
+// ones are plain memcpy()s.
+uint64_t bulkCopyThreshold();
+
+// Generates the support functions the compiled program calls at runtime.
+// Each function is emitted into the module on first use.
+class LLVMRuntime {
+  public:
+	LLVMRuntime(llvm::Module &module, const CodeGenOptions &options);
+	LLVMRuntime(const LLVMRuntime &) = delete;
+
+	// i8* malloc(i64), counted when stats are enabled, fails with a runtime
+	// error when out of memory. Large blocks are mapped from the kernel in
+	// huge pages.
+	llvm::FunctionCallee malloc();
+	// void _free_sized(i8*, i64), frees a block from malloc() of the given
+	// size
+	llvm::FunctionCallee freeSized();
+	// void free(i8*), only for blocks smaller than large_alloc_threshold
+	llvm::FunctionCallee free();
+	// i8* _arena_alloc(i64)
+	llvm::FunctionCallee arenaAlloc();
+	// void _arena_reset()
+	llvm::FunctionCallee arenaReset();
+	// i8* _pool_alloc(i64)
+	llvm::FunctionCallee poolAlloc();
+	// void _pool_free(i8*)
+	llvm::FunctionCallee poolFree();
+	// i32 memcmp(i8*, i8*, i64)
+	llvm::FunctionCallee memcmp();
+	// void _copy_nontemporal(i8*, i8*, i64), memcpy() which doesn't pull
+	// the destination into the cache
+	llvm::FunctionCallee copyNontemporal();
+	// struct job { void (*run)(i8*); i8* arg; }, a call for a worker thread
+	llvm::StructType *jobType();
+	// void _run_jobs(job*, i64), runs the jobs on the worker threads and
+	// waits for them to finish
+	llvm::FunctionCallee runJobs();
+	// void _copy_bulk(i8*, i8*, i64), memcpy() for large copies, split
+	// across the worker threads
+	llvm::FunctionCallee copyBulk();
+	// void _string_free(i8*), frees the buffer of a heap string
+	llvm::FunctionCallee stringFree();
+	// i8* _string_grow(i8*, i64, i64), moves a uniquely owned heap string
+	// holding the given length into a buffer of a larger capacity
+	llvm::FunctionCallee stringGrow();
+	// void _string_release(i8*), drops a reference to a heap string
+	llvm::FunctionCallee stringRelease();
+	// void _string_retire(i8**, i8*), drops a reference to a heap string
+	// which a variable no longer holds, keeping its buffer as the spare
+	// buffer of the variable if the string was unique
+	llvm::FunctionCallee stringRetire();
+	// i64 _string_hash(i8*, i64), returns the cached hash of a heap string
+	llvm::FunctionCallee stringHash();
+	// struct segment { i8* str; i64 len; }, a piece of a string
+	llvm::StructType *segmentType();
+	// i1 _segments_equal(segment*, i64, segment*, i64), compares the
+	// concatenations of two segment arrays of the same total length
+	llvm::FunctionCallee segmentsEqual();
+	// void _runtime_error(i8*), flushes the output, prints the message and
+	// exits with status 1
+	llvm::FunctionCallee runtimeError();
+	// void _length_overflow(), fails with a runtime error for a string
+	// longer than max_string_length
+	llvm::FunctionCallee lengthOverflow();
+	// void _int_overflow(), fails with a runtime error for an int sum above
+	// INT64_MAX
+	llvm::FunctionCallee intOverflow();
+	// i64 _format_int(i8* buf, i64 value), writes the decimal digits of a
+	// non-negative int to a buffer of at least 20 bytes and returns their
+	// count
+	llvm::FunctionCallee formatInt();
+	// void _out_write(i8*, i64), writes a string to the output of the
+	// program, stdout unless redirected by _out_open()
+	llvm::FunctionCallee outWrite();
+	// void _out_flush(), writes out what the output buffers
+	llvm::FunctionCallee outFlush();
+	// void _out_open(i8*), sends the output to a new file at the given path
+	llvm::FunctionCallee outOpen();
+	// void _out_close(), closes the file of _out_open(), sending the output
+	// back to stdout
+	llvm::FunctionCallee outClose();
+	// void _trace_open(i8* path, i8* names, i64 names_size), creates the
+	// trace file of --trace, see trace.hpp
+	llvm::FunctionCallee traceOpen();
+	// void _trace_record(i32 position, i32 variable, i8* str, i64 len),
+	// appends an assignment to the trace
+	llvm::FunctionCallee traceRecord();
+	// void _runtime_shutdown(), flushes the output and releases memory
+	// cached by the runtime
+	llvm::FunctionCallee shutdown();
+	// void _runtime_print_stats()
+	llvm::FunctionCallee printStats();
+
+  private:
+	llvm::Module &module;
+	llvm::LLVMContext &ctx;
+	const CodeGenOptions options;
+	llvm::IRBuilder<> builder;
+
+	llvm::GlobalVariable *stats_malloc_count = nullptr;
+	llvm::GlobalVariable *arena_chunk = nullptr;
+	llvm::GlobalVariable *arena_ptr = nullptr;
+	llvm::GlobalVariable *arena_end = nullptr;
+	llvm::GlobalVariable *arena_total = nullptr;
+	llvm::GlobalVariable *pool_free_lists = nullptr;
+	llvm::GlobalVariable *out_buf = nullptr;
+	llvm::GlobalVariable *out_len = nullptr;
+	llvm::GlobalVariable *out_fd = nullptr;
+	llvm::GlobalVariable *trace_header = nullptr;
+	llvm::GlobalVariable *trace_records = nullptr;
+	llvm::GlobalVariable *trace_size = nullptr;
+	llvm::GlobalVariable *worker_count = nullptr;
+	llvm::GlobalVariable *workers = nullptr;
+	llvm::GlobalVariable *worker_jobs = nullptr;
+	llvm::GlobalVariable *worker_lock = nullptr;
+	llvm::GlobalVariable *worker_wake = nullptr;
+	llvm::GlobalVariable *worker_done = nullptr;
+	llvm::GlobalVariable *worker_generation = nullptr;
+	llvm::GlobalVariable *worker_pending = nullptr;
+	llvm::GlobalVariable *worker_quit = nullptr;
+	llvm::GlobalVariable *workers_busy = nullptr;
+
+	llvm::Function *beginFunction(const std::string &name,
+	                              llvm::Type *return_type,
+	                              llvm::ArrayRef<llvm::Type *> params);
+	llvm::GlobalVariable *createGlobal(llvm::Type *type,
+	                                   const std::string &name);
+	void genArenaFreeChunks();
+	void genArenaRelease();
+	void genPoolRelease();
+	llvm::Value *genHugePageRound(llvm::Value *size);
+	llvm::FunctionCallee pthreadFunction(const std::string &name,
+	                                     unsigned params);
+	void genRunJob(llvm::Value *job);
+	llvm::Function *genWorkerMain();
+	llvm::Function *genWorkersStart();
+	void genWorkersStop();
+	llvm::StructType *copyPartType();
+	llvm::StructType *iovecType();
+	llvm::Function *genWriteVectors();
+	void createOutput();
+	llvm::StructType *traceHeaderType();
+	llvm::StructType *traceRecordType();
+	void genTraceClose();
+	void genCopyPart(llvm::Value *dst, llvm::Value *src, llvm::Value *n,
+	                 llvm::Value *streaming);
+};
+
+} // namespace compiler
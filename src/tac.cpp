@@ -106,6 +106,7 @@ TAC::Literal TAC::makeLiteral(const std::string &value,
 
 TAC::TAC(const ProgramNode &ast) {
 	translateVariableDeclaration(*ast.variables);
+	translateVariableDeclaration(*ast.int_variables);
 	translateStatements(*ast.statements);
 }
 
@@ -185,18 +186,20 @@ void TAC::translateDoWhileStatement(const DoWhileStatementNode &node) {
 }
 
 TAC::Value TAC::translateExpression(const ExpressionNode &node) {
+	// string + string concats, int + int adds
 	auto x = translateItem(*node.items[0]);
+	auto type = typeOf(x);
 	for (size_t i = 1; i < node.items.size(); i++) {
 		auto y = translateItem(*node.items[i]);
-		if (typeOf(x) != "string") {
-			throw CompileException(node.items[0]->position_begin,
-			                       "Concat operation requires string operands");
+		if (typeOf(y) != type && type == "int") {
+			throw CompileException(node.items[i]->position_begin,
+			                       "Add operation requires int operands");
 		}
-		if (typeOf(y) != "string") {
+		if (typeOf(y) != type) {
 			throw CompileException(node.items[i]->position_begin,
 			                       "Concat operation requires string operands");
 		}
-		auto tmp = tempVar("string");
+		auto tmp = tempVar(type);
 		generate("+", x, y, tmp);
 		x = tmp;
 	}
@@ -204,15 +207,14 @@ TAC::Value TAC::translateExpression(const ExpressionNode &node) {
 }
 
 TAC::Value TAC::translateCondition(const ConditionNode &node) {
+	// strings compare by length or content, ints by value
 	auto x = translateExpression(*node.lhs);
 	auto y = translateExpression(*node.rhs);
-	if (typeOf(x) != "string") {
-		throw CompileException(node.lhs->position_begin,
-		                       "Relation operator requires string operands");
-	}
-	if (typeOf(y) != "string") {
+	if (typeOf(x) != typeOf(y)) {
 		throw CompileException(node.rhs->position_begin,
-		                       "Relation operator requires string operands");
+		                       "Relation operator requires operands of the "
+		                       "same type: " +
+		                           typeOf(x) + " vs " + typeOf(y));
 	}
 	std::string op;
 	switch (node.op) {
@@ -252,6 +254,21 @@ TAC::Value TAC::translateItem(const ItemNode &node) {
 		generate("*", x, arg2, tmp);
 		x = tmp;
 	}
+	for (const auto &repeat_variable : node.repeat_variables) {
+		if (typeOf(x) != "string") {
+			throw CompileException(node.factor->position_begin,
+			                       "Repeat operator requires string operands");
+		}
+		auto arg2 = lookupVar(repeat_variable, node.position_begin);
+		if (arg2.type != "int") {
+			throw CompileException(node.position_begin,
+			                       "Repeat count is not an int: " +
+			                           repeat_variable);
+		}
+		auto tmp = tempVar("string");
+		generate("*", x, arg2, tmp);
+		x = tmp;
+	}
 	return x;
 }
 
@@ -259,6 +276,9 @@ TAC::Value TAC::translateFactor(const FactorNode &node) {
 	if (typeid(node) == typeid(StringFactorNode)) {
 		return translateStringFactor(
 		    dynamic_cast<const StringFactorNode &>(node));
+	} else if (typeid(node) == typeid(IntegerFactorNode)) {
+		return translateIntegerFactor(
+		    dynamic_cast<const IntegerFactorNode &>(node));
 	} else if (typeid(node) == typeid(VariableFactorNode)) {
 		return translateVariableFactor(
 		    dynamic_cast<const VariableFactorNode &>(node));
@@ -274,6 +294,10 @@ TAC::Value TAC::translateStringFactor(const StringFactorNode &node) {
 	return makeLiteral(node.str, "string");
 }
 
+TAC::Value TAC::translateIntegerFactor(const IntegerFactorNode &node) {
+	return makeLiteral(std::to_string(node.value), "int");
+}
+
 TAC::Value TAC::translateVariableFactor(const VariableFactorNode &node) {
 	return lookupVar(node.identifier, node.position_begin);
 }
@@ -90,6 +90,7 @@ class TAC {
 	Value translateItem(const ItemNode &node);
 	Value translateFactor(const FactorNode &node);
 	Value translateStringFactor(const StringFactorNode &node);
+	Value translateIntegerFactor(const IntegerFactorNode &node);
 	Value translateVariableFactor(const VariableFactorNode &node);
 	Value translateExpressionFactor(const ExpressionFactorNode &node);
 };
@@ -34,6 +34,8 @@ std::string to_string(TokenType x) {
 		return "OP_EQUAL";
 	case TokenType::KEYWORD_STRING:
 		return "KEYWORD_STRING";
+	case TokenType::KEYWORD_INT:
+		return "KEYWORD_INT";
 	case TokenType::KEYWORD_START:
 		return "KEYWORD_START";
 	case TokenType::KEYWORD_ELSE:
@@ -96,6 +98,8 @@ enum class Tokenizer::State {
 	KEYWORD_WHILE,
 	N_I,
 	KEYWORD_IF,
+	N_IN,
+	KEYWORD_INT,
 	N_D,
 	KEYWORD_DO,
 	IDENTIFIER,
@@ -479,6 +483,8 @@ Token Tokenizer::next() {
 		case State::N_I:
 			if (ch == 'f') {
 				state = State::KEYWORD_IF;
+			} else if (ch == 'n') {
+				state = State::N_IN;
 			} else if (is_letter(ch) || is_digit(ch)) {
 				state = State::IDENTIFIER;
 			} else {
@@ -491,6 +497,21 @@ Token Tokenizer::next() {
 			back();
 			return emit(TokenType::KEYWORD_IF);
 
+		case State::N_IN:
+			if (ch == 't') {
+				state = State::KEYWORD_INT;
+			} else if (is_letter(ch) || is_digit(ch)) {
+				state = State::IDENTIFIER;
+			} else {
+				back();
+				return emit(TokenType::IDENTIFIER);
+			}
+			break;
+
+		case State::KEYWORD_INT:
+			back();
+			return emit(TokenType::KEYWORD_INT);
+
 		case State::N_D:
 			if (ch == 'o') {
 				state = State::KEYWORD_DO;
@@ -516,8 +537,13 @@ Token Tokenizer::next() {
 			break;
 
 		case State::NUMBER:
-			back();
-			return emit(TokenType::NUMBER);
+			if (is_digit(ch)) {
+				state = State::NUMBER;
+			} else {
+				back();
+				return emit(TokenType::NUMBER);
+			}
+			break;
 
 		case State::N_STRING_INCOMPLETE:
 			if (is_letter(ch)) {
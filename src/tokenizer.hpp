@@ -23,6 +23,7 @@ enum class TokenType {
 	OP_ASSIGNMENT,
 	OP_EQUAL,
 	KEYWORD_STRING,
+	KEYWORD_INT,
 	KEYWORD_START,
 	KEYWORD_ELSE,
 	KEYWORD_END,
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace compiler {
+
+// The binary assignment trace of a program compiled with --trace. The file
+// starts with a TraceHeader, followed by the names of the traced variables,
+// each terminated by a NUL. At records_offset, the next multiple of the
+// record size, follows a ring of capacity TraceRecords. Assignment number n
+// is stored in record n % capacity, so the file holds the last capacity
+// assignments of the program.
+
+static constexpr char trace_magic[8] = {'S', 'T', 'R', 'T',
+                                        'R', 'A', 'C', 'E'};
+static constexpr uint32_t trace_version = 1;
+// a power of two
+static constexpr uint64_t trace_capacity = 1 << 20;
+static constexpr size_t trace_prefix_size = 40;
+
+struct TraceHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t capacity;
+	// assignments recorded so far
+	uint64_t count;
+	uint64_t names_size;
+	uint64_t records_offset;
+};
+
+struct TraceRecord {
+	// of the assignment in the source program
+	uint32_t position;
+	// index of the variable in the names
+	uint32_t variable;
+	uint64_t length;
+	// with -H, the hash of a value longer than the prefix if the program
+	// computed it already, otherwise 0
+	uint64_t hash;
+	// the first bytes of the value
+	char prefix[trace_prefix_size];
+};
+
+// The runtime builds the same layouts as LLVM structs.
+static_assert(sizeof(TraceHeader) == 48);
+static_assert(offsetof(TraceHeader, count) == 24);
+static_assert(sizeof(TraceRecord) == 64);
+static_assert(offsetof(TraceRecord, prefix) == 24);
+
+} // namespace compiler
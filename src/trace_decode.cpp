@@ -0,0 +1,146 @@
+#include "trace.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using compiler::TraceHeader;
+using compiler::TraceRecord;
+
+static bool opt_help = false;
+static bool opt_positions = false;
+static std::string opt_trace_file;
+
+static bool parse_commandline(int argc, char *argv[]) {
+	int idx = 1;
+	while (idx < argc) {
+		std::string arg = argv[idx];
+
+		if (arg == "-h" || arg == "--help") {
+			opt_help = true;
+			idx++;
+
+		} else if (arg == "-p" || arg == "--positions") {
+			opt_positions = true;
+			idx++;
+
+		} else if (!arg.empty() && arg[0] != '-' && opt_trace_file.empty()) {
+			opt_trace_file = arg;
+			idx++;
+
+		} else {
+			std::cerr << "error: unrecognized argument: " << arg << "\n";
+			return false;
+		}
+	}
+	if (!opt_help && opt_trace_file.empty()) {
+		std::cerr << "error: no trace file\n";
+		return false;
+	}
+	return true;
+}
+
+static void print_help() {
+	std::cout << R"(trace-decode - Prints the assignment trace of a program
+
+Usage: trace-decode [options] <trace file>
+
+Options:
+  -h/--help           prints this help text
+  -p/--positions      print the source position of each assignment
+
+The trace file is written by a program compiled with --trace <path>. Each
+assignment is printed as in debug mode, "<variable> := <value>". Values
+longer than the recorded prefix are cut off, followed by their length, and
+by their hash if the program compiled with -H/--hash has computed it.
+)";
+}
+
+static bool decode(const std::vector<char> &trace) {
+	TraceHeader header;
+	if (trace.size() < sizeof(header)) {
+		std::cerr << "error: the trace file is truncated\n";
+		return false;
+	}
+	std::memcpy(&header, trace.data(), sizeof(header));
+	if (std::memcmp(header.magic, compiler::trace_magic,
+	                sizeof(header.magic)) != 0 ||
+	    header.version != compiler::trace_version ||
+	    header.record_size != sizeof(TraceRecord) || header.capacity == 0) {
+		std::cerr << "error: not a trace file of this version\n";
+		return false;
+	}
+	if (header.records_offset < sizeof(header) + header.names_size ||
+	    header.records_offset > trace.size() ||
+	    (trace.size() - header.records_offset) / sizeof(TraceRecord) <
+	        header.capacity) {
+		std::cerr << "error: the trace file is truncated\n";
+		return false;
+	}
+
+	std::vector<std::string> names;
+	const char *names_ptr = trace.data() + sizeof(header);
+	const char *names_end = names_ptr + header.names_size;
+	while (names_ptr < names_end) {
+		names.emplace_back(names_ptr,
+		                   strnlen(names_ptr, names_end - names_ptr));
+		names_ptr += names.back().size() + 1;
+	}
+
+	uint64_t first = 0;
+	if (header.count > header.capacity) {
+		first = header.count - header.capacity;
+		std::cerr << "note: the first " << first
+		          << " assignments were overwritten\n";
+	}
+	for (uint64_t seq = first; seq < header.count; seq++) {
+		TraceRecord record;
+		std::memcpy(&record,
+		            trace.data() + header.records_offset +
+		                seq % header.capacity * sizeof(TraceRecord),
+		            sizeof(record));
+		if (opt_positions) {
+			std::cout << "@" << record.position << " ";
+		}
+		if (record.variable < names.size()) {
+			std::cout << names[record.variable];
+		} else {
+			std::cout << "<variable " << record.variable << ">";
+		}
+		std::cout << " := ";
+		if (record.length <= sizeof(record.prefix)) {
+			std::cout.write(record.prefix, record.length);
+		} else {
+			std::cout.write(record.prefix, sizeof(record.prefix));
+			std::cout << "... (" << record.length << " bytes";
+			if (record.hash != 0) {
+				std::cout << ", hash " << std::hex << record.hash << std::dec;
+			}
+			std::cout << ")";
+		}
+		std::cout << "\n";
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	if (!parse_commandline(argc, argv)) {
+		return 1;
+	}
+	if (opt_help) {
+		print_help();
+		return 0;
+	}
+
+	std::ifstream in(opt_trace_file, std::ios::binary);
+	if (!in) {
+		std::cerr << "error: cannot open " << opt_trace_file << "\n";
+		return 1;
+	}
+	in.seekg(0, std::ios::end);
+	std::vector<char> trace(in.tellg());
+	in.seekg(0);
+	in.read(trace.data(), trace.size());
+	return decode(trace) ? 0 : 1;
+}